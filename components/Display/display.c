@@ -24,6 +24,7 @@
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "display.h"
 #include "fonts.h"
 
@@ -45,8 +46,39 @@
 #define LCD_DC_LOW		reset_pin(lcd->spi_data.dc_pin);
 #define LCD_DC_HI		set_pin(lcd->spi_data.dc_pin);
 
+#define LCD_QUEUE_HOSTS	3	//SPI1 - SPI3
+
 LCD_Handler *LCD = 0; //display list
 
+//транзакция очереди: командная строка (str_len != 0) либо блок данных
+typedef struct {
+	LCD_Handler *lcd;
+	uint8_t str[LCD_QUEUE_STR_LEN];	//команды с параметрами (без пауз и признака завершения)
+	uint8_t str_len;
+	uint16_t *data;
+	uint32_t len;					//длина блока данных, байт
+	LCD_QueueCallback callback;
+	void *arg;
+} LCD_QueueItem;
+
+//очередь транзакций хоста spi
+typedef struct {
+	spi_dev_t *spi;
+	LCD_QueueItem items[LCD_QUEUE_LEN];
+	volatile uint32_t head;			//индекс текущей транзакции
+	volatile uint32_t count;		//количество транзакций в очереди
+	volatile uint8_t active;		//в очереди есть транзакции, синхронные функции вывода ожидают ее опустошения
+	volatile uint8_t running;		//транзакции запускаются из прерывания
+	uint32_t pos;					//позиция текущего шага в транзакции
+	uint8_t phase;					//0 - передача команды, 1 - передача параметров команды
+	LCD_Handler *cs_lcd;			//дисплей, выбранный очередью (CS = 0)
+	SemaphoreHandle_t done;			//отдается прерыванием по завершении каждой транзакции
+	SemaphoreHandle_t idle;			//отдается после опустошения очереди (снятия active)
+} LCD_Queue;
+
+static LCD_Queue *LCD_Queues[LCD_QUEUE_HOSTS];
+static portMUX_TYPE LCD_QueueMux = portMUX_INITIALIZER_UNLOCKED;
+
 static inline void set_pin(int pin_num)
 {
 	if (pin_num >= 0) {
@@ -84,9 +116,217 @@ static inline uint32_t read_pin(int pin_num)
 	return 0;
 }
 
+//настраивает связанный список дескрипторов для блока данных длиной len байт и запускает выходной канал DMA
+IRAM_ATTR static void LCD_DMA_Start(LCD_Handler *lcd, uint8_t *data_ptr, uint32_t len)
+{
+	spi_dev_t *spi = lcd->spi_data.spi;
+	uint32_t all_dscr_lnk = len / 4092;
+	if (len % 4092) all_dscr_lnk++;
+
+	//Set the length of the sent data.
+	spi->mosi_dlen.usr_mosi_dbitlen = len * 8 - 1;
+
+	for (uint32_t i = 0; i < all_dscr_lnk; i++) {
+		lcd->dma_descriptor_link[i].owner = 1;
+		if (i == all_dscr_lnk - 1) {
+			lcd->dma_descriptor_link[i].eof = 1;
+			lcd->dma_descriptor_link[i].next_link = 0;
+		}
+		else {
+			lcd->dma_descriptor_link[i].eof = 0;
+			lcd->dma_descriptor_link[i].next_link = &lcd->dma_descriptor_link[i+1];
+		}
+		lcd->dma_descriptor_link[i].reserved = 0;
+		lcd->dma_descriptor_link[i].lenght = len > 4092 ? 4092 : (len + 15) & 4092;
+		lcd->dma_descriptor_link[i].size = len > 4092 ? 4092 : (len + 15) & 4092;
+		lcd->dma_descriptor_link[i].buf = data_ptr;
+		len -= 4092;
+		data_ptr += 4092;
+	}
+	spi->dma_out_link.addr = ((uint32_t)&lcd->dma_descriptor_link[0]) & 0xFFFFF; //First link addr
+
+	//Reset the DMA state machine and FIFO parameters.
+	spi->dma_conf.val = SPI_AHBM_RST | SPI_AHBM_FIFO_RST | SPI_OUT_RST | SPI_IN_RST; //Reset: sets and then clears (in next string) the corresponding bits
+	spi->dma_conf.val = SPI_OUT_EOF_MODE | SPI_OUT_DATA_BURST_EN | SPI_OUTDSCR_BURST_EN; //reset complete, set burst, set eof mode
+
+	spi->dma_out_link.start = 1; //Start to use outlink descriptor
+
+	while (!(spi->dma_rx_status & (1UL << 30))) ;  //Waiting for the FIFO of the DMA buffer to be
+										   	   	   //filled with the first data packet from memory (bit 30 SPI_DMA_RSTATUS_REG)
+}
+
+//возвращает очередь транзакций хоста spi либо 0, если очередь для хоста не создана
+IRAM_ATTR static LCD_Queue* LCD_QueueFind(spi_dev_t *spi)
+{
+	for (int i = 0; i < LCD_QUEUE_HOSTS; i++) {
+		if (LCD_Queues[i] && LCD_Queues[i]->spi == spi) {
+			return LCD_Queues[i];
+		}
+	}
+	return 0;
+}
+
+//создает очередь транзакций для хоста spi (если она еще не создана)
+static void LCD_QueueCreate(spi_dev_t *spi)
+{
+	if (LCD_QueueFind(spi)) return;
+	for (int i = 0; i < LCD_QUEUE_HOSTS; i++) {
+		if (!LCD_Queues[i]) {
+			LCD_Queue *q = (LCD_Queue*)calloc(1, sizeof(LCD_Queue));
+			if (!q) return;
+			q->done = xSemaphoreCreateBinary();
+			q->idle = xSemaphoreCreateBinary();
+			if (!q->done || !q->idle) {
+				if (q->done) vSemaphoreDelete(q->done);
+				if (q->idle) vSemaphoreDelete(q->idle);
+				free(q);
+				return;
+			}
+			q->spi = spi;
+			LCD_Queues[i] = q;
+			return;
+		}
+	}
+}
+
+//запускает очередной шаг текущей транзакции очереди: передачу команды, ее параметров либо блока данных по DMA.
+//Возвращает 0, если все шаги транзакции выполнены.
+IRAM_ATTR static int LCD_QueueStep(LCD_Queue *q)
+{
+	LCD_QueueItem *item = &q->items[q->head];
+	LCD_Handler *lcd = item->lcd;
+	spi_dev_t *spi = q->spi;
+	if (item->str_len) {
+		if (q->pos >= item->str_len) return 0;
+		uint8_t cmd = item->str[q->pos], par_num = item->str[q->pos + 1];
+		if (!q->phase) {
+			//------------- send command -----------
+			LCD_DC_LOW
+			spi->user.usr_mosi_highpart = 0;
+			spi->mosi_dlen.usr_mosi_dbitlen = 8 - 1;
+			spi->data_buf[0] = cmd;
+			if (par_num) q->phase = 1;
+			else q->pos += 2;
+		}
+		else {
+			//---------- send parameters -----------
+			LCD_DC_HI
+			memcpy((void*)&spi->data_buf[8], &item->str[q->pos + 2], par_num);
+			spi->user.usr_mosi_highpart = 1;
+			spi->mosi_dlen.usr_mosi_dbitlen = par_num * 8 - 1;
+			q->phase = 0;
+			q->pos += par_num + 2;
+		}
+	}
+	else {
+		if (q->pos || !item->len) return 0;		//блок передан либо транзакция только с коллбэком
+		LCD_DC_HI
+		spi->user.usr_mosi_highpart = 0;
+		LCD_DMA_Start(lcd, (uint8_t*)item->data, item->len);
+		q->pos = item->len;
+	}
+	//Clear all interrupt status bits and enable only the "spi operation done" interrupt.
+	spi->slave.val = (spi->slave.val & (~0x3ff)) | (1UL << 9);
+	spi->cmd.usr = 1;
+	return 1;
+}
+
+//выполняет транзакции очереди, пока очередь не опустеет. Каждый шаг транзакции запускается
+//по прерыванию о завершении предыдущего. Вызывается задачей, запускающей очередь, и из прерывания.
+IRAM_ATTR static void LCD_QueueRun(LCD_Queue *q)
+{
+	LCD_Handler *lcd;
+	BaseType_t woken = pdFALSE;
+	while (1) {
+		LCD_QueueItem *item = &q->items[q->head];
+		if ((item->str_len || item->len) && q->cs_lcd != item->lcd) {		//выбор дисплея
+			if ((lcd = q->cs_lcd) && !lcd->cs_control) LCD_CS_HI
+			lcd = q->cs_lcd = item->lcd;
+			LCD_CS_LOW
+		}
+		if (LCD_QueueStep(q)) break;
+		//транзакция выполнена
+		if (item->callback) {
+			item->callback(item->lcd, item->arg);
+		}
+		portENTER_CRITICAL_ISR(&LCD_QueueMux);
+		q->head = (q->head + 1) % LCD_QUEUE_LEN;
+		q->count--;
+		q->pos = q->phase = 0;
+		uint32_t count = q->count;
+		portEXIT_CRITICAL_ISR(&LCD_QueueMux);
+		xSemaphoreGiveFromISR(q->done, &woken);
+		if (count) continue;
+		//очередь пуста: снимаем выбор дисплея и возвращаем шину синхронным функциям
+		spi_dev_t *spi = q->spi;
+		//Clear all interrupt status bits and disable all spi interrupts.
+		spi->slave.val &= ~0x3ff;
+		spi->user.usr_mosi_highpart = 0;
+		if ((lcd = q->cs_lcd) && !lcd->cs_control) LCD_CS_HI
+		q->cs_lcd = 0;
+		portENTER_CRITICAL_ISR(&LCD_QueueMux);
+		count = q->count;		//пока снимался выбор дисплея, могла быть добавлена транзакция
+		if (!count) {
+			q->running = 0;
+			q->active = 0;
+		}
+		portEXIT_CRITICAL_ISR(&LCD_QueueMux);
+		if (!count) {
+			xSemaphoreGiveFromISR(q->idle, &woken);
+			break;
+		}
+	}
+	portYIELD_FROM_ISR(woken);
+}
+
+//ставит транзакцию в очередь хоста spi и при необходимости запускает очередь
+static void LCD_QueuePut(LCD_Handler *lcd, LCD_QueueItem *item)
+{
+	spi_dev_t *spi = lcd->spi_data.spi;
+	LCD_Queue *q = LCD_QueueFind(spi);
+	uint8_t start = 0;
+	while (1) {
+		portENTER_CRITICAL(&LCD_QueueMux);
+		if (q->count < LCD_QUEUE_LEN) {
+			q->items[(q->head + q->count) % LCD_QUEUE_LEN] = *item;
+			q->count++;
+			if (!q->active) {
+				q->active = start = 1;
+			}
+			portEXIT_CRITICAL(&LCD_QueueMux);
+			break;
+		}
+		portEXIT_CRITICAL(&LCD_QueueMux);
+		xSemaphoreTake(q->done, 1);		//ожидание освобождения места в очереди
+	}
+	if (!start) return;
+	//Waiting for the end of the synchronous transaction and its interrupt processing.
+	while (spi->cmd.usr || (spi->slave.val & (1UL << 9))) ;
+	q->running = 1;
+	LCD_QueueRun(q);
+}
+
+//ожидает опустошения очереди хоста spi перед синхронным выводом. Семафор idle отдается после снятия active;
+//оставшийся от прошлого опустошения семафор лишь повторяет проверку. Дождавшаяся задача отдает семафор
+//снова, чтобы проснулись и другие ожидающие.
+static inline void LCD_QueueWaitIdle(spi_dev_t *spi)
+{
+	LCD_Queue *q = LCD_QueueFind(spi);
+	if (!q || !q->active) return;
+	while (q->active) {
+		xSemaphoreTake(q->idle, portMAX_DELAY);
+	}
+	xSemaphoreGive(q->idle);
+}
+
 IRAM_ATTR void LCD_TC_Callback(void *arg)
 {
 	spi_dev_t *spi = (spi_dev_t*)arg;
+	LCD_Queue *q = LCD_QueueFind(spi);
+	if (q && q->running) {
+		LCD_QueueRun(q);
+		return;
+	}
 	LCD_Handler *lcd = LCD;
 	while (lcd) {
 		if (spi == lcd->spi_data.spi) {
@@ -96,12 +336,12 @@ IRAM_ATTR void LCD_TC_Callback(void *arg)
 					continue;
 				}
 			}
-			//Clear all interrupt status bits and disable all spi interrupts.
-			spi->slave.val &= ~0x3ff;
 			if (!lcd->cs_control) {
 			//	while (spi->ext2.st) ; //spi idle state
 				LCD_CS_HI
 			}
+			//Clear all interrupt status bits and disable all spi interrupts.
+			spi->slave.val &= ~0x3ff;
 			break;
 		}
 		lcd	= (LCD_Handler*)lcd->next;
@@ -132,6 +372,7 @@ inline void LCD_ResDC(LCD_Handler *lcd)
 void LCD_String_Interpretator(LCD_Handler* lcd, const uint8_t *str)
 {
 	spi_dev_t *spi = lcd->spi_data.spi;
+	LCD_QueueWaitIdle(spi);
 	while (spi->cmd.usr) ;
 
 	//Clear all interrupt status bits and disable all spi interrupts.
@@ -279,6 +520,7 @@ LCD_Handler* LCD_DisplayAdd(LCD_Handler *lcds,
 		int all_descr_lnk = (2 * lcd->Width * lcd->Height) / 4092;
 		if ((2 * lcd->Width * lcd->Height) % 4092) all_descr_lnk++;
 		lcd->dma_descriptor_link = (LCD_DMA_descriptor_link*)calloc(all_descr_lnk, sizeof(LCD_DMA_descriptor_link));
+		LCD_QueueCreate(lcd->spi_data.spi);
 	}
 	if (!lcds) {
 		return lcd;
@@ -335,7 +577,8 @@ inline uint16_t LCD_GetHeight(LCD_Handler* lcd)
 //дисплей занят, если занято spi, к которому он подключен
 inline LCD_State LCD_GetState(LCD_Handler* lcd)
 {
-	if (lcd->spi_data.spi->cmd.usr) {
+	LCD_Queue *q = LCD_QueueFind(lcd->spi_data.spi);
+	if (lcd->spi_data.spi->cmd.usr || (q && q->active)) {
 		return LCD_STATE_BUSY;
 	}
 	return LCD_STATE_READY;
@@ -387,48 +630,100 @@ void LCD_SetActiveWindow(LCD_Handler* lcd, uint16_t x1, uint16_t y1, uint16_t x2
 	LCD_String_Interpretator(lcd, lcd->SetActiveWindow_callback(x1 + lcd->x_offs, y1 + lcd->y_offs, x2 + lcd->x_offs, y2 + lcd->y_offs));
 }
 
+//копирует командную строку в транзакцию очереди (паузы пропускаются: транзакции выполняются в прерывании).
+//Возвращает 0, если строка не помещается в транзакцию.
+static int LCD_QueueCopyString(LCD_QueueItem *item, const uint8_t *str)
+{
+	uint8_t par_num;
+	item->str_len = 0;
+	while (1) {
+		par_num = str[1];
+		if (par_num == 255) break;					//eof command string
+		if (par_num < 20) {
+			if (item->str_len + par_num + 2 > LCD_QUEUE_STR_LEN) return 0;
+			memcpy(&item->str[item->str_len], str, par_num + 2);
+			item->str_len += par_num + 2;
+			str += par_num;
+		}
+		str += 2;
+	}
+	return 1;
+}
+
+//ставит в очередь установку окна вывода. Без DMA, а также для командной строки длиннее LCD_QUEUE_STR_LEN
+//окно устанавливается сразу.
+void LCD_QueueSetActiveWindow(LCD_Handler* lcd, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
+{
+	const uint8_t *str = lcd->SetActiveWindow_callback(x1 + lcd->x_offs, y1 + lcd->y_offs, x2 + lcd->x_offs, y2 + lcd->y_offs);
+	if (!LCD_QueueFind(lcd->spi_data.spi)) {
+		LCD_String_Interpretator(lcd, str);
+		return;
+	}
+	LCD_QueueItem item = { .lcd = lcd };
+	if (!LCD_QueueCopyString(&item, str)) {		//длинная строка выводится синхронно после опустошения очереди
+		LCD_String_Interpretator(lcd, str);
+		return;
+	}
+	if (!item.str_len) return;
+	LCD_QueuePut(lcd, &item);
+}
+
+//ставит в очередь передачу len точек из буфера data. Без DMA данные передаются сразу,
+//а коллбэк вызывается из задачи.
+void LCD_QueueWriteData(LCD_Handler *lcd, uint16_t *data, uint32_t len, LCD_QueueCallback callback, void *arg)
+{
+	LCD_Queue *q = LCD_QueueFind(lcd->spi_data.spi);
+	if (!len) {		//пустой блок: шина не используется, коллбэк - после поставленных ранее транзакций
+		if (q && q->active) {
+			LCD_QueueItem item = { .lcd = lcd, .callback = callback, .arg = arg };
+			LCD_QueuePut(lcd, &item);
+		}
+		else if (callback) callback(lcd, arg);
+		return;
+	}
+	if (!q) {
+		if (!lcd->cs_control) LCD_CS_LOW
+		LCD_DC_HI
+		LCD_WriteData(lcd, data, len);
+		if (!lcd->cs_control) LCD_CS_HI
+		if (callback) callback(lcd, arg);
+		return;
+	}
+	LCD_QueueItem item = { .lcd = lcd, .data = data, .len = len * 2, .callback = callback, .arg = arg };
+	LCD_QueuePut(lcd, &item);
+}
+
+//коллбэк завершения транзакции: уведомляет задачу arg
+IRAM_ATTR void LCD_QueueNotifyCallback(LCD_Handler *lcd, void *arg)
+{
+	(void)lcd;
+	if (xPortInIsrContext()) {
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveFromISR((TaskHandle_t)arg, &woken);
+		portYIELD_FROM_ISR(woken);
+	}
+	else {
+		xTaskNotifyGive((TaskHandle_t)arg);
+	}
+}
+
+//ожидает выполнения всех транзакций в очереди хоста spi
+void LCD_QueueWait(LCD_Handler *lcd)
+{
+	LCD_QueueWaitIdle(lcd->spi_data.spi);
+}
+
 //В тесте 87 fps при spi_clock = 80 MHz (240 x 240 x 2)
 void LCD_WriteDataDMA(LCD_Handler *lcd, uint16_t *data, uint32_t len)
 {
 	if (!len) return;
 	if (lcd->spi_data.dma_channel) { //if DMA available
 		spi_dev_t *spi = lcd->spi_data.spi;
+		LCD_QueueWaitIdle(spi);
 		while (spi->cmd.usr) ;
-		len *= 2;
-		uint8_t *data_ptr = (uint8_t*)data;
-		uint32_t all_dscr_lnk = len / 4092;
-		if (len % 4092) all_dscr_lnk++;
-
-		//Set the length of the sent data and run spi with DMA.
-		spi->mosi_dlen.usr_mosi_dbitlen = len * 8 - 1;
-
-		for (int i = 0; i < all_dscr_lnk; i++) {
-			lcd->dma_descriptor_link[i].owner = 1;
-			if (i == all_dscr_lnk - 1) {
-				lcd->dma_descriptor_link[i].eof = 1;
-				lcd->dma_descriptor_link[i].next_link = 0;
-			}
-			else {
-				lcd->dma_descriptor_link[i].eof = 0;
-				lcd->dma_descriptor_link[i].next_link = &lcd->dma_descriptor_link[i+1];
-			}
-			lcd->dma_descriptor_link[i].reserved = 0;
-			lcd->dma_descriptor_link[i].lenght = len > 4092 ? 4092 : (len + 15) & 4092;
-			lcd->dma_descriptor_link[i].size = len > 4092 ? 4092 : (len + 15) & 4092;
-			lcd->dma_descriptor_link[i].buf = data_ptr;
-			len -= 4092;
-			data_ptr += 4092;
-		}
-		spi->dma_out_link.addr = ((uint32_t)&lcd->dma_descriptor_link[0]) & 0xFFFFF; //First link addr
 
-		//Reset the DMA state machine and FIFO parameters.
-		spi->dma_conf.val = SPI_AHBM_RST | SPI_AHBM_FIFO_RST | SPI_OUT_RST | SPI_IN_RST; //Reset: sets and then clears (in next string) the corresponding bits
-		spi->dma_conf.val = SPI_OUT_EOF_MODE | SPI_OUT_DATA_BURST_EN | SPI_OUTDSCR_BURST_EN; //reset complete, set burst, set eof mode
-
-		spi->dma_out_link.start = 1; //Start to use outlink descriptor
-
-		while (!(spi->dma_rx_status & (1UL << 30))) ;  //Waiting for the FIFO of the DMA buffer to be
-											   	   	   //filled with the first data packet from memory (bit 30 SPI_DMA_RSTATUS_REG)
+		//Setting DMA links and start DMA.
+		LCD_DMA_Start(lcd, (uint8_t*)data, len * 2);
 
 		//Clear all interrupt status bits and enable only the "spi operation done" interrupt.
 		uint32_t int_en_done = spi->slave.val;
@@ -446,6 +741,7 @@ void LCD_WriteData(LCD_Handler *lcd, uint16_t *data, uint32_t len)
 {
 	if (!len) return;
 	spi_dev_t *spi = lcd->spi_data.spi;
+	LCD_QueueWaitIdle(spi);
 	while (spi->cmd.usr) ;
 	volatile uint32_t *ptr_buf;
 	uint32_t *ptr_data = (uint32_t *)data;
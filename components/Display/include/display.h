@@ -135,6 +135,13 @@ typedef struct {
 
 extern LCD_Handler *LCD;		//указатель на список дисплеев (первый дисплей в списке)
 
+//асинхронная очередь транзакций (одна на хост spi, используется при подключении с DMA)
+#define LCD_QUEUE_LEN		16		//максимальное количество транзакций в очереди
+#define LCD_QUEUE_STR_LEN	32		//максимальная длина командной строки транзакции, байт
+
+//коллбэк завершения транзакции очереди (вызывается из обработчика прерывания)
+typedef void (*LCD_QueueCallback)(LCD_Handler *lcd, void *arg);
+
 void LCD_SetCS(LCD_Handler *lcd);
 void LCD_ResCS(LCD_Handler *lcd);
 void LCD_SetDC(LCD_Handler *lcd);
@@ -190,6 +197,17 @@ void LCD_SetOrientation(LCD_Handler* lcd, LCD_PageOrientation orientation);
 void LCD_WriteData(LCD_Handler *lcd, uint16_t *data, uint32_t len);
 //отправляет данные на дисплей с использованием DMA
 void LCD_WriteDataDMA(LCD_Handler *lcd, uint16_t *data, uint32_t len);
+//ставит в очередь установку окна вывода и возвращает управление, не дожидаясь передачи
+void LCD_QueueSetActiveWindow(LCD_Handler* lcd, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2);
+//ставит в очередь передачу данных на дисплей и возвращает управление, не дожидаясь передачи.
+//Буфер data не должен изменяться до завершения транзакции, о котором сообщает callback (может быть 0).
+//Если очередь заполнена, ожидает освобождения места. Без DMA передача выполняется сразу.
+//При len = 0 шина не используется, callback вызывается после ранее поставленных транзакций.
+void LCD_QueueWriteData(LCD_Handler *lcd, uint16_t *data, uint32_t len, LCD_QueueCallback callback, void *arg);
+//коллбэк завершения транзакции, отправляющий уведомление задаче arg (TaskHandle_t)
+void LCD_QueueNotifyCallback(LCD_Handler *lcd, void *arg);
+//ожидает выполнения всех транзакций в очереди хоста spi, к которому подключен дисплей
+void LCD_QueueWait(LCD_Handler *lcd);
 //заливает окно с заданными координатами заданным цветом
 void LCD_FillWindow(LCD_Handler* lcd, uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint32_t color);
 //заливает весь экран заданным цветом
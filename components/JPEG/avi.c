@@ -0,0 +1,307 @@
+/*
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *	Воспроизведение видео Motion-JPEG в контейнере AVI
+ *
+ *	Кадры видеопотока находятся по индексу idx1 (при его отсутствии - просмотром списка movi),
+ *	каждый кадр (фрагмент 00dc) - отдельное jpeg изображение, которое читается в буфер
+ *	и распаковывается декодером JPEG_Decoder из памяти. Вывод кадров привязан к частоте кадров
+ *	файла: кадр выводится не раньше своего времени, а кадры, время которых уже прошло,
+ *	пропускаются по индексу без чтения и распаковки.
+ *
+ *  Допускается свободное распространение.
+ *  При любом способе распространения указание автора ОБЯЗАТЕЛЬНО.
+ *  В случае внесения изменений и распространения модификаций указание первоначального автора ОБЯЗАТЕЛЬНО.
+ *  Распространяется по типу "как есть", то есть использование осуществляется на свой страх и риск.
+ *  Автор не предоставляет никаких гарантий.
+ *
+ *  https://www.youtube.com/@VadRov
+ *  https://dzen.ru/vadrov
+ *  https://vk.com/vadrov
+ *  https://t.me/vadrov_channel
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "avi.h"
+#include "jpeg_chan.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define AVI_FOURCC(a, b, c, d)	((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+#define AVI_IDX1_BLOCK			16	//количество записей индекса, читаемых за один раз
+
+static uint32_t avi_u32 (const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int avi_read (FILE *f, uint32_t pos, void *buf, uint32_t len)
+{
+	if (fseek(f, pos, SEEK_SET)) return 0;
+	return fread(buf, 1, len, f) == len;
+}
+
+static int avi_is_mjpeg (uint32_t fcc)
+{
+	return fcc == AVI_FOURCC('M','J','P','G') || fcc == AVI_FOURCC('m','j','p','g') ||
+		   fcc == AVI_FOURCC('J','P','E','G') || fcc == AVI_FOURCC('j','p','e','g');
+}
+
+//Заголовки потока (список strl): 1 - видеопоток MJPEG.
+//us_per_frame - длительность кадра по частоте потока (не изменяется, если частота не задана)
+static int avi_parse_strl (FILE *f, uint32_t pos, uint32_t end, uint32_t *us_per_frame, uint16_t *width, uint16_t *height)
+{
+	uint8_t hdr[40];
+	int vids = 0, mjpeg = 0;
+	while (pos + 8 <= end) {
+		if (!avi_read(f, pos, hdr, 8)) return 0;
+		uint32_t id = avi_u32(hdr), size = avi_u32(hdr + 4);
+		if (id == AVI_FOURCC('s','t','r','h') && size >= 32 && avi_read(f, pos + 8, hdr, 32)) {
+			//fccType, fccHandler, ..., dwScale (20), dwRate (24)
+			vids = avi_u32(hdr) == AVI_FOURCC('v','i','d','s');
+			mjpeg |= avi_is_mjpeg(avi_u32(hdr + 4));
+			uint32_t scale = avi_u32(hdr + 20), rate = avi_u32(hdr + 24);
+			if (vids && scale && rate) *us_per_frame = (uint32_t)((uint64_t)scale * 1000000 / rate);
+		}
+		else if (id == AVI_FOURCC('s','t','r','f') && vids && size >= 20 && avi_read(f, pos + 8, hdr, 20)) {
+			//BITMAPINFOHEADER: biWidth (4), biHeight (8), biCompression (16)
+			*width = (uint16_t)avi_u32(hdr + 4);
+			*height = (uint16_t)avi_u32(hdr + 8);
+			mjpeg |= avi_is_mjpeg(avi_u32(hdr + 16));
+		}
+		pos += 8 + size + (size & 1);
+	}
+	return vids && mjpeg;
+}
+
+//Заголовки файла (список hdrl): длительность кадра, размеры кадра и номер видеопотока
+static int avi_parse_hdrl (AVI_Player *avi, FILE *f, uint32_t pos, uint32_t end, uint32_t *stream)
+{
+	uint8_t hdr[40];
+	uint32_t n = 0, avih_us = 0;
+	int found = 0;
+	while (pos + 8 <= end) {
+		if (!avi_read(f, pos, hdr, 12)) break;
+		uint32_t id = avi_u32(hdr), size = avi_u32(hdr + 4);
+		if (id == AVI_FOURCC('a','v','i','h') && size >= 40 && avi_read(f, pos + 8, hdr, 40)) {
+			//dwMicroSecPerFrame (0), ..., dwWidth (32), dwHeight (36)
+			avih_us = avi_u32(hdr);
+			avi->width = (uint16_t)avi_u32(hdr + 32);
+			avi->height = (uint16_t)avi_u32(hdr + 36);
+		}
+		else if (id == AVI_FOURCC('L','I','S','T') && avi_u32(hdr + 8) == AVI_FOURCC('s','t','r','l')) {
+			uint32_t us = 0;
+			uint16_t w = avi->width, h = avi->height;
+			if (!found && avi_parse_strl(f, pos + 12, pos + 8 + size, &us, &w, &h)) {
+				found = 1;
+				*stream = n;
+				avi->us_per_frame = us;
+				avi->width = w;
+				avi->height = h;
+			}
+			n++;
+		}
+		pos += 8 + size + (size & 1);
+	}
+	if (!avi->us_per_frame) avi->us_per_frame = avih_us;
+	return found;
+}
+
+//Фрагмент кадра видеопотока: "NNdc" (chunk_id) или "NNdb" - так кадры MJPEG записывают некоторые кодировщики
+static int avi_is_frame (uint32_t id, uint32_t chunk_id)
+{
+	return id == chunk_id || id == ((chunk_id & 0xFFFF) | AVI_FOURCC(0, 0, 'd', 'b'));
+}
+
+//Кадры по индексу idx1. Смещения записей отсчитываются от метки movi или от начала файла:
+//вариант определяется по первой записи видеопотока. frames = 0 - только подсчет кадров.
+static uint32_t avi_scan_idx1 (FILE *f, uint32_t pos, uint32_t size, uint32_t movi, uint32_t chunk_id, AVI_Frame *frames)
+{
+	uint8_t buf[AVI_IDX1_BLOCK * 16], hdr[4];
+	uint32_t count = 0, entries = size / 16, base = 0;
+	int base_found = 0;
+	for (uint32_t i = 0; i < entries; i += AVI_IDX1_BLOCK) {
+		uint32_t k = entries - i < AVI_IDX1_BLOCK ? entries - i : AVI_IDX1_BLOCK;
+		if (!avi_read(f, pos + i * 16, buf, k * 16)) return 0;
+		for (uint32_t j = 0; j < k; j++) {
+			const uint8_t *e = buf + j * 16;	//ckid, dwFlags, dwChunkOffset, dwChunkLength
+			if (!avi_is_frame(avi_u32(e), chunk_id)) continue;
+			uint32_t offset = avi_u32(e + 8);
+			if (!base_found) {
+				if (avi_read(f, movi + offset, hdr, 4) && avi_is_frame(avi_u32(hdr), chunk_id)) base = movi;
+				else if (!avi_read(f, offset, hdr, 4) || !avi_is_frame(avi_u32(hdr), chunk_id)) return 0;
+				base_found = 1;
+			}
+			if (frames) {
+				frames[count].offset = base + offset + 8;
+				frames[count].size = avi_u32(e + 12);
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+//Кадры просмотром списка movi (файл без индекса). frames = 0 - только подсчет кадров.
+static uint32_t avi_scan_movi (FILE *f, uint32_t pos, uint32_t end, uint32_t chunk_id, AVI_Frame *frames)
+{
+	uint8_t hdr[8];
+	uint32_t count = 0;
+	while (pos + 8 <= end) {
+		if (!avi_read(f, pos, hdr, 8)) break;
+		uint32_t id = avi_u32(hdr), size = avi_u32(hdr + 4);
+		if (id == AVI_FOURCC('L','I','S','T')) {	//список rec: фрагменты внутри него
+			pos += 12;
+			continue;
+		}
+		if (avi_is_frame(id, chunk_id)) {
+			if (frames) {
+				frames[count].offset = pos + 8;
+				frames[count].size = size;
+			}
+			count++;
+		}
+		pos += 8 + size + (size & 1);
+	}
+	return count;
+}
+
+//Открывает видео AVI с потоком MJPEG: разбор заголовков и построение индекса кадров.
+//file - открытый файл (FILE*), dec - декодер кадров. Файл должен оставаться открытым до AVI_Close.
+//Кадры MJPEG обычно используют одни и те же таблицы: декодер с кэшем таблиц (JPEG_Decoder_SetTableCache)
+//строит их только для первого кадра.
+AVI_Result AVI_Open (AVI_Player *avi, void *file, JPEG_Decoder *dec)
+{
+	FILE *f = (FILE*)file;
+	uint8_t hdr[12];
+	memset(avi, 0, sizeof(AVI_Player));
+	avi->file = file;
+	avi->dec = dec;
+	if (!avi_read(f, 0, hdr, 12)) return AVI_ERR_READ;
+	if (avi_u32(hdr) != AVI_FOURCC('R','I','F','F') || avi_u32(hdr + 8) != AVI_FOURCC('A','V','I',' ')) return AVI_ERR_FORMAT;
+	uint32_t end = 8 + avi_u32(hdr + 4), pos = 12;
+	uint32_t movi = 0, movi_end = 0, idx1 = 0, idx1_size = 0, stream = 0;
+	int video = 0;
+	while (pos + 8 <= end) {
+		if (!avi_read(f, pos, hdr, 12)) break;
+		uint32_t id = avi_u32(hdr), size = avi_u32(hdr + 4);
+		if (id == AVI_FOURCC('L','I','S','T')) {
+			uint32_t type = avi_u32(hdr + 8);
+			if (type == AVI_FOURCC('h','d','r','l')) video = avi_parse_hdrl(avi, f, pos + 12, pos + 8 + size, &stream);
+			else if (type == AVI_FOURCC('m','o','v','i')) {
+				movi = pos + 8;
+				movi_end = pos + 8 + size;
+			}
+		}
+		else if (id == AVI_FOURCC('i','d','x','1')) {
+			idx1 = pos + 8;
+			idx1_size = size;
+		}
+		pos += 8 + size + (size & 1);
+	}
+	if (!video || !movi) return AVI_ERR_FORMAT;
+	//фрагменты кадров видеопотока: "NNdc" или "NNdb", NN - номер потока
+	uint32_t chunk_id = AVI_FOURCC('0' + stream / 10 % 10, '0' + stream % 10, 'd', 'c');
+	uint32_t count = idx1 ? avi_scan_idx1(f, idx1, idx1_size, movi, chunk_id, 0) : 0;
+	if (!count) {
+		idx1 = 0;
+		count = avi_scan_movi(f, movi + 4, movi_end, chunk_id, 0);
+	}
+	if (!count) return AVI_ERR_NO_FRAMES;
+	avi->frames = (AVI_Frame*)heap_caps_malloc(count * sizeof(AVI_Frame), MALLOC_CAP_8BIT);
+	if (!avi->frames) return AVI_ERR_MEM;
+	count = idx1 ? avi_scan_idx1(f, idx1, idx1_size, movi, chunk_id, avi->frames) :
+				   avi_scan_movi(f, movi + 4, movi_end, chunk_id, avi->frames);
+	//буфер данных кадра по размеру самого большого кадра
+	for (uint32_t i = 0; i < count; i++) {
+		if (avi->frames[i].size > avi->buf_size) avi->buf_size = avi->frames[i].size;
+	}
+	avi->frames_count = count;
+	avi->buf = avi->buf_size ? (uint8_t*)heap_caps_malloc(avi->buf_size, MALLOC_CAP_8BIT) : 0;
+	if (!count || (avi->buf_size && !avi->buf)) {
+		AVI_Close(avi);
+		return count ? AVI_ERR_MEM : AVI_ERR_READ;
+	}
+	return AVI_OK;
+}
+
+//Освобождает индекс и буфер кадров (файл закрывает вызывающий)
+void AVI_Close (AVI_Player *avi)
+{
+	heap_caps_free(avi->frames);
+	heap_caps_free(avi->buf);
+	avi->frames = 0;
+	avi->buf = 0;
+	avi->frames_count = 0;
+	avi->buf_size = 0;
+}
+
+//Вывод кадра n в окно дисплея x, y, w, h (кадр уменьшается, чтобы поместиться в окно).
+//Кадр нулевого размера (повтор предыдущего) не выводится.
+AVI_Result AVI_ShowFrame (AVI_Player *avi, uint32_t n, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+	if (n >= avi->frames_count) return AVI_ERR_NO_FRAMES;
+	AVI_Frame *fr = &avi->frames[n];
+	if (!fr->size) return AVI_OK;
+	if (!avi_read((FILE*)avi->file, fr->offset, avi->buf, fr->size)) return AVI_ERR_READ;
+	iPicture_jpg pic = { avi->buf, fr->size };
+	return LCD_Load_JPG_dec(avi->dec, lcd, x, y, w, h, &pic, PICTURE_IN_MEMORY) ? AVI_ERR_DECODE : AVI_OK;
+}
+
+//Воспроизведение видео в окне дисплея x, y, w, h с частотой кадров файла.
+//Кадр n выводится не раньше n * us_per_frame от начала воспроизведения. Если вывод опоздал
+//и уже наступило время следующих кадров, выводится кадр текущего времени, а предыдущие
+//пропускаются без чтения и распаковки. Кадры нулевого размера (повтор предыдущего) не выводятся
+//и считаются в статистике отдельно. stats - статистика воспроизведения (может быть 0).
+//Возвращает AVI_ERR_READ при ошибке чтения файла, ошибки распаковки кадров считаются в статистике.
+AVI_Result AVI_Play (AVI_Player *avi, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h, AVI_Stats *stats)
+{
+	AVI_Stats st;
+	AVI_Result res = AVI_OK;
+	const int64_t tick_us = portTICK_PERIOD_MS * 1000;
+	memset(&st, 0, sizeof(AVI_Stats));
+	int64_t start = esp_timer_get_time();
+	uint32_t n = 0;
+	while (n < avi->frames_count) {
+		int64_t due = start + (int64_t)n * avi->us_per_frame;
+		int64_t now = esp_timer_get_time();
+		if (now < due) {
+			//ожидание времени кадра (с округлением до ближайшего тика планировщика)
+			TickType_t ticks = (TickType_t)((due - now + tick_us / 2) / tick_us);
+			if (ticks) vTaskDelay(ticks);
+			now = esp_timer_get_time();
+		}
+		else if (avi->us_per_frame) {
+			//кадр, время которого идет сейчас; опоздавшие кадры пропускаются
+			uint32_t cur = (uint32_t)((now - start) / avi->us_per_frame);
+			if (cur > n) {
+				if (cur >= avi->frames_count) cur = avi->frames_count;
+				st.dropped += cur - n;
+				n = cur;
+				if (n == avi->frames_count) break;
+				due = start + (int64_t)n * avi->us_per_frame;
+			}
+		}
+		if (!avi->frames[n].size) {		//повтор: на экране остается предыдущий кадр
+			st.repeated++;
+			n++;
+			continue;
+		}
+		if (now - due > st.late_us) st.late_us = (uint32_t)(now - due);
+		AVI_Result rc = AVI_ShowFrame(avi, n, lcd, x, y, w, h);
+		if (rc == AVI_ERR_READ) {
+			res = rc;
+			break;
+		}
+		if (rc == AVI_OK) st.shown++;
+		else st.errors++;
+		n++;
+	}
+	st.time_us = esp_timer_get_time() - start;
+	if (stats) *stats = st;
+	return res;
+}
@@ -0,0 +1,67 @@
+/*
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *	Воспроизведение видео Motion-JPEG в контейнере AVI
+ *
+ *  Допускается свободное распространение.
+ *  При любом способе распространения указание автора ОБЯЗАТЕЛЬНО.
+ *  В случае внесения изменений и распространения модификаций указание первоначального автора ОБЯЗАТЕЛЬНО.
+ *  Распространяется по типу "как есть", то есть использование осуществляется на свой страх и риск.
+ *  Автор не предоставляет никаких гарантий.
+ *
+ *  https://www.youtube.com/@VadRov
+ *  https://dzen.ru/vadrov
+ *  https://vk.com/vadrov
+ *  https://t.me/vadrov_channel
+ */
+
+#ifndef INC_AVI_H_
+#define INC_AVI_H_
+
+#include <stdint.h>
+#include "display.h"
+#include "jpeg_chan.h"
+
+typedef enum {
+	AVI_OK = 0,
+	AVI_ERR_READ,		//ошибка чтения файла
+	AVI_ERR_FORMAT,		//файл не AVI или в нем нет видеопотока MJPEG
+	AVI_ERR_NO_FRAMES,	//в файле нет кадров
+	AVI_ERR_MEM,		//нехватка памяти
+	AVI_ERR_DECODE		//ошибка распаковки кадра
+} AVI_Result;
+
+//Кадр видеопотока: положение данных jpeg в файле
+typedef struct {
+	uint32_t offset;		//смещение данных кадра от начала файла, байт
+	uint32_t size;			//размер данных кадра, байт
+} AVI_Frame;
+
+typedef struct {
+	void *file;				//открытый файл AVI (FILE*)
+	JPEG_Decoder *dec;		//декодер кадров
+	AVI_Frame *frames;		//индекс кадров видеопотока
+	uint32_t frames_count;	//количество кадров
+	uint32_t us_per_frame;	//длительность кадра, мкс
+	uint16_t width, height;	//размеры кадра
+	uint8_t *buf;			//буфер данных кадра (по размеру самого большого кадра)
+	uint32_t buf_size;
+} AVI_Player;
+
+//Статистика воспроизведения
+typedef struct {
+	uint32_t shown;			//выведено кадров
+	uint32_t dropped;		//пропущено опоздавших кадров
+	uint32_t repeated;		//кадров-повторов (нулевого размера, не выводятся)
+	uint32_t errors;		//кадров с ошибкой распаковки
+	uint32_t late_us;		//наибольшее опоздание вывода кадра, мкс
+	int64_t time_us;		//длительность воспроизведения, мкс
+} AVI_Stats;
+
+AVI_Result AVI_Open (AVI_Player *avi, void *file, JPEG_Decoder *dec);
+void AVI_Close (AVI_Player *avi);
+AVI_Result AVI_ShowFrame (AVI_Player *avi, uint32_t n, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h);
+AVI_Result AVI_Play (AVI_Player *avi, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h, AVI_Stats *stats);
+
+#endif /* INC_AVI_H_ */
@@ -20,8 +20,24 @@
 #define INC_JPEG_CHAN_H_
 
 #include "display.h"
+#include "tjpgd.h"
+#include "microgl2d.h"
 
 #define JPEG_CHAN_WORK_BUFFER_SIZE	12000 //максимум памяти, выделяемый для декодера
+#define JPEG_CHAN_OUTPUT_STRIPS		1	  //1 - блоки собираются в полосы шириной в изображение и высотой в строку блоков,
+										  //полоса выводится одним окном (два буфера полос, пока передается одна,
+										  //декодируется следующая); 0 - каждый блок выводится своим окном
+#define JPEG_CHAN_PIPELINE			1	  //1 - конвейер на двух ядрах: декодирование блоков (Хаффман, IDCT) в вызывающей
+										  //задаче, преобразование цвета и вывод - в задаче на другом ядре; 0 - на одном ядре
+#define JPEG_CHAN_RING_LEN			4	  //количество буферов блоков в кольце между этапами конвейера
+#define JPEG_CHAN_TASK_STACK		4096  //размер стека задачи вывода, байт
+#define JPEG_CHAN_TASK_PRIORITY		4	  //приоритет задачи вывода
+#define JPEG_CHAN_RST_PARALLEL		1	  //1 - изображение в памяти с интервалами перезапуска (маркер DRI) делится
+										  //на две части по границе интервала, части распаковываются на двух ядрах
+#define JPEG_CHAN_FILE_READ_AHEAD	1	  //1 - файл читается задачей на другом ядре в кольцо блоков заранее,
+										  //декодер не ждет носитель; 0 - файл читается самим декодером
+#define JPEG_CHAN_FILE_CHUNK		2048  //размер блока упреждающего чтения файла, байт
+#define JPEG_CHAN_FILE_CHUNKS		4	  //количество блоков в кольце упреждающего чтения
 
 typedef enum {
 	PICTURE_IN_FILE,
@@ -34,16 +50,75 @@ typedef struct {
 } iPicture_jpg;
 
 typedef struct {
-	void *file;   			//указатель на обработчик файла
-	volatile uint32_t size;	//размер файла
+	void *file;   			//указатель на открытый файл (FILE*), чтение с текущей позиции
+	volatile uint32_t size;	//размер файла (количество байт, которые можно прочитать)
 } iFile_jpg;
 
 typedef struct {
     void *file;   			//входной поток
     LCD_Handler *lcd;		//указатель на обработчик дисплея
     uint16_t x_offs, y_offs;
+    uint16_t *strip[2];		//буферы полос (0 - вывод каждого блока своим окном)
+    uint16_t strip_w;		//ширина полосы (ширина изображения с учетом масштаба)
+    uint8_t strip_idx;		//индекс заполняемого буфера полосы
+    uint8_t queued;			//количество полос, поставленных в очередь на передачу
+    void *task;				//задача, получающая уведомления о передаче полос
+    void *pipe;				//конвейер двух ядер (0 - не используется)
+    void *lock;				//мьютекс вывода на дисплей (0 - дисплей используется одной задачей)
+    MGL_IMAGE *image;		//изображение MicroGL2D для вывода (JPEG_DecodeImage)
+    uint8_t image_order;	//порядок байтов цвета R5G6B5 изображения: 0 - процессора, 1 - дисплея
+    MGL_OBJ *overlay;		//объекты MicroGL2D, накладываемые на изображение перед выводом (0 - нет)
 } IODEV;
 
+//Экземпляр декодера: рабочая память, формат цвета и мьютекс вывода. Декодеры с разной рабочей
+//памятью распаковывают изображения одновременно (например, в задачах на разных ядрах).
+//Декодеры, выводящие на один дисплей, должны использовать общий мьютекс вывода.
+typedef struct {
+	uint8_t *pool;			//рабочая память декодера (0 - выделяется в куче на время распаковки)
+	uint32_t pool_size;		//размер рабочей памяти, байт (pool = 0 и pool_size = 0 - размер по заголовку изображения)
+	uint8_t color_format;	//формат цвета: 1 - R5G6B5 цветной, 3 - R5G6B5 оттенки серого
+	void *lock;				//мьютекс вывода на дисплей (SemaphoreHandle_t, 0 - дисплей используется одной задачей)
+	MGL_OBJ *overlay;		//список объектов MicroGL2D, накладываемых на изображение (0 - нет)
+	JD_TBLCACHE *tables;	//кэш таблиц квантования и Хаффмана (0 - нет)
+} JPEG_Decoder;
+
 uint8_t LCD_Load_JPG_chan (LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h, void *image_stream, PictureLocation location);
+uint8_t LCD_Load_JPG_chan_rect (LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h, void *image_stream,
+								PictureLocation location, uint16_t src_x, uint16_t src_y, uint8_t scale, const void *index);
+void* LCD_Index_JPG_chan (iPicture_jpg *image, uint32_t *size);
+
+//Статистика кэша распакованных изображений
+typedef struct {
+	uint32_t hits;			//изображение выведено из кэша
+	uint32_t misses;		//изображение распаковано
+	uint32_t evictions;		//вытеснено изображений
+	uint32_t uncached;		//изображение больше бюджета кэша (нехватка памяти) и выведено без сохранения
+	uint32_t used;			//занято памяти кэшем, байт
+	uint32_t entries;		//количество изображений в кэше
+} JPEG_CacheStats;
+
+//Кэш распакованных изображений (LRU в пределах бюджета памяти)
+typedef struct JPEG_Cache_ JPEG_Cache;
+
+void JPEG_Decoder_Init (JPEG_Decoder *dec, void *pool, uint32_t pool_size, uint8_t color_format, void *lock);
+void JPEG_Decoder_SetOverlay (JPEG_Decoder *dec, MGL_OBJ *overlay);
+void JPEG_Decoder_SetTableCache (JPEG_Decoder *dec, JD_TBLCACHE *tables);
+uint8_t LCD_Load_JPG_dec (JPEG_Decoder *dec, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+						  void *image_stream, PictureLocation location);
+uint8_t LCD_Load_JPG_dec_rect (JPEG_Decoder *dec, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+							   void *image_stream, PictureLocation location, uint16_t src_x, uint16_t src_y,
+							   uint8_t scale, const void *index);
+void* LCD_Index_JPG_dec (JPEG_Decoder *dec, iPicture_jpg *image, uint32_t *size);
+uint8_t LCD_Probe_JPG_chan (void *image_stream, PictureLocation location, JD_PROBE *info);
+uint8_t JPEG_DecodeImage (JPEG_Decoder *dec, void *image_stream, PictureLocation location, uint8_t scale, MGL_IMAGE *image);
+uint8_t JPEG_FindThumbnail (void *image_stream, PictureLocation location, uint32_t *offset, uint32_t *size);
+uint8_t LCD_Load_JPG_preview (JPEG_Decoder *dec, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+							  void *image_stream, PictureLocation location, uint8_t refine);
+
+JPEG_Cache* JPEG_CacheCreate (JPEG_Decoder *dec, uint32_t budget, uint32_t caps);
+void JPEG_CacheDelete (JPEG_Cache *cache);
+void JPEG_CacheClear (JPEG_Cache *cache);
+void JPEG_CacheGetStats (JPEG_Cache *cache, JPEG_CacheStats *stats);
+uint8_t LCD_Load_JPG_cached (JPEG_Cache *cache, LCD_Handler *lcd, uint16_t x, uint16_t y, iPicture_jpg *image, uint8_t scale);
 
 #endif /* INC_JPEG_CHAN_H_ */
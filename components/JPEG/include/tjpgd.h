@@ -57,6 +57,10 @@ typedef int16_t jd_yuv_t;
 typedef uint8_t jd_yuv_t;
 #endif
 
+#if JD_FASTDECODE == 2
+#define JD_HUFF_LUT_LEN	(1 << 10)	//размер быстрой таблицы Хаффмана, элементов (1 << HUFF_BIT)
+#endif
+
 
 /* Error code */
 typedef enum {
@@ -83,6 +87,70 @@ typedef struct {
 
 
 
+/* Индекс строк блоков: состояние декодера в начале каждой строки блоков изображения в памяти.
+   Индекс не содержит указателей и может сохраняться вместе с изображением. */
+typedef struct {
+	uint64_t wreg;				//регистр битов
+	uint32_t offset;			//смещение следующего байта потока от начала данных сканирования
+	int16_t dcv[3];				//предсказание DC компонент
+	uint16_t rst, rsc;			//счетчик блоков интервала перезапуска и номер ожидаемого маркера RSTn
+	uint8_t dbit, marker;		//количество битов в регистре, обнаруженный маркер
+} JD_ROWPOS;
+
+typedef struct {
+	uint32_t version;			//версия формата индекса (JD_INDEX_VERSION)
+	uint32_t scan_size;			//размер данных сканирования, байт
+	uint16_t width, height;		//размеры изображения
+	uint16_t rows;				//количество строк блоков
+	uint8_t msx, msy;			//размеры блока
+	JD_ROWPOS pos[];			//состояние в начале каждой строки блоков
+} JD_INDEX;
+
+#define JD_INDEX_VERSION	2
+
+/* Параметры изображения, полученные разбором заголовка без построения таблиц (jd_probe) */
+typedef struct {
+	uint16_t width, height;		//размеры изображения, пикселей
+	uint8_t ncomp;				//количество компонент цвета: 1 - оттенки серого, 3 - Y/Cb/Cr
+	uint8_t msx, msy;			//размеры блока (1x1 - 4:4:4, 2x1 - 4:2:2, 2x2 - 4:2:0)
+	uint16_t nrst;				//интервал перезапуска, блоков (0 - нет интервалов)
+	size_t sz_pool;				//размер рабочей памяти, которую займет jd_prepare (jd_prepare_mem) без кэша таблиц, байт
+} JD_PROBE;
+
+/* Кэш таблиц квантования и Хаффмана (jd_prepare_tc, jd_prepare_mem_tc).
+   Таблица из сегмента DQT/DHT, совпадающая с уже построенной (хэш и данные), не строится заново:
+   декодер использует таблицы кэша (вместе с быстрыми таблицами hufflut_ac/hufflut_dc).
+   Таблицы кэша используются декодером до окончания распаковки, поэтому кэш принадлежит одному
+   декодеру: следующий разбор заголовка с этим кэшем можно начинать только после окончания
+   распаковки предыдущего изображения. */
+typedef struct {
+	uint32_t hash;				//хэш данных таблицы (0 - запись свободна)
+	uint32_t stamp;				//номер разбора заголовка, в котором таблица использовалась последней
+	int32_t tbl[64];			//таблица деквантования
+	uint8_t raw[64];			//данные таблицы из сегмента DQT
+} JD_TC_QT;
+
+typedef struct {
+	uint32_t hash;				//хэш данных таблицы (0 - запись свободна)
+	uint32_t stamp;				//номер разбора заголовка, в котором таблица использовалась последней
+#if JD_FASTDECODE == 2
+	uint16_t lut[JD_HUFF_LUT_LEN];	//быстрая таблица (hufflut_ac, для DC - hufflut_dc байтами)
+#endif
+	uint16_t code[256];			//коды
+	uint8_t raw[16 + 256];		//данные таблицы из сегмента DHT: количества кодов длиной 1...16 бит и значения
+	uint16_t len;				//размер данных таблицы
+	uint8_t cls;				//класс таблицы: 0 - DC, 1 - AC
+	uint8_t longofs;			//смещение длинных кодов в таблице значений
+} JD_TC_HUFF;
+
+typedef struct {
+	uint32_t stamp;				//счетчик разборов заголовков
+	uint32_t hits;				//таблиц взято из кэша
+	uint32_t misses;			//таблиц построено
+	JD_TC_QT qt[JD_TBLCACHE_QT];
+	JD_TC_HUFF huff[JD_TBLCACHE_HUFF];
+} JD_TBLCACHE;
+
 /* Decompressor object structure */
 typedef struct JDEC JDEC;
 struct JDEC {
@@ -102,7 +170,7 @@ struct JDEC {
 	uint8_t* huffdata[2][2];	/* Huffman decoded data tables [id][dcac] */
 	int32_t* qttbl[4];			/* Dequantizer tables [id] */
 #if JD_FASTDECODE >= 1
-	uint32_t wreg;				/* Working shift register */
+	uint64_t wreg;				/* Working shift register */
 	uint8_t marker;				/* Detected marker (0:None) */
 #if JD_FASTDECODE == 2
 	uint8_t longofs[2][2];		/* Table offset of long code [id][dcac] */
@@ -121,13 +189,39 @@ struct JDEC {
 	size_t sz_pool;				/* Size of momory pool (bytes available) */
 	size_t (*infunc)(JDEC*, uint8_t*, size_t);	/* Pointer to jpeg stream input function */
 	void* device;				/* Pointer to I/O device identifiler for the session */
+	const uint8_t* mem;			//источник в памяти (jd_prepare_mem): текущая позиция чтения
+	size_t mem_left;			//количество непрочитанных байт источника в памяти
+	const uint8_t* mem_scan;	//начало данных сканирования источника в памяти
+	const JD_INDEX* index;		//индекс строк блоков (0 - не используется)
+	JRECT roi;					//область распаковки (jd_decomp_rect)
+	int (*roi_outfunc)(JDEC*, void*, JRECT*);	//функция вывода блоков области
+	JD_TBLCACHE* tblcache;		//кэш таблиц (0 - таблицы строятся в рабочей памяти)
 };
 
 
 
 /* TJpgDec API functions */
 JRESULT jd_prepare (JDEC* jd, size_t (*infunc)(JDEC*,uint8_t*,size_t), void* pool, size_t sz_pool, void* dev);
+JRESULT jd_prepare_mem (JDEC* jd, const uint8_t* data, size_t size, void* pool, size_t sz_pool, void* dev);
+//Инициализация декодера с кэшем таблиц квантования и Хаффмана (tc = 0 - без кэша)
+JRESULT jd_prepare_tc (JDEC* jd, size_t (*infunc)(JDEC*,uint8_t*,size_t), void* pool, size_t sz_pool, void* dev, JD_TBLCACHE* tc);
+JRESULT jd_prepare_mem_tc (JDEC* jd, const uint8_t* data, size_t size, void* pool, size_t sz_pool, void* dev, JD_TBLCACHE* tc);
+void jd_tblcache_init (JD_TBLCACHE* tc);
+//Разбор заголовка без распаковки: параметры изображения и необходимый размер рабочей памяти
+JRESULT jd_probe (JDEC* jd, size_t (*infunc)(JDEC*,uint8_t*,size_t), void* dev, JD_PROBE* info);
+JRESULT jd_probe_mem (JDEC* jd, const uint8_t* data, size_t size, JD_PROBE* info);
 JRESULT jd_decomp (JDEC* jd, int (*outfunc)(JDEC*,void*,JRECT*), uint8_t scale);
+//Конвейерная распаковка: этап загрузки блоков (Хаффман, деквантование, IDCT) и этап вывода блока
+JRESULT jd_decomp_load (JDEC* jd, int (*putfunc)(JDEC*,unsigned int,unsigned int), uint8_t scale);
+JRESULT jd_mcu_output (JDEC* jd, jd_yuv_t* mcubuf, int (*outfunc)(JDEC*,void*,JRECT*), unsigned int x, unsigned int y);
+//Распаковка диапазона блоков, начинающегося с интервала перезапуска (RSTn)
+JRESULT jd_decomp_range (JDEC* jd, int (*outfunc)(JDEC*,void*,JRECT*), uint8_t scale, uint32_t mcu_first, uint32_t mcu_num);
+//Распаковка области изображения (координаты масштабированного изображения)
+JRESULT jd_decomp_rect (JDEC* jd, int (*outfunc)(JDEC*,void*,JRECT*), uint8_t scale, const JRECT* roi);
+//Индекс строк блоков изображения в памяти: размер, построение и подключение к декодеру
+size_t jd_index_size (JDEC* jd);
+JRESULT jd_build_index (JDEC* jd, JD_INDEX* index);
+JRESULT jd_set_index (JDEC* jd, const JD_INDEX* index);
 
 
 #ifdef __cplusplus
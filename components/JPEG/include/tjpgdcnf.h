@@ -37,6 +37,12 @@
 
 #define JD_BYTES_SWAP		1
 
+/* Кэш таблиц (JD_TBLCACHE): количество таблиц Хаффмана и таблиц квантования.
+/  Обычному изображению нужны 4 таблицы Хаффмана (DC и AC яркости и цветности) и 2 таблицы квантования.
+*/
+#define JD_TBLCACHE_HUFF	4
+#define JD_TBLCACHE_QT		4
+
 /* Specifies size of stream input buffer */
 #define	JD_SZBUF		1024
 
@@ -16,63 +16,171 @@
  *  https://t.me/vadrov_channel
  */
 
-//#include "ff.h"
+#include <stdio.h>
 #include "jpeg_chan.h"
 #include "tjpgd.h"
 #include "display.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
 
+static uint8_t work_buffer[JPEG_CHAN_WORK_BUFFER_SIZE];
+
+//Декодер функций LCD_Load_JPG_chan и LCD_Index_JPG_chan: общая рабочая память, вывод цветом R5G6B5
+static JPEG_Decoder jpeg_default = { work_buffer, JPEG_CHAN_WORK_BUFFER_SIZE, 1, 0, 0, 0 };
+
+//Получение данных из файла (файл jpeg на sd карте, во flash-памяти - через VFS).
+//buff = 0 - пропуск данных, выполняется перемещением по файлу.
+static size_t tjd_input_file (JDEC* jd, uint8_t* buff, size_t nd)
+{
+	IODEV *iodev = (IODEV *)jd->device;
+	iFile_jpg *file = (iFile_jpg *)iodev->file;
+	if (file->size < nd) {
+		nd = file->size;
+	}
+	if (buff) {
+		nd = fread(buff, 1, nd, (FILE *)file->file);
+	}
+	else if (fseek((FILE *)file->file, (long)nd, SEEK_CUR)) {
+		nd = 0;
+	}
+	file->size -= nd;
+	return nd;
+}
+
+#if JPEG_CHAN_FILE_READ_AHEAD
+//Упреждающее чтение файла: задача чтения заполняет блок head и отдает его (full),
+//декодер читает блок tail и возвращает его (empty). Пустой блок - конец файла.
 typedef struct {
-	uint8_t *data;
-	uint32_t data_left;
-} Data_Mem_src;
+	iFile_jpg *file;
+	uint8_t *chunk[JPEG_CHAN_FILE_CHUNKS];
+	uint32_t len[JPEG_CHAN_FILE_CHUNKS];	//количество прочитанных в блок байт
+	uint8_t head, tail;
+	uint8_t have;							//блок tail получен декодером
+	uint32_t pos;							//позиция чтения в блоке tail
+	volatile uint8_t stop;					//признак завершения работы задачи чтения
+	SemaphoreHandle_t full, empty, done;
+} JPEG_FileReader;
 
-uint8_t work_buffer[JPEG_CHAN_WORK_BUFFER_SIZE];
+static void tjd_read_task (void *param)
+{
+	JPEG_FileReader *rd = (JPEG_FileReader*)param;
+	iFile_jpg *file = rd->file;
+	uint32_t n;
+	do {
+		xSemaphoreTake(rd->empty, portMAX_DELAY);
+		if (rd->stop) break;
+		n = file->size < JPEG_CHAN_FILE_CHUNK ? file->size : JPEG_CHAN_FILE_CHUNK;
+		n = fread(rd->chunk[rd->head], 1, n, (FILE *)file->file);
+		file->size -= n;
+		rd->len[rd->head] = n;
+		rd->head = (rd->head + 1) % JPEG_CHAN_FILE_CHUNKS;
+		xSemaphoreGive(rd->full);
+	} while (n);
+	xSemaphoreGive(rd->done);
+	vTaskDelete(NULL);
+}
 
-uint8_t AVI_color_mode = 1;			//Формат цвета AVI: 1 - R5G6B5 цветной, 3 - R5G6B5 оттенки серого.
+//Получение данных из кольца упреждающего чтения
+static size_t tjd_input_ahead (JDEC* jd, uint8_t* buff, size_t nd)
+{
+	JPEG_FileReader *rd = (JPEG_FileReader*)((IODEV *)jd->device)->file;
+	size_t rb = 0, n;
+	while (rb < nd) {
+		if (!rd->have) {
+			xSemaphoreTake(rd->full, portMAX_DELAY);
+			rd->have = 1;
+			rd->pos = 0;
+		}
+		n = rd->len[rd->tail] - rd->pos;
+		if (!n) break; //конец файла
+		if (n > nd - rb) n = nd - rb;
+		if (buff) memcpy(buff + rb, rd->chunk[rd->tail] + rd->pos, n);
+		rb += n;
+		rd->pos += n;
+		if (rd->pos == rd->len[rd->tail]) {
+			rd->have = 0;
+			rd->tail = (rd->tail + 1) % JPEG_CHAN_FILE_CHUNKS;
+			xSemaphoreGive(rd->empty);
+		}
+	}
+	return rb;
+}
 
-/*
-//Получение данных с внешнего носителя - sd карты (файл jpeg на sd карте)
-static inline unsigned int tjd_input_file (JDEC* jd, uint8_t* buff, unsigned int nd)
+//Запускает упреждающее чтение файла с текущей позиции (после разбора заголовка).
+//Возвращает 0, если задача чтения не запущена: декодер читает файл сам.
+static JPEG_FileReader* tjd_reader_start (JDEC *jd)
 {
 	IODEV *iodev = (IODEV *)jd->device;
-	FIL *file = (FIL *)((iFile_jpg *)iodev->file)->file;
-	jd = jd;
-	if (((iFile_jpg *)iodev->file)->size < nd) {
-		nd = ((iFile_jpg *)iodev->file)->size;
-		((iFile_jpg *)iodev->file)->size = 0;
-	}
-	else {
-		((iFile_jpg *)iodev->file)->size -= nd;
+	JPEG_FileReader *rd = (JPEG_FileReader*)heap_caps_malloc(sizeof(JPEG_FileReader), MALLOC_CAP_8BIT);
+	uint8_t *buf = (uint8_t*)heap_caps_malloc(JPEG_CHAN_FILE_CHUNKS * JPEG_CHAN_FILE_CHUNK, MALLOC_CAP_8BIT);
+	if (!rd || !buf) {
+		heap_caps_free(rd);
+		heap_caps_free(buf);
+		return 0;
 	}
-	if (buff) {
-		UINT read_b = 0;
-		NVIC_DisableIRQ(AudioDAC_IRQn);
-		f_read(file, buff, nd, &read_b);
-		NVIC_EnableIRQ(AudioDAC_IRQn);
-		return read_b;
+	rd->file = (iFile_jpg *)iodev->file;
+	for (int i = 0; i < JPEG_CHAN_FILE_CHUNKS; i++) {
+		rd->chunk[i] = buf + i * JPEG_CHAN_FILE_CHUNK;
 	}
-	else {
-		NVIC_DisableIRQ(AudioDAC_IRQn);
-		FRESULT res = f_lseek(file, f_tell(file) + (FSIZE_t)nd);
-		NVIC_EnableIRQ(AudioDAC_IRQn);
-		return res == FR_OK ? nd : 0;
+	rd->head = rd->tail = rd->have = rd->stop = 0;
+	rd->full = xSemaphoreCreateCounting(JPEG_CHAN_FILE_CHUNKS, 0);
+	rd->empty = xSemaphoreCreateCounting(JPEG_CHAN_FILE_CHUNKS, JPEG_CHAN_FILE_CHUNKS);
+	rd->done = xSemaphoreCreateBinary();
+	if (rd->full && rd->empty && rd->done &&
+		xTaskCreatePinnedToCore(tjd_read_task, "jpeg_read", JPEG_CHAN_TASK_STACK, rd,
+								JPEG_CHAN_TASK_PRIORITY, NULL, portNUM_PROCESSORS > 1 ? !xPortGetCoreID() : 0) == pdPASS) {
+		iodev->file = rd;
+		jd->infunc = tjd_input_ahead;
+		return rd;
 	}
+	if (rd->full) vSemaphoreDelete(rd->full);
+	if (rd->empty) vSemaphoreDelete(rd->empty);
+	if (rd->done) vSemaphoreDelete(rd->done);
+	heap_caps_free(rd);
+	heap_caps_free(buf);
+	return 0;
 }
-*/
 
-//Получение данных из памяти (файл jpeg во Flash или RAM МК)
-static inline unsigned int tjd_input_memory (JDEC* jd, uint8_t* buff, unsigned int nd)
+//Останавливает задачу чтения (в том числе после ошибки распаковки до конца файла)
+static void tjd_reader_stop (JDEC *jd, JPEG_FileReader *rd)
 {
 	IODEV *iodev = (IODEV *)jd->device;
-	if (((Data_Mem_src*)iodev->file)->data_left < nd) {
-		nd = ((Data_Mem_src*)iodev->file)->data_left;
+	rd->stop = 1;
+	xSemaphoreGive(rd->empty);
+	xSemaphoreTake(rd->done, portMAX_DELAY);
+	iodev->file = rd->file;
+	vSemaphoreDelete(rd->full);
+	vSemaphoreDelete(rd->empty);
+	vSemaphoreDelete(rd->done);
+	heap_caps_free(rd->chunk[0]);
+	heap_caps_free(rd);
+}
+#endif
+
+//Ставит заполненную полосу в очередь на передачу и переключает буфер полос.
+//Если следующий буфер еще передается, ожидает завершения его передачи.
+static void tjd_strip_flush (IODEV *iodev, uint16_t top, uint16_t bottom)
+{
+	LCD_Handler *lcd = iodev->lcd;
+	uint16_t x = iodev->x_offs, y = iodev->y_offs + top, h = bottom - top + 1;
+	if (y + h <= lcd->Height) {
+		if (iodev->overlay) { //объекты рисуются поверх полосы в координатах дисплея
+			MGL_RenderObjects(iodev->overlay, x, y, x + iodev->strip_w - 1, y + h - 1, iodev->strip[iodev->strip_idx]);
+		}
+		//окно и данные полосы не должны разделяться выводом другой задачи
+		if (iodev->lock) xSemaphoreTake((SemaphoreHandle_t)iodev->lock, portMAX_DELAY);
+		LCD_QueueSetActiveWindow(lcd, x, y, x + iodev->strip_w - 1, y + h - 1);
+		LCD_QueueWriteData(lcd, iodev->strip[iodev->strip_idx], iodev->strip_w * h, LCD_QueueNotifyCallback, iodev->task);
+		if (iodev->lock) xSemaphoreGive((SemaphoreHandle_t)iodev->lock);
+		iodev->queued++;
 	}
-	if (buff) {
-		memcpy(buff, ((Data_Mem_src*)iodev->file)->data, nd);
+	iodev->strip_idx ^= 1;
+	if (iodev->queued == 2) {
+		ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+		iodev->queued--;
 	}
-	((Data_Mem_src*)iodev->file)->data += nd;
-	((Data_Mem_src*)iodev->file)->data_left -= nd;
-	return nd;
 }
 
 //Вывод блока памяти bitmap на дисплей в указанной позиции rect
@@ -80,45 +188,1017 @@ static inline int tjd_output (JDEC* jd, void* bitmap, JRECT* rect)
 {
 	IODEV *iodev = (IODEV *)jd->device;
 
+	if (iodev->strip[0]) {
+		//Копирование блока в полосу, полоса выводится после последнего блока строки
+		uint16_t w = rect->right - rect->left + 1;
+		uint16_t *src = (uint16_t*)bitmap;
+		uint16_t *dst = iodev->strip[iodev->strip_idx] + rect->left;
+		for (int row = rect->top; row <= rect->bottom; row++) {
+			memcpy(dst, src, w * 2);
+			src += w;
+			dst += iodev->strip_w;
+		}
+		if (rect->right == iodev->strip_w - 1) {
+			tjd_strip_flush(iodev, rect->top, rect->bottom);
+		}
+		return JDR_OK;
+	}
+
 	//Вывод блока на дисплей
+	if (iodev->overlay) {
+		MGL_RenderObjects(iodev->overlay, rect->left + iodev->x_offs, rect->top + iodev->y_offs,
+						  rect->right + iodev->x_offs, rect->bottom + iodev->y_offs, (uint16_t*)bitmap);
+	}
+	if (iodev->lock) xSemaphoreTake((SemaphoreHandle_t)iodev->lock, portMAX_DELAY);
 	LCD_DrawImage(iodev->lcd, rect->left + iodev->x_offs, rect->top + iodev->y_offs, rect->right - rect->left + 1,
 			      rect->bottom - rect->top + 1, (uint16_t*)bitmap, 1);
+	if (iodev->lock) xSemaphoreGive((SemaphoreHandle_t)iodev->lock);
 	return JDR_OK;
 }
 
-//Вывод jpeg изображения на дисплей.
-//location определяет местоположение файла (на sd карте или во Flash/RAM МК)
-uint8_t LCD_Load_JPG_chan (LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h, void *image_stream, PictureLocation location)
+//Ожидает передачи полос, поставленных в очередь
+static void tjd_strip_wait (IODEV *iodev)
+{
+	for (; iodev->queued; iodev->queued--) {
+		ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+	}
+}
+
+#if JPEG_CHAN_PIPELINE
+//Элемент кольца блоков между этапами конвейера
+typedef struct {
+	jd_yuv_t *mcubuf;	//блок после IDCT (компоненты Y, Cb, Cr)
+	uint16_t x, y;		//положение блока в изображении
+	uint8_t stop;		//признак завершения работы этапа вывода
+} JPEG_RingItem;
+
+//Конвейер: этап загрузки заполняет элемент head и отдает его (full), этап вывода
+//обрабатывает элемент tail и возвращает его (empty). Каждый индекс изменяет только свой этап.
+typedef struct {
+	JDEC jd_out;							//копия декодера для этапа вывода
+	JPEG_RingItem items[JPEG_CHAN_RING_LEN];
+	uint8_t head, tail;
+	SemaphoreHandle_t full, empty, done;
+	volatile JRESULT rc;					//результат этапа вывода
+} JPEG_Pipe;
+
+//Передает загруженный блок этапу вывода и выдает декодеру следующий свободный буфер
+static int tjd_put_mcu (JDEC* jd, unsigned int x, unsigned int y)
+{
+	JPEG_Pipe *pipe = (JPEG_Pipe*)((IODEV *)jd->device)->pipe;
+	JPEG_RingItem *item = &pipe->items[pipe->head];
+	item->x = x;
+	item->y = y;
+	item->stop = 0;
+	xSemaphoreGive(pipe->full);
+	pipe->head = (pipe->head + 1) % JPEG_CHAN_RING_LEN;
+	xSemaphoreTake(pipe->empty, portMAX_DELAY);
+	jd->mcubuf = pipe->items[pipe->head].mcubuf;
+	return pipe->rc == JDR_OK;
+}
+
+//Задача этапа вывода: преобразование цвета и вывод блоков на дисплей
+static void tjd_output_task (void *param)
+{
+	JPEG_Pipe *pipe = (JPEG_Pipe*)param;
+	IODEV *iodev = (IODEV *)pipe->jd_out.device;
+	JPEG_RingItem *item;
+	iodev->task = (void*)xTaskGetCurrentTaskHandle(); //уведомления о передаче полос получает эта задача
+	while (1) {
+		xSemaphoreTake(pipe->full, portMAX_DELAY);
+		item = &pipe->items[pipe->tail];
+		if (item->stop) break;
+		if (pipe->rc == JDR_OK) { //после ошибки вывода блоки только возвращаются в кольцо
+			pipe->rc = jd_mcu_output(&pipe->jd_out, item->mcubuf, tjd_output, item->x, item->y);
+		}
+		pipe->tail = (pipe->tail + 1) % JPEG_CHAN_RING_LEN;
+		xSemaphoreGive(pipe->empty);
+	}
+	tjd_strip_wait(iodev);
+	xSemaphoreGive(pipe->done);
+	vTaskDelete(NULL);
+}
+
+//Распаковка конвейером на двух ядрах. Возвращает 0, если конвейер не может быть запущен
+//(одно ядро, нехватка памяти), иначе 1 и результат распаковки в rc.
+static int tjd_decomp_pipeline (JDEC *jd, uint8_t scale, JRESULT *rc)
+{
+	if (portNUM_PROCESSORS < 2) return 0;
+	IODEV *iodev = (IODEV *)jd->device;
+	uint32_t mcu_size = (jd->msx * jd->msy + 2) * 64 * sizeof(jd_yuv_t);
+	JPEG_Pipe *pipe = (JPEG_Pipe*)heap_caps_malloc(sizeof(JPEG_Pipe), MALLOC_CAP_8BIT);
+	uint8_t *mcubufs = (uint8_t*)heap_caps_malloc(JPEG_CHAN_RING_LEN * mcu_size, MALLOC_CAP_8BIT);
+	int32_t *idct_buf = (int32_t*)heap_caps_malloc(64 * sizeof(int32_t), MALLOC_CAP_8BIT);
+	if (!pipe || !mcubufs || !idct_buf) {
+		heap_caps_free(pipe);
+		heap_caps_free(mcubufs);
+		heap_caps_free(idct_buf);
+		return 0;
+	}
+	pipe->full = xSemaphoreCreateCounting(JPEG_CHAN_RING_LEN, 0);
+	pipe->empty = xSemaphoreCreateCounting(JPEG_CHAN_RING_LEN, JPEG_CHAN_RING_LEN);
+	pipe->done = xSemaphoreCreateBinary();
+	int res = 0;
+	if (pipe->full && pipe->empty && pipe->done) {
+		for (int i = 0; i < JPEG_CHAN_RING_LEN; i++) {
+			pipe->items[i].mcubuf = (jd_yuv_t*)(mcubufs + i * mcu_size);
+		}
+		pipe->head = pipe->tail = 0;
+		pipe->rc = JDR_OK;
+		//этап вывода работает с копией декодера и его буфером workbuf (две половины для DMA),
+		//этапу загрузки остается отдельный буфер для IDCT
+		pipe->jd_out = *jd;
+		pipe->jd_out.scale = scale;
+		jd->workbuf = idct_buf;
+		iodev->pipe = pipe;
+		xSemaphoreTake(pipe->empty, portMAX_DELAY);
+		jd->mcubuf = pipe->items[0].mcubuf;
+		if (xTaskCreatePinnedToCore(tjd_output_task, "jpeg_out", JPEG_CHAN_TASK_STACK, pipe,
+									JPEG_CHAN_TASK_PRIORITY, NULL, !xPortGetCoreID()) == pdPASS) {
+			*rc = jd_decomp_load(jd, tjd_put_mcu, scale);
+			//этап загрузки владеет элементом head: он становится признаком завершения
+			pipe->items[pipe->head].stop = 1;
+			xSemaphoreGive(pipe->full);
+			xSemaphoreTake(pipe->done, portMAX_DELAY);
+			if (*rc == JDR_INTR || *rc == JDR_OK) {
+				if (pipe->rc != JDR_OK) *rc = pipe->rc;
+			}
+			res = 1;
+		}
+		iodev->pipe = 0;
+		jd->workbuf = pipe->jd_out.workbuf;
+	}
+	if (pipe->full) vSemaphoreDelete(pipe->full);
+	if (pipe->empty) vSemaphoreDelete(pipe->empty);
+	if (pipe->done) vSemaphoreDelete(pipe->done);
+	heap_caps_free(pipe);
+	heap_caps_free(mcubufs);
+	heap_caps_free(idct_buf);
+	return res;
+}
+#endif
+
+#if JPEG_CHAN_RST_PARALLEL
+//Вторая часть изображения, распаковываемая на другом ядре
+typedef struct {
+	JDEC jd;				//свой объект декодера (таблицы общие с первой частью)
+	IODEV iodev;			//свой вывод (буферы полос, уведомления о передаче)
+	uint32_t mcu_first, mcu_num;
+	uint8_t scale;
+	JRESULT rc;
+	SemaphoreHandle_t done;
+} JPEG_RstPart;
+
+//Возвращает указатель на данные после n-го маркера RSTn или 0, если маркер не найден
+static const uint8_t* tjd_find_rst (const uint8_t *p, const uint8_t *end, uint32_t n)
+{
+	while (p + 1 < end) {
+		if (*p++ != 0xFF) continue;
+		if (*p >= 0xD0 && *p <= 0xD7) {
+			p++;
+			if (!--n) return p;
+		}
+		else if (*p == 0xD9) break; //EOI
+	}
+	return 0;
+}
+
+static void tjd_rst_task (void *param)
+{
+	JPEG_RstPart *part = (JPEG_RstPart*)param;
+	part->iodev.task = (void*)xTaskGetCurrentTaskHandle();
+	part->rc = jd_decomp_range(&part->jd, tjd_output, part->scale, part->mcu_first, part->mcu_num);
+	tjd_strip_wait(&part->iodev);
+	xSemaphoreGive(part->done);
+	vTaskDelete(NULL);
+}
+
+//Распаковка изображения в памяти двумя частями на двух ядрах. Граница частей - начало интервала
+//перезапуска, при выводе полосами - еще и начало строки блоков. Возвращает 0, если распаковка
+//частями невозможна (нет интервалов, одно ядро, нехватка памяти), иначе 1 и результат в rc.
+static int tjd_decomp_rst (JDEC *jd, uint8_t scale, JRESULT *rc)
+{
+	if (portNUM_PROCESSORS < 2 || !jd->nrst) return 0;
+	IODEV *iodev = (IODEV *)jd->device;
+	uint32_t mx = jd->msx * 8, my = jd->msy * 8;
+	uint32_t mcx = (jd->width + mx - 1) / mx, mcu_total = mcx * ((jd->height + my - 1) / my);
+	uint32_t rst_total = (mcu_total + jd->nrst - 1) / jd->nrst;
+	//шаг границы в интервалах: полоса не может начинаться с середины строки блоков
+	uint32_t step = 1, k;
+	if (iodev->strip[0]) {
+		while ((step * jd->nrst) % mcx) step++;
+	}
+	k = ((rst_total / 2 + step / 2) / step) * step;
+	if (!k) k = step;
+	if (k >= rst_total) return 0;
+	//начало данных интервала: данные после заголовка, еще не прочитанные декодером из буфера
+	const uint8_t *scan = jd->mem - jd->dctr, *end = jd->mem + jd->mem_left;
+	const uint8_t *part_data = tjd_find_rst(scan, end, k);
+	if (!part_data) return 0;
+
+	uint32_t n = jd->msx * jd->msy;
+	uint32_t work_size = 2 * jd->offset_value, mcu_size = (n + 2) * 64 * sizeof(jd_yuv_t);
+	uint32_t in_size = JD_FASTDECODE ? 0 : JD_SZBUF; //входной буфер нужен только при копировании потока
+	JPEG_RstPart *part = (JPEG_RstPart*)heap_caps_malloc(sizeof(JPEG_RstPart), MALLOC_CAP_8BIT);
+	uint8_t *buf = (uint8_t*)heap_caps_malloc(in_size + work_size + mcu_size, MALLOC_CAP_8BIT);
+	//мьютекс вывода экземпляра декодера общий с другими декодерами дисплея, он используется и частями
+	SemaphoreHandle_t lock = iodev->lock ? (SemaphoreHandle_t)iodev->lock : xSemaphoreCreateMutex();
+	int res = 0;
+	if (part && buf && lock) {
+		part->done = xSemaphoreCreateBinary();
+		part->iodev = *iodev;
+		part->iodev.strip_idx = 0;
+		part->iodev.queued = 0;
+		part->iodev.pipe = 0;
+		part->iodev.lock = lock;
+		if (iodev->strip[0]) {
+			uint32_t strip_size = iodev->strip_w * ((jd->msy * 8) >> scale) * sizeof(uint16_t);
+			part->iodev.strip[0] = (uint16_t*)heap_caps_malloc(strip_size, MALLOC_CAP_DMA);
+			part->iodev.strip[1] = (uint16_t*)heap_caps_malloc(strip_size, MALLOC_CAP_DMA);
+		}
+		if (part->done && (!iodev->strip[0] || (part->iodev.strip[0] && part->iodev.strip[1]))) {
+			part->jd = *jd;
+			part->jd.device = &part->iodev;
+			part->jd.mem = part_data;
+			part->jd.mem_left = end - part_data;
+			part->jd.inbuf = buf;
+			part->jd.workbuf = buf + in_size;
+			part->jd.mcubuf = (jd_yuv_t*)(buf + in_size + work_size);
+			part->jd.offset = 0;
+			part->mcu_first = k * jd->nrst;
+			part->mcu_num = mcu_total - part->mcu_first;
+			part->scale = scale;
+			void *own_lock = iodev->lock;
+			iodev->lock = lock;
+			if (xTaskCreatePinnedToCore(tjd_rst_task, "jpeg_rst", JPEG_CHAN_TASK_STACK, part,
+										JPEG_CHAN_TASK_PRIORITY, NULL, !xPortGetCoreID()) == pdPASS) {
+				//первая часть распаковывается вызывающей задачей с начала данных изображения
+				jd->mem = scan;
+				jd->mem_left = end - scan;
+				*rc = jd_decomp_range(jd, tjd_output, scale, 0, part->mcu_first);
+				xSemaphoreTake(part->done, portMAX_DELAY);
+				if (*rc == JDR_OK) *rc = part->rc;
+				res = 1;
+			}
+			iodev->lock = own_lock;
+		}
+		heap_caps_free(part->iodev.strip[0]);
+		heap_caps_free(part->iodev.strip[1]);
+		if (part->done) vSemaphoreDelete(part->done);
+	}
+	if (lock && lock != iodev->lock) vSemaphoreDelete(lock);
+	heap_caps_free(part);
+	heap_caps_free(buf);
+	return res;
+}
+#endif
+
+//Ширина и высота изображения с учетом масштаба: границы последних выводимых блоков
+static void tjd_scaled_size (uint16_t width, uint16_t height, uint8_t msx, uint8_t msy, uint8_t scale, uint16_t *w, uint16_t *h)
+{
+	uint16_t mx = msx * 8, x_last = ((width - 1) / mx) * mx;
+	uint16_t my = msy * 8, y_last = ((height - 1) / my) * my;
+	*w = (x_last >> scale) + ((width - x_last) >> scale);
+	*h = (y_last >> scale) + ((height - y_last) >> scale);
+}
+
+//Масштаб, с которым изображение помещается в окно w x h (не больше 3 - уменьшение в 8 раз)
+static uint8_t tjd_fit_scale (uint16_t width, uint16_t height, uint16_t w, uint16_t h)
+{
+	uint8_t scale;
+	for (scale = 0; scale < 3; scale++) {
+		if ((width >> scale) <= w && (height >> scale) <= h) break;
+	}
+	return scale;
+}
+
+//Вывод jpeg изображения (roi = 0) или его области roi в координатах изображения с масштабом scale
+//декодером dec с рабочей памятью pool размером pool_size. index - индекс строк блоков изображения в памяти для
+//распаковки области (0 - нет индекса).
+static uint8_t tjd_decode (JPEG_Decoder *dec, uint8_t *pool, uint32_t pool_size, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+						   void *image_stream, PictureLocation location, JRECT *roi, uint8_t scale, const void *index)
 {
 	JDEC jd;
 	JRESULT rc = JDR_PAR;
-	uint8_t scale;
 
 	IODEV iodev;
+	iodev.strip[0] = iodev.strip[1] = 0;
+	iodev.queued = 0;
+	iodev.pipe = 0;
+	iodev.lock = dec->lock;
+	iodev.image = 0;
+	iodev.overlay = dec->overlay;
 	iodev.lcd = lcd;
 	iodev.x_offs = x;
 	iodev.y_offs = y;
 	if (location == PICTURE_IN_MEMORY)	{
-		Data_Mem_src data;
-		data.data = (uint8_t *)((iPicture_jpg*)image_stream)->data;
-		data.data_left = ((iPicture_jpg*)image_stream)->size;
-		iodev.file = (void *)&data;
-		rc = jd_prepare(&jd, tjd_input_memory, work_buffer, JPEG_CHAN_WORK_BUFFER_SIZE, &iodev);
+		//изображение в памяти читается декодером на месте, без копирования
+		iodev.file = image_stream;
+		rc = jd_prepare_mem_tc(&jd, ((iPicture_jpg*)image_stream)->data, ((iPicture_jpg*)image_stream)->size,
+							   pool, pool_size, &iodev, dec->tables);
+	}
+	else if (location == PICTURE_IN_FILE) {
+		iodev.file = image_stream;
+		rc = jd_prepare_tc(&jd, tjd_input_file, pool, pool_size, &iodev, dec->tables);
 	}
 	else {
 		return JDR_INP;
 	}
-/*
+	if (rc == JDR_OK) {
+		jd.color_format = dec->color_format;
+		if (!roi) scale = tjd_fit_scale(jd.width, jd.height, w, h);
+		uint16_t img_w, img_h;
+		tjd_scaled_size(jd.width, jd.height, jd.msx, jd.msy, scale, &img_w, &img_h);
+		if (roi) {
+			//область ограничивается размерами изображения
+			if (roi->right >= img_w) roi->right = img_w - 1;
+			if (roi->bottom >= img_h) roi->bottom = img_h - 1;
+			if (roi->left > roi->right || roi->top > roi->bottom) return JDR_PAR;
+		}
+#if JPEG_CHAN_OUTPUT_STRIPS
+		uint16_t strip_w = roi ? roi->right - roi->left + 1 : img_w;
+		uint32_t strip_size = strip_w * ((jd.msy * 8) >> scale) * sizeof(uint16_t);
+		//Полосы не используются, если изображение не помещается по ширине
+		//(блоки, выходящие за дисплей, не выводятся, а остальные выводятся)
+		if (strip_w && x + strip_w <= lcd->Width) {
+			iodev.strip[0] = (uint16_t*)heap_caps_malloc(strip_size, MALLOC_CAP_DMA);
+			iodev.strip[1] = (uint16_t*)heap_caps_malloc(strip_size, MALLOC_CAP_DMA);
+			if (!iodev.strip[0] || !iodev.strip[1]) {
+				heap_caps_free(iodev.strip[0]);
+				heap_caps_free(iodev.strip[1]);
+				iodev.strip[0] = iodev.strip[1] = 0;
+			}
+		}
+		iodev.strip_w = strip_w;
+		iodev.strip_idx = 0;
+#endif
+		iodev.task = (void*)xTaskGetCurrentTaskHandle();
+#if JPEG_CHAN_FILE_READ_AHEAD
+		JPEG_FileReader *reader = 0;
+		if (location == PICTURE_IN_FILE) reader = tjd_reader_start(&jd);
+#endif
+		int decoded = 0;
+		if (roi) { //область распаковывается одной задачей
+			//индекс, построенный для другого изображения, не используется
+			if (index && location == PICTURE_IN_MEMORY) jd_set_index(&jd, (const JD_INDEX*)index);
+			rc = jd_decomp_rect(&jd, tjd_output, scale, roi);
+			decoded = 1;
+		}
+#if JPEG_CHAN_RST_PARALLEL
+		if (!decoded && location == PICTURE_IN_MEMORY) decoded = tjd_decomp_rst(&jd, scale, &rc);
+#endif
+#if JPEG_CHAN_PIPELINE
+		if (!decoded) decoded = tjd_decomp_pipeline(&jd, scale, &rc);
+#endif
+		if (!decoded) rc = jd_decomp(&jd, tjd_output, scale);
+#if JPEG_CHAN_FILE_READ_AHEAD
+		if (reader) tjd_reader_stop(&jd, reader);
+#endif
+		if (iodev.strip[0]) {
+			tjd_strip_wait(&iodev);
+			heap_caps_free(iodev.strip[0]);
+			heap_caps_free(iodev.strip[1]);
+		}
+	}
+	return rc;
+}
+
+//Выделяет рабочую память декодеру без заданной памяти: pool_size байт или, если размер
+//не задан, столько, сколько нужно изображению по заголовку. Возвращает 0 при ошибке в rc.
+static uint8_t* tjd_pool_alloc (JPEG_Decoder *dec, void *image_stream, PictureLocation location, uint32_t *size, uint8_t *rc)
+{
+	*size = dec->pool_size;
+	if (dec->pool) return dec->pool;
+	if (!*size) {
+		JD_PROBE info;
+		if ((*rc = LCD_Probe_JPG_chan(image_stream, location, &info)) != JDR_OK) return 0;
+		*size = info.sz_pool;
+	}
+	uint8_t *pool = (uint8_t*)heap_caps_malloc(*size, MALLOC_CAP_8BIT);
+	if (!pool) *rc = JDR_MEM1;
+	return pool;
+}
+
+//Распаковка декодером dec. Рабочая память, не заданная в декодере, выделяется на время распаковки.
+static uint8_t tjd_load (JPEG_Decoder *dec, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+						 void *image_stream, PictureLocation location, JRECT *roi, uint8_t scale, const void *index)
+{
+	uint32_t size;
+	uint8_t rc;
+	uint8_t *pool = tjd_pool_alloc(dec, image_stream, location, &size, &rc);
+	if (!pool) return rc;
+	rc = tjd_decode(dec, pool, size, lcd, x, y, w, h, image_stream, location, roi, scale, index);
+	if (!dec->pool) heap_caps_free(pool);
+	return rc;
+}
+
+//Разбор заголовка jpeg изображения без распаковки: размеры, сэмплирование, интервал перезапуска
+//и размер рабочей памяти декодера (info->sz_pool) для любого формата цвета и масштаба.
+//Файл после разбора возвращается в исходную позицию.
+uint8_t LCD_Probe_JPG_chan (void *image_stream, PictureLocation location, JD_PROBE *info)
+{
+	JDEC jd;
+	IODEV iodev;
+	iodev.file = image_stream;
+	if (location == PICTURE_IN_MEMORY) {
+		return jd_probe_mem(&jd, ((iPicture_jpg*)image_stream)->data, ((iPicture_jpg*)image_stream)->size, info);
+	}
+	if (location != PICTURE_IN_FILE) return JDR_INP;
+	iFile_jpg *file = (iFile_jpg *)image_stream;
+	uint32_t size = file->size;
+	long pos = ftell((FILE *)file->file);
+	JRESULT rc = jd_probe(&jd, tjd_input_file, &iodev, info);
+	if (pos < 0 || fseek((FILE *)file->file, pos, SEEK_SET)) rc = JDR_INP;
+	file->size = size;
+	return rc;
+}
+
+//Инициализация экземпляра декодера.
+//pool, pool_size - рабочая память декодера (pool = 0 - pool_size байт выделяются в куче на время распаковки,
+//pool = 0 и pool_size = 0 - выделяется столько, сколько нужно изображению, см. LCD_Probe_JPG_chan);
+//color_format - формат цвета вывода (1 - R5G6B5 цветной, 3 - R5G6B5 оттенки серого);
+//lock - мьютекс вывода на дисплей (xSemaphoreCreateMutex), общий для всех декодеров, одновременно
+//выводящих на один дисплей; 0 - на дисплей выводит только этот декодер.
+void JPEG_Decoder_Init (JPEG_Decoder *dec, void *pool, uint32_t pool_size, uint8_t color_format, void *lock)
+{
+	dec->pool = (uint8_t*)pool;
+	dec->pool_size = pool_size;
+	dec->color_format = color_format;
+	dec->lock = lock;
+	dec->overlay = 0;
+	dec->tables = 0;
+}
+
+//Задает список объектов MicroGL2D, которые рисуются поверх изображения (текст, шкалы и т.п.).
+//Объекты накладываются на каждую полосу (блок) изображения в буфере перед передачей на дисплей,
+//поэтому изображение с объектами выводится за один проход без буфера кадра. Объекты
+//рисуются только в пределах изображения. overlay = 0 - изображение выводится без объектов.
+void JPEG_Decoder_SetOverlay (JPEG_Decoder *dec, MGL_OBJ *overlay)
+{
+	dec->overlay = overlay;
+}
+
+//Задает кэш таблиц квантования и Хаффмана (инициализированный jd_tblcache_init). Таблицы, совпадающие
+//с таблицами предыдущих изображений (кадры MJPEG, изображения одного кодировщика), не строятся заново.
+//Кэш принадлежит одному декодеру, распаковки которым не должны выполняться одновременно (для декодера
+//кэша изображений это обеспечивает JPEG_CacheCreate). tables = 0 - таблицы строятся для каждого изображения.
+void JPEG_Decoder_SetTableCache (JPEG_Decoder *dec, JD_TBLCACHE *tables)
+{
+	dec->tables = tables;
+}
+
+//Вывод jpeg изображения на дисплей декодером dec (см. LCD_Load_JPG_chan)
+uint8_t LCD_Load_JPG_dec (JPEG_Decoder *dec, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+						  void *image_stream, PictureLocation location)
+{
+	return tjd_load(dec, lcd, x, y, w, h, image_stream, location, 0, 0, 0);
+}
+
+//Вывод области jpeg изображения на дисплей декодером dec (см. LCD_Load_JPG_chan_rect)
+uint8_t LCD_Load_JPG_dec_rect (JPEG_Decoder *dec, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+							   void *image_stream, PictureLocation location, uint16_t src_x, uint16_t src_y,
+							   uint8_t scale, const void *index)
+{
+	if (!w || !h) return JDR_PAR;
+	JRECT roi = { .left = src_x, .right = src_x + w - 1, .top = src_y, .bottom = src_y + h - 1 };
+	return tjd_load(dec, lcd, x, y, w, h, image_stream, location, &roi, scale, index);
+}
+
+//Построение индекса строк блоков jpeg изображения в памяти декодером dec (см. LCD_Index_JPG_chan)
+void* LCD_Index_JPG_dec (JPEG_Decoder *dec, iPicture_jpg *image, uint32_t *size)
+{
+	JDEC jd;
+	JD_INDEX *index = 0;
+	uint32_t pool_size;
+	uint8_t rc;
+	uint8_t *pool = tjd_pool_alloc(dec, image, PICTURE_IN_MEMORY, &pool_size, &rc);
+	if (!pool) return 0;
+	if (jd_prepare_mem_tc(&jd, image->data, image->size, pool, pool_size, 0, dec->tables) == JDR_OK) {
+		size_t len = jd_index_size(&jd);
+		if (len) index = (JD_INDEX*)heap_caps_malloc(len, MALLOC_CAP_8BIT);
+		if (index && jd_build_index(&jd, index) != JDR_OK) {
+			heap_caps_free(index);
+			index = 0;
+		}
+		if (index && size) *size = len;
+	}
+	if (!dec->pool) heap_caps_free(pool);
+	return index;
+}
+
+//Вывод jpeg изображения на дисплей.
+//location определяет местоположение файла (на sd карте или во Flash/RAM МК).
+//Использует общую рабочую память: одновременно может выполняться только одна распаковка
+//функциями LCD_Load_JPG_chan, LCD_Load_JPG_chan_rect и LCD_Index_JPG_chan.
+uint8_t LCD_Load_JPG_chan (LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h, void *image_stream, PictureLocation location)
+{
+	return tjd_load(&jpeg_default, lcd, x, y, w, h, image_stream, location, 0, 0, 0);
+}
+
+//Вывод области jpeg изображения на дисплей в окно x, y, w, h (панорамирование, кадрирование).
+//src_x, src_y - левый верхний угол области в изображении, уменьшенном в 2^scale раз (scale = 0...3).
+//Блоки вне области не проходят IDCT и преобразование цвета, распаковка завершается после
+//последней строки блоков, пересекающей область. С индексом (LCD_Index_JPG_chan) распаковка
+//начинается со строки блоков, содержащей верх области (index = 0 - с начала изображения).
+uint8_t LCD_Load_JPG_chan_rect (LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h, void *image_stream,
+								PictureLocation location, uint16_t src_x, uint16_t src_y, uint8_t scale, const void *index)
+{
+	return LCD_Load_JPG_dec_rect(&jpeg_default, lcd, x, y, w, h, image_stream, location, src_x, src_y, scale, index);
+}
+
+//Построение индекса строк блоков jpeg изображения в памяти. Возвращает индекс, выделенный
+//в куче (освобождается heap_caps_free), и его размер в size; 0 - ошибка. Индекс не содержит
+//указателей: его можно сохранить вместе с изображением и загрузить при следующем запуске.
+void* LCD_Index_JPG_chan (iPicture_jpg *image, uint32_t *size)
+{
+	return LCD_Index_JPG_dec(&jpeg_default, image, size);
+}
+
+//Вывод блока в изображение MicroGL2D. Пиксели за границами изображения отсекаются.
+static int tjd_output_image (JDEC* jd, void* bitmap, JRECT* rect)
+{
+	MGL_IMAGE *image = ((IODEV *)jd->device)->image;
+	uint32_t bpp = jd->color_format ? 2 : 3;	//R5G6B5 (оттенки серого R5G6B5) или R8G8B8
+	uint32_t w = rect->right - rect->left + 1;
+	if (rect->left >= image->w || rect->top >= image->h) return JDR_OK;
+	uint32_t cw = rect->right < image->w ? w : (uint32_t)(image->w - rect->left);
+	uint32_t bottom = rect->bottom < image->h ? rect->bottom : image->h - 1;
+	uint8_t *src = (uint8_t*)bitmap;
+	uint8_t *dst = (uint8_t*)image->data + (rect->top * image->w + rect->left) * bpp;
+	uint8_t swap = bpp == 2 && !((IODEV *)jd->device)->image_order;
+	for (uint32_t row = rect->top; row <= bottom; row++) {
+#if JD_BYTES_SWAP
+		if (swap) {
+			//декодер переставляет байты цвета для передачи на дисплей, изображение MicroGL2D
+			//хранит цвет в порядке байтов процессора
+			uint16_t *s = (uint16_t*)src, *d = (uint16_t*)dst;
+			for (uint32_t i = 0; i < cw; i++) {
+				d[i] = (s[i] >> 8) | (s[i] << 8);
+			}
+		}
+		else
+#endif
+		memcpy(dst, src, cw * bpp);
+		src += w * bpp;
+		dst += image->w * bpp;
+	}
+	return JDR_OK;
+}
+
+//Распаковка в изображение с цветом в порядке байтов процессора (display_order = 0) или дисплея (1)
+static uint8_t tjd_decode_image (JPEG_Decoder *dec, void *image_stream, PictureLocation location, uint8_t scale,
+								 MGL_IMAGE *image, uint8_t display_order)
+{
+	uint8_t color_format;
+	if (scale > 3) return JDR_PAR;
+	if (image->mode == MGL_IMAGE_COLOR_R5G6B5) color_format = dec->color_format == 3 ? 3 : 1;
+	else if (image->mode == MGL_IMAGE_COLOR_R8G8B8) color_format = 0;
+	else return JDR_PAR;
+
+	uint32_t pool_size;
+	uint8_t rc;
+	uint8_t *pool = tjd_pool_alloc(dec, image_stream, location, &pool_size, &rc);
+	if (!pool) return rc;
+	JDEC jd;
+	IODEV iodev;
+	iodev.file = image_stream;
+	iodev.lcd = 0;
+	iodev.strip[0] = iodev.strip[1] = 0;
+	iodev.pipe = 0;
+	iodev.lock = 0;
+	iodev.image = image;
+	iodev.image_order = display_order;
+	iodev.overlay = 0;
+	if (location == PICTURE_IN_MEMORY) {
+		rc = jd_prepare_mem_tc(&jd, ((iPicture_jpg*)image_stream)->data, ((iPicture_jpg*)image_stream)->size,
+							   pool, pool_size, &iodev, dec->tables);
+	}
 	else if (location == PICTURE_IN_FILE) {
-		iodev.file = image_stream;
-		rc = jd_prepare(&jd, tjd_input_file, work_buffer, JPEG_CHAN_WORK_BUFFER_SIZE, &iodev);
+		rc = jd_prepare_tc(&jd, tjd_input_file, pool, pool_size, &iodev, dec->tables);
+	}
+	else {
+		rc = JDR_INP;
 	}
-*/
 	if (rc == JDR_OK) {
-		for (scale = 0; scale < 3; scale++) {
-			if ((jd.width >> scale) <= w && (jd.height >> scale) <= h) break;
+		jd.color_format = color_format;
+		uint8_t *data = 0;
+		if (!image->data) {
+			uint16_t img_w, img_h;
+			tjd_scaled_size(jd.width, jd.height, jd.msx, jd.msy, scale, &img_w, &img_h);
+			data = (uint8_t*)heap_caps_malloc(img_w * img_h * (color_format ? 2 : 3), MALLOC_CAP_8BIT);
+			if (data) {
+				image->data = data;
+				image->w = img_w;
+				image->h = img_h;
+			}
+			else rc = JDR_MEM1;
+		}
+		if (image->data) {
+#if JPEG_CHAN_FILE_READ_AHEAD
+			JPEG_FileReader *reader = 0;
+			if (location == PICTURE_IN_FILE) reader = tjd_reader_start(&jd);
+#endif
+			rc = jd_decomp(&jd, tjd_output_image, scale);
+#if JPEG_CHAN_FILE_READ_AHEAD
+			if (reader) tjd_reader_stop(&jd, reader);
+#endif
+			if (rc != JDR_OK && data) {
+				heap_caps_free(data);
+				image->data = 0;
+			}
 		}
-		rc = jd_decomp(&jd, tjd_output, scale);
 	}
+	if (!dec->pool) heap_caps_free(pool);
 	return rc;
 }
+
+//Распаковка jpeg изображения, уменьшенного в 2^scale раз (scale = 0...3), в изображение MicroGL2D
+//(например, для текстуры MGL_ObjectSetTexture). Режим цвета image->mode: MGL_IMAGE_COLOR_R5G6B5
+//(оттенки серого при формате цвета декодера 3) или MGL_IMAGE_COLOR_R8G8B8.
+//image->data = 0 - память изображения выделяется в куче (освобождается heap_caps_free), в image->w,
+//image->h записываются размеры уменьшенного изображения; иначе image->data - массив image->w * image->h
+//пикселей, часть изображения за его границами отсекается.
+uint8_t JPEG_DecodeImage (JPEG_Decoder *dec, void *image_stream, PictureLocation location, uint8_t scale, MGL_IMAGE *image)
+{
+	return tjd_decode_image(dec, image_stream, location, scale, image, 0);
+}
+
+/*
+ * Кэш распакованных изображений
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Изображения в памяти распаковываются в R5G6B5 с порядком байтов дисплея и хранятся в куче
+ * с заданными свойствами (caps). Ключ - данные и размер jpeg изображения, масштаб и формат цвета.
+ * Повторный вывод - только передача готовых пикселей на дисплей. Изображения упорядочены
+ * по давности использования: при нехватке бюджета вытесняются давно не выводившиеся.
+ */
+typedef struct JPEG_CacheEntry_ {
+	const uint8_t *src;		//ключ: данные jpeg изображения
+	uint32_t src_size;		//размер данных
+	uint8_t scale;			//масштаб
+	uint8_t color_format;	//формат цвета
+	uint16_t w, h;			//размеры распакованного изображения
+	uint16_t *data;			//пиксели R5G6B5 в порядке байтов дисплея
+	uint32_t bytes;			//память, занятая изображением (с описанием)
+	struct JPEG_CacheEntry_ *prev, *next;	//список по давности использования (first - последнее выведенное)
+} JPEG_CacheEntry;
+
+struct JPEG_Cache_ {
+	JPEG_Decoder *dec;		//декодер для распаковки изображений, отсутствующих в кэше
+	uint32_t budget;		//бюджет памяти кэша, байт
+	uint32_t caps;			//свойства памяти изображений (heap_caps_malloc)
+	JPEG_CacheEntry *first, *last;
+	JPEG_CacheStats stats;
+	SemaphoreHandle_t mutex;
+	SemaphoreHandle_t decode;	//распаковка декодером dec (его рабочая память и кэш таблиц общие для всех задач)
+};
+
+static void tjd_cache_unlink (JPEG_Cache *cache, JPEG_CacheEntry *e)
+{
+	if (e->prev) e->prev->next = e->next;
+	else cache->first = e->next;
+	if (e->next) e->next->prev = e->prev;
+	else cache->last = e->prev;
+}
+
+static void tjd_cache_push (JPEG_Cache *cache, JPEG_CacheEntry *e)
+{
+	e->prev = 0;
+	e->next = cache->first;
+	if (cache->first) cache->first->prev = e;
+	else cache->last = e;
+	cache->first = e;
+}
+
+static void tjd_cache_free (JPEG_Cache *cache, JPEG_CacheEntry *e)
+{
+	tjd_cache_unlink(cache, e);
+	cache->stats.used -= e->bytes;
+	cache->stats.entries--;
+	heap_caps_free(e->data);
+	heap_caps_free(e);
+}
+
+//Освобождает давно не выводившиеся изображения, пока в бюджете не окажется bytes свободных байт
+static void tjd_cache_evict (JPEG_Cache *cache, uint32_t bytes)
+{
+	while (cache->last && cache->stats.used + bytes > cache->budget) {
+		tjd_cache_free(cache, cache->last);
+		cache->stats.evictions++;
+	}
+}
+
+//Передает изображение из кэша на дисплей (часть за границами дисплея отсекается)
+static void tjd_cache_blit (JPEG_Cache *cache, JPEG_CacheEntry *e, LCD_Handler *lcd, uint16_t x, uint16_t y)
+{
+	if (x >= lcd->Width || y >= lcd->Height) return;
+	uint16_t w = e->w < lcd->Width - x ? e->w : lcd->Width - x;
+	uint16_t h = e->h < lcd->Height - y ? e->h : lcd->Height - y;
+	uint16_t rows = w == e->w ? 1 : h;		//при отсечении по ширине строки передаются своими окнами
+	uint16_t lines = w == e->w ? h : 1;
+	SemaphoreHandle_t lock = (SemaphoreHandle_t)cache->dec->lock;
+	if (lock) xSemaphoreTake(lock, portMAX_DELAY);
+	for (uint16_t i = 0; i < rows; i++) {
+		uint16_t *data = e->data + i * e->w;
+		if (cache->caps & MALLOC_CAP_DMA) {
+			//память доступна DMA: передача через очередь хоста spi, ожидание ее окончания
+			LCD_QueueSetActiveWindow(lcd, x, y + i, x + w - 1, y + i + lines - 1);
+			LCD_QueueWriteData(lcd, data, w * lines, i == rows - 1 ? LCD_QueueNotifyCallback : 0,
+							   (void*)xTaskGetCurrentTaskHandle());
+		}
+		else {
+			LCD_DrawImage(lcd, x, y + i, w, lines, data, 0);
+		}
+	}
+	if (lock) xSemaphoreGive(lock);
+	if (cache->caps & MALLOC_CAP_DMA) ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+}
+
+//Создает кэш распакованных изображений.
+//dec - декодер для распаковки (его формат цвета - часть ключа, мьютекс вывода используется при выводе из кэша);
+//budget - бюджет памяти кэша, байт; caps - свойства памяти изображений: MALLOC_CAP_DMA - вывод через DMA,
+//иначе (например, MALLOC_CAP_SPIRAM) - вывод процессором.
+//Кэшем могут пользоваться несколько задач: изображения из кэша выводятся параллельно с распаковкой,
+//а распаковки декодером dec выполняются по очереди (рабочая память и кэш таблиц декодера общие).
+//Декодер dec после создания кэша используется только через кэш. Объекты overlay декодера не выводятся.
+JPEG_Cache* JPEG_CacheCreate (JPEG_Decoder *dec, uint32_t budget, uint32_t caps)
+{
+	JPEG_Cache *cache = (JPEG_Cache*)heap_caps_malloc(sizeof(JPEG_Cache), MALLOC_CAP_8BIT);
+	if (!cache) return 0;
+	memset(cache, 0, sizeof(JPEG_Cache));
+	cache->mutex = xSemaphoreCreateMutex();
+	cache->decode = xSemaphoreCreateMutex();
+	if (!cache->mutex || !cache->decode) {
+		if (cache->mutex) vSemaphoreDelete(cache->mutex);
+		if (cache->decode) vSemaphoreDelete(cache->decode);
+		heap_caps_free(cache);
+		return 0;
+	}
+	cache->dec = dec;
+	cache->budget = budget;
+	cache->caps = caps;
+	return cache;
+}
+
+//Освобождает все изображения кэша
+void JPEG_CacheClear (JPEG_Cache *cache)
+{
+	xSemaphoreTake(cache->mutex, portMAX_DELAY);
+	while (cache->first) tjd_cache_free(cache, cache->first);
+	xSemaphoreGive(cache->mutex);
+}
+
+//Удаляет кэш
+void JPEG_CacheDelete (JPEG_Cache *cache)
+{
+	if (!cache) return;
+	JPEG_CacheClear(cache);
+	vSemaphoreDelete(cache->mutex);
+	vSemaphoreDelete(cache->decode);
+	heap_caps_free(cache);
+}
+
+//Возвращает статистику кэша
+void JPEG_CacheGetStats (JPEG_Cache *cache, JPEG_CacheStats *stats)
+{
+	xSemaphoreTake(cache->mutex, portMAX_DELAY);
+	*stats = cache->stats;
+	xSemaphoreGive(cache->mutex);
+}
+
+//Вывод jpeg изображения в памяти, уменьшенного в 2^scale раз (scale = 0...3), в позицию x, y дисплея
+//через кэш. Изображение, отсутствующее в кэше, распаковывается в кэш и выводится из него.
+//Изображение, не помещающееся в бюджет или в память, выводится декодером без сохранения.
+uint8_t LCD_Load_JPG_cached (JPEG_Cache *cache, LCD_Handler *lcd, uint16_t x, uint16_t y, iPicture_jpg *image, uint8_t scale)
+{
+	if (scale > 3) return JDR_PAR;
+	uint8_t color_format = cache->dec->color_format == 3 ? 3 : 1;
+	JPEG_CacheEntry *e;
+	xSemaphoreTake(cache->mutex, portMAX_DELAY);
+	for (e = cache->first; e; e = e->next) {
+		if (e->src == image->data && e->src_size == image->size && e->scale == scale && e->color_format == color_format) break;
+	}
+	if (e) {
+		cache->stats.hits++;
+		tjd_cache_unlink(cache, e);
+		tjd_cache_push(cache, e);
+		tjd_cache_blit(cache, e, lcd, x, y);
+		xSemaphoreGive(cache->mutex);
+		return JDR_OK;
+	}
+	cache->stats.misses++;
+	xSemaphoreGive(cache->mutex);
+
+	//распаковка выполняется без блокировки кэша: другие задачи могут выводить изображения из него
+	JD_PROBE info;
+	uint8_t rc = LCD_Probe_JPG_chan(image, PICTURE_IN_MEMORY, &info);
+	if (rc != JDR_OK) return rc;
+	uint16_t w, h;
+	tjd_scaled_size(info.width, info.height, info.msx, info.msy, scale, &w, &h);
+	uint32_t bytes = sizeof(JPEG_CacheEntry) + w * h * sizeof(uint16_t);
+	uint8_t shown = 0;
+	if (bytes <= cache->budget) {
+		xSemaphoreTake(cache->mutex, portMAX_DELAY);
+		tjd_cache_evict(cache, bytes);
+		cache->stats.used += bytes; //память резервируется до окончания распаковки
+		xSemaphoreGive(cache->mutex);
+		e = (JPEG_CacheEntry*)heap_caps_malloc(sizeof(JPEG_CacheEntry), MALLOC_CAP_8BIT);
+		uint16_t *data = e ? (uint16_t*)heap_caps_malloc(w * h * sizeof(uint16_t), cache->caps) : 0;
+		MGL_IMAGE surface = { data, w, h, MGL_IMAGE_COLOR_R5G6B5 };
+		if (data) {
+			xSemaphoreTake(cache->decode, portMAX_DELAY);
+			rc = tjd_decode_image(cache->dec, image, PICTURE_IN_MEMORY, scale, &surface, 1);
+			xSemaphoreGive(cache->decode);
+		}
+		xSemaphoreTake(cache->mutex, portMAX_DELAY);
+		cache->stats.used -= bytes;
+		JPEG_CacheEntry *same;
+		for (same = cache->first; same; same = same->next) { //то же изображение, распакованное другой задачей
+			if (same->src == image->data && same->src_size == image->size && same->scale == scale && same->color_format == color_format) break;
+		}
+		if (data && rc == JDR_OK && !same) {
+			e->src = image->data;
+			e->src_size = image->size;
+			e->scale = scale;
+			e->color_format = color_format;
+			e->w = w;
+			e->h = h;
+			e->data = data;
+			e->bytes = bytes;
+			tjd_cache_evict(cache, bytes);
+			cache->stats.used += bytes;
+			cache->stats.entries++;
+			tjd_cache_push(cache, e);
+			tjd_cache_blit(cache, e, lcd, x, y);
+			shown = 1;
+		}
+		else {
+			if (data && rc == JDR_OK) {
+				tjd_cache_blit(cache, same, lcd, x, y);
+				shown = 1;
+			}
+			heap_caps_free(data);
+			heap_caps_free(e);
+		}
+		xSemaphoreGive(cache->mutex);
+		if (rc != JDR_OK) return rc;
+	}
+	if (!shown) { //изображение не сохраняется в кэше
+		xSemaphoreTake(cache->mutex, portMAX_DELAY);
+		cache->stats.uncached++;
+		xSemaphoreGive(cache->mutex);
+		if (x >= lcd->Width || y >= lcd->Height) return JDR_OK;
+		JPEG_Decoder dec = *cache->dec;
+		dec.overlay = 0; //как и при выводе из кэша
+		xSemaphoreTake(cache->decode, portMAX_DELAY);
+		rc = LCD_Load_JPG_dec_rect(&dec, lcd, x, y, lcd->Width - x, lcd->Height - y, image, PICTURE_IN_MEMORY, 0, 0, scale, 0);
+		xSemaphoreGive(cache->decode);
+	}
+	return rc;
+}
+
+/*
+ * Предварительный просмотр по встроенной миниатюре
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Фотографии обычно содержат миниатюру (около 160x120) в сегменте APP1 Exif (IFD1, теги
+ * JPEGInterchangeFormat и JPEGInterchangeFormatLength) или в расширении JFIF APP0 JFXX (код 0x10).
+ * Миниатюра - отдельное jpeg изображение внутри заголовка: ее распаковка занимает доли
+ * времени распаковки основного изображения даже с уменьшением в 8 раз.
+ */
+
+//Чтение len байт со смещения pos от начала изображения (файл - от позиции start)
+static int tjd_thumb_read (void *image_stream, PictureLocation location, long start, uint32_t pos, void *buf, uint32_t len)
+{
+	if (location == PICTURE_IN_MEMORY) {
+		iPicture_jpg *image = (iPicture_jpg*)image_stream;
+		if (pos > image->size || len > image->size - pos) return 0;
+		memcpy(buf, image->data + pos, len);
+		return 1;
+	}
+	iFile_jpg *file = (iFile_jpg*)image_stream;
+	if (pos > file->size || len > file->size - pos) return 0;
+	if (fseek((FILE*)file->file, start + (long)pos, SEEK_SET)) return 0;
+	return fread(buf, 1, len, (FILE*)file->file) == len;
+}
+
+static uint32_t tjd_tiff_u16 (const uint8_t *p, int be)
+{
+	return be ? (uint32_t)p[0] << 8 | p[1] : (uint32_t)p[1] << 8 | p[0];
+}
+
+static uint32_t tjd_tiff_u32 (const uint8_t *p, int be)
+{
+	return be ? tjd_tiff_u16(p, 1) << 16 | tjd_tiff_u16(p + 2, 1) : tjd_tiff_u16(p + 2, 0) << 16 | tjd_tiff_u16(p, 0);
+}
+
+//Миниатюра в данных Exif: tiff - смещение заголовка TIFF, end - конец сегмента APP1
+static int tjd_exif_thumb (void *image_stream, PictureLocation location, long start, uint32_t tiff, uint32_t end,
+						   uint32_t *offset, uint32_t *size)
+{
+	uint8_t b[12];
+	if (!tjd_thumb_read(image_stream, location, start, tiff, b, 8)) return 0;
+	int be = b[0] == 'M';
+	if ((b[0] != 'I' && b[0] != 'M') || b[1] != b[0] || tjd_tiff_u16(b + 2, be) != 42) return 0;
+	//IFD0 (основное изображение), за ним IFD1 (миниатюра)
+	uint32_t ifd = tjd_tiff_u32(b + 4, be);
+	if (!tjd_thumb_read(image_stream, location, start, tiff + ifd, b, 2)) return 0;
+	uint32_t n = tjd_tiff_u16(b, be);
+	if (!tjd_thumb_read(image_stream, location, start, tiff + ifd + 2 + n * 12, b, 4)) return 0;
+	ifd = tjd_tiff_u32(b, be);
+	if (!ifd || !tjd_thumb_read(image_stream, location, start, tiff + ifd, b, 2)) return 0;
+	n = tjd_tiff_u16(b, be);
+	uint32_t thumb_ofs = 0, thumb_len = 0;
+	for (uint32_t i = 0; i < n; i++) {	//запись: тег, тип, количество, значение
+		if (!tjd_thumb_read(image_stream, location, start, tiff + ifd + 2 + i * 12, b, 12)) return 0;
+		uint32_t tag = tjd_tiff_u16(b, be);
+		uint32_t val = tjd_tiff_u16(b + 2, be) == 3 ? tjd_tiff_u16(b + 8, be) : tjd_tiff_u32(b + 8, be);
+		if (tag == 0x0201) thumb_ofs = val;
+		else if (tag == 0x0202) thumb_len = val;
+	}
+	if (!thumb_ofs || !thumb_len || thumb_ofs > end - tiff || thumb_len > end - tiff - thumb_ofs) return 0;
+	*offset = tiff + thumb_ofs;
+	*size = thumb_len;
+	return 1;
+}
+
+//Поиск миниатюры в заголовке (до начала сканирования). start - позиция начала изображения в файле.
+static uint8_t tjd_find_thumb (void *image_stream, PictureLocation location, long start, uint32_t *offset, uint32_t *size)
+{
+	uint8_t b[6];
+	uint32_t pos = 2;
+	if (!tjd_thumb_read(image_stream, location, start, 0, b, 2)) return JDR_INP;
+	if (b[0] != 0xFF || b[1] != 0xD8) return JDR_FMT1;
+	for (;;) {
+		if (!tjd_thumb_read(image_stream, location, start, pos, b, 4)) return JDR_INP;
+		uint32_t len = (uint32_t)b[2] << 8 | b[3];
+		if (b[0] != 0xFF || len < 2) return JDR_FMT1;
+		if (b[1] == 0xDA || b[1] == 0xD9) return JDR_FMT2;	//SOS, EOI: миниатюры нет
+		uint32_t seg = pos + 4, end = pos + 2 + len;
+		if (b[1] == 0xE1 && len >= 2 + 6 + 8 && tjd_thumb_read(image_stream, location, start, seg, b, 6) &&
+			!memcmp(b, "Exif\0\0", 6) && tjd_exif_thumb(image_stream, location, start, seg + 6, end, offset, size)) break;
+		if (b[1] == 0xE0 && len > 2 + 6 && tjd_thumb_read(image_stream, location, start, seg, b, 6) &&
+			!memcmp(b, "JFXX\0\x10", 6)) {
+			*offset = seg + 6;
+			*size = end - *offset;
+			break;
+		}
+		pos = end;
+	}
+	//миниатюра должна быть jpeg изображением
+	if (!tjd_thumb_read(image_stream, location, start, *offset, b, 2) || b[0] != 0xFF || b[1] != 0xD8) return JDR_FMT2;
+	return JDR_OK;
+}
+
+//Поиск миниатюры jpeg изображения. offset - смещение миниатюры от начала изображения
+//(файла - от текущей позиции), size - ее размер. Возвращает JDR_OK, если миниатюра найдена,
+//JDR_FMT2, если ее нет. Файл после поиска возвращается в исходную позицию.
+uint8_t JPEG_FindThumbnail (void *image_stream, PictureLocation location, uint32_t *offset, uint32_t *size)
+{
+	if (location == PICTURE_IN_MEMORY) return tjd_find_thumb(image_stream, location, 0, offset, size);
+	if (location != PICTURE_IN_FILE) return JDR_INP;
+	FILE *f = (FILE*)((iFile_jpg*)image_stream)->file;
+	long start = ftell(f);
+	if (start < 0) return JDR_INP;
+	uint8_t rc = tjd_find_thumb(image_stream, location, start, offset, size);
+	if (fseek(f, start, SEEK_SET)) rc = JDR_INP;
+	return rc;
+}
+
+//Вывод jpeg изображения с предварительным просмотром декодером dec. Сначала выводится миниатюра
+//из заголовка: в центре области, которую займет изображение, с уменьшением до ее размеров.
+//refine = 1 - затем изображение выводится полностью (см. LCD_Load_JPG_chan), refine = 0 - только миниатюра.
+//Изображение без миниатюры выводится полностью. Миниатюра файла читается в кучу.
+uint8_t LCD_Load_JPG_preview (JPEG_Decoder *dec, LCD_Handler *lcd, uint16_t x, uint16_t y, uint16_t w, uint16_t h,
+							  void *image_stream, PictureLocation location, uint8_t refine)
+{
+	JD_PROBE info;
+	uint32_t offset, size;
+	long start = 0;
+	uint8_t rc = LCD_Probe_JPG_chan(image_stream, location, &info);
+	if (rc != JDR_OK) return rc;
+	FILE *f = location == PICTURE_IN_FILE ? (FILE*)((iFile_jpg*)image_stream)->file : 0;
+	if (f && (start = ftell(f)) < 0) return JDR_INP;
+	int shown = 0;
+	if (tjd_find_thumb(image_stream, location, start, &offset, &size) == JDR_OK) {
+		iPicture_jpg thumb = { 0, size };
+		uint8_t *buf = 0;
+		if (!f) thumb.data = ((iPicture_jpg*)image_stream)->data + offset;
+		else if ((buf = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_8BIT)) &&
+				 tjd_thumb_read(image_stream, location, start, offset, buf, size)) thumb.data = buf;
+		JD_PROBE tinfo;
+		if (thumb.data && LCD_Probe_JPG_chan(&thumb, PICTURE_IN_MEMORY, &tinfo) == JDR_OK) {
+			//область изображения и размеры миниатюры, уменьшенной до нее
+			uint16_t img_w, img_h, tw, th;
+			tjd_scaled_size(info.width, info.height, info.msx, info.msy, tjd_fit_scale(info.width, info.height, w, h), &img_w, &img_h);
+			tjd_scaled_size(tinfo.width, tinfo.height, tinfo.msx, tinfo.msy,
+							tjd_fit_scale(tinfo.width, tinfo.height, img_w, img_h), &tw, &th);
+			uint16_t tx = x + (tw < img_w ? (img_w - tw) / 2 : 0), ty = y + (th < img_h ? (img_h - th) / 2 : 0);
+			shown = LCD_Load_JPG_dec(dec, lcd, tx, ty, img_w, img_h, &thumb, PICTURE_IN_MEMORY) == JDR_OK;
+		}
+		heap_caps_free(buf);
+	}
+	if (f && fseek(f, start, SEEK_SET)) return JDR_INP;
+	if (shown && !refine) return JDR_OK;
+	return tjd_load(dec, lcd, x, y, w, h, image_stream, location, 0, 0, 0);
+}
@@ -60,9 +60,11 @@
 #define HUFF_BIT	10	/* Bit length to apply fast huffman decode */
 #define HUFF_LEN	(1 << HUFF_BIT)
 #define HUFF_MASK	(HUFF_LEN - 1)
+#if HUFF_LEN != JD_HUFF_LUT_LEN
+#error "JD_HUFF_LUT_LEN must match HUFF_BIT"
+#endif
+#define HUFF_VAL	0x1000	//Признак результата huffext (AC) с кодом и значением коэффициента: b11..8 - серия нулей, b7..0 - значение
 #endif
-
-extern uint8_t AVI_color_mode;
 
 /*
  * Оптимизация
@@ -247,6 +249,136 @@ static void* alloc_pool (	/* Pointer to allocated memory block (NULL:no memory a
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Источник данных в памяти (jd_prepare_mem)                             */
+/*-----------------------------------------------------------------------*/
+
+//Функция ввода для источника в памяти: копирует данные в buff (buff = 0 - пропуск данных)
+static size_t mem_input (JDEC* jd, uint8_t* buff, size_t nd)
+{
+	if (jd->mem_left < nd) nd = jd->mem_left;
+	if (buff) memcpy(buff, jd->mem, nd);
+	jd->mem += nd;
+	jd->mem_left -= nd;
+	return nd;
+}
+
+//Заполнение входного буфера потока. Источник в памяти при JD_FASTDECODE >= 1 не копируется:
+//*dp указывает на его данные, и весь остаток источника становится доступен сразу
+//(при JD_FASTDECODE == 0 декодер изменяет данные в буфере, поэтому они копируются).
+static inline size_t stream_fill (JDEC* jd, uint8_t** dp)
+{
+	size_t dc;
+#if JD_FASTDECODE >= 1
+	if (jd->mem) {
+		*dp = (uint8_t*)jd->mem;
+		dc = jd->mem_left;
+		jd->mem += dc;
+		jd->mem_left = 0;
+		return dc;
+	}
+#endif
+	*dp = jd->inbuf;
+	dc = jd->infunc(jd, *dp, JD_SZBUF);
+	return dc;
+}
+
+//Чтение len байт заголовка. Возвращает указатель на данные (0 - ошибка ввода): данные источника
+//в памяти не копируются, иначе копируются во входной буфер
+static const uint8_t* stream_read (JDEC* jd, size_t len)
+{
+	const uint8_t *p;
+#if JD_FASTDECODE >= 1
+	if (jd->mem) {
+		if (jd->mem_left < len) return 0;
+		p = jd->mem;
+		jd->mem += len;
+		jd->mem_left -= len;
+		return p;
+	}
+#endif
+	if (jd->infunc(jd, jd->inbuf, len) != len) return 0;
+	p = jd->inbuf;
+	return p;
+}
+
+
+
+
+/*
+ * Кэш таблиц квантования и Хаффмана
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Данные каждой таблицы сегмента DQT/DHT хэшируются и сравниваются с таблицами кэша. Совпавшая
+ * таблица берется из кэша, иначе строится в записи, не использовавшейся дольше других (таблицы,
+ * уже взятые текущим изображением, не вытесняются), или, если такой нет, в рабочей памяти.
+ * Запись становится действительной только после успешного построения таблицы.
+ */
+static uint32_t tc_hash (const uint8_t* data, size_t len)
+{
+	uint32_t h = 2166136261u;	//FNV-1a
+	while (len--) h = (h ^ *data++) * 16777619u;
+	return h ? h : 1;
+}
+
+//Поиск таблицы квантования. Возвращает запись с таблицей (*hit = 1), запись для построения
+//таблицы (*hit = 0) или 0, если все записи заняты таблицами текущего изображения
+static JD_TC_QT* tc_find_qt (JD_TBLCACHE* tc, const uint8_t* data, uint32_t* hash, int* hit)
+{
+	JD_TC_QT *e, *victim = 0;
+	uint32_t h = tc_hash(data, 64);
+	for (e = tc->qt; e < tc->qt + JD_TBLCACHE_QT; e++) {
+		if (e->hash == h && !memcmp(e->raw, data, 64)) {
+			e->stamp = tc->stamp;
+			tc->hits++;
+			*hit = 1;
+			return e;
+		}
+		if (e->stamp != tc->stamp && (!victim || e->stamp < victim->stamp)) victim = e;
+	}
+	tc->misses++;
+	*hit = 0;
+	*hash = h;
+	if (victim) {
+		victim->hash = 0;
+		victim->stamp = tc->stamp;
+	}
+	return victim;
+}
+
+//Поиск таблицы Хаффмана класса cls (см. tc_find_qt)
+static JD_TC_HUFF* tc_find_huff (JD_TBLCACHE* tc, unsigned int cls, const uint8_t* data, size_t len, uint32_t* hash, int* hit)
+{
+	JD_TC_HUFF *e, *victim = 0;
+	uint32_t h = tc_hash(data, len);
+	for (e = tc->huff; e < tc->huff + JD_TBLCACHE_HUFF; e++) {
+		if (e->hash == h && e->cls == cls && e->len == len && !memcmp(e->raw, data, len)) {
+			e->stamp = tc->stamp;
+			tc->hits++;
+			*hit = 1;
+			return e;
+		}
+		if (e->stamp != tc->stamp && (!victim || e->stamp < victim->stamp)) victim = e;
+	}
+	tc->misses++;
+	*hit = 0;
+	*hash = h;
+	if (victim) {
+		victim->hash = 0;
+		victim->stamp = tc->stamp;
+	}
+	return victim;
+}
+
+//Очистка кэша таблиц
+void jd_tblcache_init (JD_TBLCACHE* tc)
+{
+	memset(tc, 0, sizeof (JD_TBLCACHE));
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Create de-quantization and prescaling tables with a DQT segment       */
 /*-----------------------------------------------------------------------*/
@@ -260,15 +392,28 @@ static JRESULT create_qt_tbl (	/* 0:OK, !0:Failed */
 	unsigned int i, zi;
 	uint8_t d;
 	int32_t *pb;
+	JD_TC_QT *e;
+	uint32_t hash;
+	int hit;
 	while (ndata) {	/* Process all tables in the segment */
 		if (ndata < 65) return JDR_FMT1;	/* Err: table size is unaligned */
 		ndata -= 65;
 		d = *data++;							/* Get table property */
 		if (d & 0xF0) return JDR_FMT1;			/* Err: not 8-bit resolution */
 		i = d & 3;								/* Get table ID */
-		pb = alloc_pool(jd, 64 * sizeof (int32_t));/* Allocate a memory block for the table */
+		e = jd->tblcache ? tc_find_qt(jd->tblcache, data, &hash, &hit) : 0;
+		if (e && hit) {							//таблица уже построена
+			jd->qttbl[i] = e->tbl;
+			data += 64;
+			continue;
+		}
+		pb = e ? e->tbl : alloc_pool(jd, 64 * sizeof (int32_t));/* Allocate a memory block for the table */
 		if (!pb) return JDR_MEM1;				/* Err: not enough memory */
 		jd->qttbl[i] = pb;						/* Register the table */
+		if (e) {
+			memcpy(e->raw, data, 64);
+			e->hash = hash;
+		}
 		for (i = 0; i < 64; i++) {				/* Load the table */
 			zi = Zig[i];						/* Zigzag-order to raster-order conversion */
 			pb[zi] = (int32_t)((uint32_t)*data++ * Ipsf[zi]);	/* Apply scale factor of Arai algorithm to the de-quantizers */
@@ -295,6 +440,9 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 	size_t np;
 	uint8_t d, *pb, *pd;
 	uint16_t hc, *ph;
+	JD_TC_HUFF *e;
+	uint32_t hash;
+	int hit;
 
 
 	while (ndata) {	/* Process all tables in the segment */
@@ -303,13 +451,28 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 		d = *data++;						/* Get table number and class */
 		if (d & 0xEE) return JDR_FMT1;		/* Err: invalid class/number */
 		cls = d >> 4; num = d & 0x0F;		/* class = dc(0)/ac(1), table number = 0/1 */
-		pb = alloc_pool(jd, 16);			/* Allocate a memory block for the bit distribution table */
+		for (np = i = 0; i < 16; i++) np += data[i];
+		e = jd->tblcache && np <= 256 && ndata >= np ? tc_find_huff(jd->tblcache, cls, data, 16 + np, &hash, &hit) : 0;
+		if (e && hit) {						//таблица уже построена
+			jd->huffbits[num][cls] = e->raw;
+			jd->huffcode[num][cls] = e->code;
+			jd->huffdata[num][cls] = e->raw + 16;
+#if (JD_FASTDECODE == 2)
+			if (cls) jd->hufflut_ac[num] = e->lut;
+			else jd->hufflut_dc[num] = (uint8_t*)e->lut;
+			jd->longofs[num][cls] = e->longofs;
+#endif
+			data += 16 + np;
+			ndata -= np;
+			continue;
+		}
+		pb = e ? e->raw : alloc_pool(jd, 16);	/* Allocate a memory block for the bit distribution table */
 		if (!pb) return JDR_MEM1;			/* Err: not enough memory */
 		jd->huffbits[num][cls] = pb;
 		for (np = i = 0; i < 16; i++) {		/* Load number of patterns for 1 to 16-bit code */
 			np += (pb[i] = *data++);		/* Get sum of code words for each code */
 		}
-		ph = alloc_pool(jd, np * sizeof (uint16_t));/* Allocate a memory block for the code word table */
+		ph = e ? e->code : alloc_pool(jd, np * sizeof (uint16_t));/* Allocate a memory block for the code word table */
 		if (!ph) return JDR_MEM1;			/* Err: not enough memory */
 		jd->huffcode[num][cls] = ph;
 		hc = 0;
@@ -321,7 +484,7 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 
 		if (ndata < np) return JDR_FMT1;	/* Err: wrong data size */
 		ndata -= np;
-		pd = alloc_pool(jd, np);			/* Allocate a memory block for the decoded data */
+		pd = e ? e->raw + 16 : alloc_pool(jd, np);	/* Allocate a memory block for the decoded data */
 		if (!pd) return JDR_MEM1;			/* Err: not enough memory */
 		jd->huffdata[num][cls] = pd;
 		for (i = 0; i < np; i++) {			/* Load decoded data corresponds to each code word */
@@ -331,14 +494,14 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 		}
 #if (JD_FASTDECODE == 2)
 		{	/* Create fast huffman decode table */
-			unsigned int td, ti;
+			unsigned int td, ti, nb;
 #if (JD_FAST_OPTIMIZE == 0)
 			unsigned int span;
 #endif
 			uint16_t *tbl_ac = 0;
 			uint8_t *tbl_dc = 0;
 			if (cls) {
-				tbl_ac = alloc_pool(jd, HUFF_LEN * sizeof (uint16_t));	/* LUT for AC elements */
+				tbl_ac = e ? e->lut : alloc_pool(jd, HUFF_LEN * sizeof (uint16_t));	/* LUT for AC elements */
 				if (!tbl_ac) return JDR_MEM1;		/* Err: not enough memory */
 				jd->hufflut_ac[num] = tbl_ac;
 #if (JD_FAST_OPTIMIZE == 0)
@@ -347,7 +510,7 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 				memset_32(tbl_ac, 0xffffffff, HUFF_LEN/2); //оптимизация
 #endif
 			} else {
-				tbl_dc = alloc_pool(jd, HUFF_LEN * sizeof (uint8_t));	/* LUT for AC elements */
+				tbl_dc = e ? (uint8_t*)e->lut : alloc_pool(jd, HUFF_LEN * sizeof (uint8_t));	/* LUT for AC elements */
 				if (!tbl_dc) return JDR_MEM1;		/* Err: not enough memory */
 				jd->hufflut_dc[num] = tbl_dc;
 #if (JD_FAST_OPTIMIZE == 0)
@@ -360,7 +523,25 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 				for (j = pb[b]; j; j--) {
 					ti = ph[i] << (HUFF_BIT - 1 - b) & HUFF_MASK;	/* Index of input pattern for the code */
 					if (cls) {
-						td = pd[i++] | ((b + 1) << 8);	/* b15..b8: code length, b7..b0: zero run and data length */
+						td = pd[i++];
+						nb = td & 0x0F;					//Длина значения коэффициента
+						if (nb && nb <= 7 && b + 1 + nb <= HUFF_BIT) {
+							//Код и значение помещаются в индекс таблицы: запись сразу содержит значение коэффициента.
+							//b15..b12: длина кода со значением, b11..b8: серия нулей, b7..b0: значение со знаком
+							unsigned int m, vs = HUFF_BIT - 1 - b - nb;
+							for (m = 0; m < (1U << nb); m++) {
+								int v = (m & (1U << (nb - 1))) ? (int)m : (int)m - (int)((1U << nb) - 1);	//Восстановление знака
+								td = ((b + 1 + nb) << 12) | ((pd[i - 1] >> 4) << 8) | (v & 0xFF);
+#if (JD_FAST_OPTIMIZE == 0)
+								for (span = 1 << vs; span; span--, tbl_ac[ti++] = (uint16_t)td) ; //оригинал
+#else
+								memset_16(&tbl_ac[ti], (uint16_t)td, 1 << vs); //оптимизация
+								ti += 1 << vs;
+#endif
+							}
+							continue;
+						}
+						td |= (b + 1) << 8;	/* b15..b8: code length, b7..b0: zero run and data length */
 #if (JD_FAST_OPTIMIZE == 0)
 						for (span = 1 << (HUFF_BIT - 1 - b); span; span--, tbl_ac[ti++] = (uint16_t)td) ; //оригинал
 #else
@@ -377,14 +558,79 @@ static JRESULT create_huffman_tbl (	/* 0:OK, !0:Failed */
 				}
 			}
 			jd->longofs[num][cls] = i;	/* Code table offset for long code */
+			if (e) e->longofs = i;
 		}
 #endif
+		if (e) {							//таблица построена в записи кэша
+			e->len = 16 + np;
+			e->cls = cls;
+			e->hash = hash;
+		}
 	}
 
 	return JDR_OK;
 }
 
 
+#if JD_FASTDECODE >= 1
+/*
+ * Пополнение 64-битного регистра битов jd->wreg до nbit и более битов
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Пока в регистре меньше 32 битов и в следующих 4 байтах потока нет 0xFF, регистр пополняется
+ * сразу словом из 4 байтов. Побайтно (с обработкой 0xFF00 и маркеров) поток читается только
+ * вблизи байта 0xFF и на границе входного буфера. Биты регистра выше jd->dbit не очищаются:
+ * читающие их отбрасывают маской.
+ */
+static inline int wreg_fill (	/* 0: OK, <0: error code */
+	JDEC* jd,			/* Pointer to the decompressor object */
+	unsigned int nbit	/* Number of bits required (1 to 32) */
+)
+{
+	size_t dc = jd->dctr;
+	uint8_t *dp = jd->dptr;
+	unsigned int d, wbit = jd->dbit, flg = 0;
+	uint64_t w = jd->wreg;
+	uint32_t x;
+
+	while (wbit < nbit) {
+		if (wbit < 32 && dc >= 4 && !flg && !jd->marker) {
+			x = ((uint32_t)dp[0] << 24) | ((uint32_t)dp[1] << 16) | ((uint32_t)dp[2] << 8) | dp[3];
+			if (!(((x & 0x7F7F7F7F) + 0x01010101) & x & 0x80808080)) {	//Нет байтов 0xFF
+				w = w << 32 | x;
+				wbit += 32;
+				dp += 4; dc -= 4;
+				continue;
+			}
+		}
+		if (jd->marker) {
+			d = 0xFF;	/* Input stream has stalled for a marker. Generate stuff bits */
+		} else {
+			if (!dc) {	/* Buffer empty, re-fill input buffer */
+				dc = stream_fill(jd, &dp);			/* Top of input buffer */
+				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
+			}
+			d = *dp++; dc--;
+			if (flg) {		/* In flag sequence? */
+				flg = 0;	/* Exit flag sequence */
+				if (d != 0) jd->marker = d;	/* Not an escape of 0xFF but a marker */
+				d = 0xFF;
+			} else {
+				if (d == 0xFF) {		/* Is start of flag sequence? */
+					flg = 1; continue;	/* Enter flag sequence, get trailing byte */
+				}
+			}
+		}
+		w = w << 8 | d;	/* Shift 8 bits in the working register */
+		wbit += 8;
+	}
+	jd->dctr = dc; jd->dptr = dp;
+	jd->wreg = w; jd->dbit = wbit;
+	return 0;
+}
+#endif
+
+
 /*-----------------------------------------------------------------------*/
 /* Extract a huffman decoded data from input stream                      */
 /*-----------------------------------------------------------------------*/
@@ -395,11 +641,10 @@ static int huffext (	/* >=0: decoded data, <0: error code */
 	unsigned int cls	/* Table class (0:DC, 1:AC) */
 )
 {
+#if JD_FASTDECODE == 0
 	size_t dc = jd->dctr;
 	uint8_t *dp = jd->dptr;
 	unsigned int d, flg = 0;
-
-#if JD_FASTDECODE == 0
 	uint8_t bm, nd, bl;
 	const uint8_t *hb = jd->huffbits[id][cls];	/* Bit distribution table */
 	const uint16_t *hc = jd->huffcode[id][cls];	/* Code word table */
@@ -446,42 +691,27 @@ static int huffext (	/* >=0: decoded data, <0: error code */
 #else
 	const uint8_t *hb, *hd;
 	const uint16_t *hc;
-	unsigned int nc, bl, wbit = jd->dbit % 32;
-	uint32_t w = jd->wreg & ((1UL << wbit) - 1);
-
+	unsigned int d, nc, bl, wbit;
+	uint64_t w;
+	int e;
 
-	while (wbit < 16) {	/* Prepare 16 bits into the working register */
-		if (jd->marker) {
-			d = 0xFF;	/* Input stream has stalled for a marker. Generate stuff bits */
-		} else {
-			if (!dc) {	/* Buffer empty, re-fill input buffer */
-				dp = jd->inbuf;						/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
-				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
-			}
-			d = *dp++; dc--;
-			if (flg) {		/* In flag sequence? */
-				flg = 0;	/* Exit flag sequence */
-				if (d != 0) jd->marker = d;	/* Not an escape of 0xFF but a marker */
-				d = 0xFF;
-			} else {
-				if (d == 0xFF) {		/* Is start of flag sequence? */
-					flg = 1; continue;	/* Enter flag sequence, get trailing byte */
-				}
-			}
-		}
-		w = w << 8 | d;	/* Shift 8 bits in the working register */
-		wbit += 8;
+	if (jd->dbit < 16) {	/* Prepare 16 bits into the working register */
+		e = wreg_fill(jd, 16);
+		if (e) return e;
 	}
-	jd->dctr = dc; jd->dptr = dp;
-	jd->wreg = w;
+	wbit = jd->dbit;
+	w = jd->wreg;	/* Биты выше wbit отбрасываются маской */
 
 #if JD_FASTDECODE == 2
 	/* Table serch for the short codes */
-	d = (unsigned int)(w >> (wbit - HUFF_BIT));	/* Short code as table index */
+	d = (unsigned int)(w >> (wbit - HUFF_BIT)) & HUFF_MASK;	/* Short code as table index */
 	if (cls) {	/* AC element */
 		d = jd->hufflut_ac[id][d];	/* Table decode */
 		if (d != 0xFFFF) {	/* It is done if hit in short code */
+			if (d >> 12) {	//Код вместе со значением коэффициента
+				jd->dbit = wbit - (d >> 12);
+				return (d & 0x0FFF) | HUFF_VAL;
+			}
 			jd->dbit = wbit - (d >> 8);	/* Snip the code length */
 			return d & 0xFF;	/* b7..0: zero run and following data bits */
 		}
@@ -508,7 +738,7 @@ static int huffext (	/* >=0: decoded data, <0: error code */
 	for ( ; bl <= 16; bl++) {	/* Incremental search */
 		nc = *hb++;
 		if (nc) {
-			d = w >> (wbit - bl);
+			d = (unsigned int)(w >> (wbit - bl)) & ((1U << bl) - 1);
 			do {	/* Search the code word in this bit length */
 				if (d == *hc++) {		/* Matched? */
 					jd->dbit = wbit - bl;	/* Snip the huffman code */
@@ -535,11 +765,10 @@ static inline int bitext (	/* >=0: extracted data, <0: error code */
 	unsigned int nbit	/* Number of bits to extract (1 to 16) */
 )
 {
+#if JD_FASTDECODE == 0
 	size_t dc = jd->dctr;
 	uint8_t *dp = jd->dptr;
 	unsigned int d, flg = 0;
-
-#if JD_FASTDECODE == 0
 	uint8_t mbit = jd->dbit;
 
 	d = 0;
@@ -574,37 +803,17 @@ static inline int bitext (	/* >=0: extracted data, <0: error code */
 	return (int)d;
 
 #else
-	unsigned int wbit = jd->dbit % 32;
-	uint32_t w = jd->wreg & ((1UL << wbit) - 1);
-
+	unsigned int wbit;
+	int e;
 
-	while (wbit < nbit) {	/* Prepare nbit bits into the working register */
-		if (jd->marker) {
-			d = 0xFF;	/* Input stream stalled, generate stuff bits */
-		} else {
-			if (!dc) {	/* Buffer empty, re-fill input buffer */
-				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
-				if (!dc) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
-			}
-			d = *dp++; dc--;
-			if (flg) {		/* In flag sequence? */
-				flg = 0;	/* Exit flag sequence */
-				if (d != 0) jd->marker = d;	/* Not an escape of 0xFF but a marker */
-				d = 0xFF;
-			} else {
-				if (d == 0xFF) {		/* Is start of flag sequence? */
-					flg = 1; continue;	/* Enter flag sequence, get trailing byte */
-				}
-			}
-		}
-		w = w << 8 | d;	/* Get 8 bits into the working register */
-		wbit += 8;
+	if (jd->dbit < nbit) {	/* Prepare nbit bits into the working register */
+		e = wreg_fill(jd, nbit);
+		if (e) return e;
 	}
-	jd->wreg = w; jd->dbit = wbit - nbit;
-	jd->dctr = dc; jd->dptr = dp;
+	wbit = jd->dbit - nbit;
+	jd->dbit = wbit;
 
-	return (int)(w >> ((wbit - nbit) % 32));
+	return (int)((jd->wreg >> wbit) & ((1UL << nbit) - 1));
 #endif
 }
 
@@ -657,8 +866,7 @@ static JRESULT restart (
 		marker = 0;
 		for (i = 0; i < 2; i++) {	/* Get a restart marker */
 			if (!dc) {		/* No input data is available, re-fill input buffer */
-				dp = jd->inbuf;
-				dc = jd->infunc(jd, dp, JD_SZBUF);
+				dc = stream_fill(jd, &dp);
 				if (!dc) return JDR_INP;
 			}
 			marker = (marker << 8) | *dp++;	/* Get a byte */
@@ -683,117 +891,383 @@ static JRESULT restart (
 /* Apply Inverse-DCT in Arai Algorithm (see also aa_idct.png)            */
 /*-----------------------------------------------------------------------*/
 
+#define IDCT_M13	((int32_t)(1.41421*4096))
+#define IDCT_M2		((int32_t)(1.08239*4096))
+#define IDCT_M4		((int32_t)(2.61313*4096))
+#define IDCT_M5		((int32_t)(1.84776*4096))
+
+//Первый проход (столбец блока, шаг 8, результат на месте)
+static inline void block_idct_col (int32_t* src)
+{
+	int32_t v0, v1, v2, v3, v4, v5, v6, v7;
+	int32_t t10, t11, t12, t13;
+
+	v0 = src[8 * 0];
+	v1 = src[8 * 2];
+	v2 = src[8 * 4];
+	v3 = src[8 * 6];
+
+	t10 = v0 + v2;
+	t12 = v0 - v2;
+	t11 = (v1 - v3) * IDCT_M13 >> 12;
+	v3 += v1;
+	t11 -= v3;
+	v0 = t10 + v3;
+	v3 = t10 - v3;
+	v1 = t11 + t12;
+	v2 = t12 - t11;
+
+	v4 = src[8 * 7];
+	v5 = src[8 * 1];
+	v6 = src[8 * 5];
+	v7 = src[8 * 3];
+
+	t10 = v5 - v4;
+	t11 = v5 + v4;
+	t12 = v6 - v7;
+	v7 += v6;
+	v5 = (t11 - v7) * IDCT_M13 >> 12;
+	v7 += t11;
+	t13 = (t10 + t12) * IDCT_M5 >> 12;
+	v4 = t13 - (t10 * IDCT_M2 >> 12);
+	v6 = t13 - (t12 * IDCT_M4 >> 12) - v7;
+	v5 -= v6;
+	v4 -= v5;
+
+	src[8 * 0] = v0 + v7;
+	src[8 * 7] = v0 - v7;
+	src[8 * 1] = v1 + v6;
+	src[8 * 6] = v1 - v6;
+	src[8 * 2] = v2 + v5;
+	src[8 * 5] = v2 - v5;
+	src[8 * 3] = v3 + v4;
+	src[8 * 4] = v3 - v4;
+}
+
+//Второй проход (строка блока) с записью пикселей в dst
+static inline void block_idct_row (int32_t* src, jd_yuv_t* dst)
+{
+	int32_t v0, v1, v2, v3, v4, v5, v6, v7;
+	int32_t t10, t11, t12, t13;
+
+	v0 = src[0] + (128L << 8);
+	v1 = src[2];
+	v2 = src[4];
+	v3 = src[6];
+
+	t10 = v0 + v2;
+	t12 = v0 - v2;
+	t11 = (v1 - v3) * IDCT_M13 >> 12;
+	v3 += v1;
+	t11 -= v3;
+	v0 = t10 + v3;
+	v3 = t10 - v3;
+	v1 = t11 + t12;
+	v2 = t12 - t11;
+
+	v4 = src[7];
+	v5 = src[1];
+	v6 = src[5];
+	v7 = src[3];
+
+	t10 = v5 - v4;
+	t11 = v5 + v4;
+	t12 = v6 - v7;
+	v7 += v6;
+	v5 = (t11 - v7) * IDCT_M13 >> 12;
+	v7 += t11;
+	t13 = (t10 + t12) * IDCT_M5 >> 12;
+	v4 = t13 - (t10 * IDCT_M2 >> 12);
+	v6 = t13 - (t12 * IDCT_M4 >> 12) - v7;
+	v5 -= v6;
+	v4 -= v5;
+
+#if JD_FASTDECODE >= 1
+	dst[0] = (int16_t)((v0 + v7) >> 8);
+	dst[7] = (int16_t)((v0 - v7) >> 8);
+	dst[1] = (int16_t)((v1 + v6) >> 8);
+	dst[6] = (int16_t)((v1 - v6) >> 8);
+	dst[2] = (int16_t)((v2 + v5) >> 8);
+	dst[5] = (int16_t)((v2 - v5) >> 8);
+	dst[3] = (int16_t)((v3 + v4) >> 8);
+	dst[4] = (int16_t)((v3 - v4) >> 8);
+#else
+	dst[0] = BYTECLIP((v0 + v7) >> 8);
+	dst[7] = BYTECLIP((v0 - v7) >> 8);
+	dst[1] = BYTECLIP((v1 + v6) >> 8);
+	dst[6] = BYTECLIP((v1 - v6) >> 8);
+	dst[2] = BYTECLIP((v2 + v5) >> 8);
+	dst[5] = BYTECLIP((v2 - v5) >> 8);
+	dst[3] = BYTECLIP((v3 + v4) >> 8);
+	dst[4] = BYTECLIP((v3 - v4) >> 8);
+#endif
+}
+
 //#if (JD_FAST_OPTIMIZE == 0)
 static inline void block_idct (int32_t* src, jd_yuv_t* dst)
 {
-	const int32_t M13 = (int32_t)(1.41421*4096), M2 = (int32_t)(1.08239*4096), M4 = (int32_t)(2.61313*4096), M5 = (int32_t)(1.84776*4096);
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		block_idct_col(src + i);
+	}
+	for (i = 0; i < 8; i++) {
+		block_idct_row(src, dst);
+		dst += 8; src += 8;
+	}
+}
+//#endif
+
+/*
+ * IDCT с учетом расположения ненулевых коэффициентов блока
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * block_idct_col4/block_idct_row4 - варианты проходов для коэффициентов только с индексами 0...3
+ * (входы 4...7 равны нулю и не читаются). Операции те же, что в block_idct_col/block_idct_row,
+ * поэтому результат совпадает до бита.
+ */
+static inline void block_idct_col4 (int32_t* src)
+{
 	int32_t v0, v1, v2, v3, v4, v5, v6, v7;
 	int32_t t10, t11, t12, t13;
+
+	t10 = src[8 * 0];
+	v1 = src[8 * 2];
+
+	t11 = (v1 * IDCT_M13 >> 12) - v1;
+	v0 = t10 + v1;
+	v3 = t10 - v1;
+	v1 = t10 + t11;
+	v2 = t10 - t11;
+
+	v5 = src[8 * 1];
+	v7 = src[8 * 3];
+
+	t12 = -v7;
+	t13 = (v5 + t12) * IDCT_M5 >> 12;
+	v4 = t13 - (v5 * IDCT_M2 >> 12);
+	v7 += v5;
+	v5 = (v5 + t12) * IDCT_M13 >> 12;
+	v6 = t13 - (t12 * IDCT_M4 >> 12) - v7;
+	v5 -= v6;
+	v4 -= v5;
+
+	src[8 * 0] = v0 + v7;
+	src[8 * 7] = v0 - v7;
+	src[8 * 1] = v1 + v6;
+	src[8 * 6] = v1 - v6;
+	src[8 * 2] = v2 + v5;
+	src[8 * 5] = v2 - v5;
+	src[8 * 3] = v3 + v4;
+	src[8 * 4] = v3 - v4;
+}
+
+static inline void block_idct_row4 (int32_t* src, jd_yuv_t* dst)
+{
+	int32_t v0, v1, v2, v3, v4, v5, v6, v7;
+	int32_t t10, t11, t12, t13;
+
+	t10 = src[0] + (128L << 8);
+	v1 = src[2];
+
+	t11 = (v1 * IDCT_M13 >> 12) - v1;
+	v0 = t10 + v1;
+	v3 = t10 - v1;
+	v1 = t10 + t11;
+	v2 = t10 - t11;
+
+	v5 = src[1];
+	v7 = src[3];
+
+	t12 = -v7;
+	t13 = (v5 + t12) * IDCT_M5 >> 12;
+	v4 = t13 - (v5 * IDCT_M2 >> 12);
+	v7 += v5;
+	v5 = (v5 + t12) * IDCT_M13 >> 12;
+	v6 = t13 - (t12 * IDCT_M4 >> 12) - v7;
+	v5 -= v6;
+	v4 -= v5;
+
+#if JD_FASTDECODE >= 1
+	dst[0] = (int16_t)((v0 + v7) >> 8);
+	dst[7] = (int16_t)((v0 - v7) >> 8);
+	dst[1] = (int16_t)((v1 + v6) >> 8);
+	dst[6] = (int16_t)((v1 - v6) >> 8);
+	dst[2] = (int16_t)((v2 + v5) >> 8);
+	dst[5] = (int16_t)((v2 - v5) >> 8);
+	dst[3] = (int16_t)((v3 + v4) >> 8);
+	dst[4] = (int16_t)((v3 - v4) >> 8);
+#else
+	dst[0] = BYTECLIP((v0 + v7) >> 8);
+	dst[7] = BYTECLIP((v0 - v7) >> 8);
+	dst[1] = BYTECLIP((v1 + v6) >> 8);
+	dst[6] = BYTECLIP((v1 - v6) >> 8);
+	dst[2] = BYTECLIP((v2 + v5) >> 8);
+	dst[5] = BYTECLIP((v2 - v5) >> 8);
+	dst[3] = BYTECLIP((v3 + v4) >> 8);
+	dst[4] = BYTECLIP((v3 - v4) >> 8);
+#endif
+}
+
+/*
+ * rows, cols - битовые маски строк и столбцов блока с ненулевыми коэффициентами (mcu_load).
+ * Если коэффициенты только в столбце 0, то все пиксели строки равны, если только в строке 0,
+ * то первый проход не меняет блок и все строки равны. Иначе, если коэффициенты только в строках
+ * (столбцах) 0...3, используются 4-входовые проходы по столбцам (строкам), а пустые столбцы 4...7
+ * пропускаются.
+ */
+static inline void block_idct_sparse (int32_t* src, jd_yuv_t* dst, unsigned int rows, unsigned int cols)
+{
+	jd_yuv_t p;
+	int i, n;
+
+	if (cols == 1) {	//Только столбец 0
+		if (rows < 16) block_idct_col4(src); else block_idct_col(src);
+		for (i = 0; i < 8; i++) {
+#if JD_FASTDECODE >= 1
+			p = (int16_t)((src[8 * i] + (128L << 8)) >> 8);
+#else
+			p = BYTECLIP((src[8 * i] + (128L << 8)) >> 8);
+#endif
+			dst[0] = dst[1] = dst[2] = dst[3] = dst[4] = dst[5] = dst[6] = dst[7] = p;
+			dst += 8;
+		}
+	}
+	else if (rows == 1) {	//Только строка 0
+		if (cols < 16) block_idct_row4(src, dst); else block_idct_row(src, dst);
+		for (i = 1; i < 8; i++) {
+			memcpy(dst + 8 * i, dst, 8 * sizeof (jd_yuv_t));
+		}
+	}
+	else {
+		n = (cols < 16) ? 4 : 8;	//Столбцы 4...7 без коэффициентов остаются нулевыми
+		if (rows < 16) {
+			for (i = 0; i < n; i++) block_idct_col4(src + i);
+		}
+		else {
+			for (i = 0; i < n; i++) block_idct_col(src + i);
+		}
+		if (cols < 16) {
+			for (i = 0; i < 8; i++, src += 8, dst += 8) block_idct_row4(src, dst);
+		}
+		else {
+			for (i = 0; i < 8; i++, src += 8, dst += 8) block_idct_row(src, dst);
+		}
+	}
+}
+
+#if JD_USE_SCALE && (JD_FAST_OPTIMIZE == 1)
+/*
+ * Уменьшенные варианты IDCT для масштабов 1/2 и 1/4
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Вычисляются только отсчеты уменьшенного блока (4x4 или 2x2), равные средним значениям
+ * пикселей полного блока по группам 2x2 или 4x4. Среднее базисной функции частоты 8 - u
+ * по группе из 2 пикселей отличается от среднего для частоты u только знаком, а для u = 4
+ * равно 0, поэтому старшие коэффициенты вычитаются из младших ("сворачиваются"), после чего
+ * выполняется 4-точечное (или 2-точечное) преобразование. Коэффициенты уже умножены на
+ * масштабные множители алгоритма Arai (Ipsf), веса M* разделены на них.
+ * Результат записывается в буфер MCU с шагом строки 4 или 2.
+ */
+static inline void block_idct_4x4 (int32_t* src, jd_yuv_t* dst)
+{
+	const int32_t M1 = (int32_t)(0.92388*4096), M2 = (int32_t)(0.38268*4096), M3 = (int32_t)(0.70711*4096);
+	int32_t v0, v1, v2, v3, e0, e1, o0, o1;
 	int i;
 
-	for (i = 0; i < 8; i++) {
+	for (i = 0; i < 8; i++) {	//Свертка частот по горизонтали
+		src[1] -= src[7];
+		src[2] -= src[6];
+		src[3] -= src[5];
+		src += 8;
+	}
+
+	src -= 8 * 8;
+	for (i = 0; i < 4; i++) {	//Столбцы 0...3 со сверткой частот по вертикали
 		v0 = src[8 * 0];
-		v1 = src[8 * 2];
-		v2 = src[8 * 4];
-		v3 = src[8 * 6];
-
-		t10 = v0 + v2;
-		t12 = v0 - v2;
-		t11 = (v1 - v3) * M13 >> 12;
-		v3 += v1;
-		t11 -= v3;
-		v0 = t10 + v3;
-		v3 = t10 - v3;
-		v1 = t11 + t12;
-		v2 = t12 - t11;
-
-		v4 = src[8 * 7];
-		v5 = src[8 * 1];
-		v6 = src[8 * 5];
-		v7 = src[8 * 3];
-
-		t10 = v5 - v4;
-		t11 = v5 + v4;
-		t12 = v6 - v7;
-		v7 += v6;
-		v5 = (t11 - v7) * M13 >> 12;
-		v7 += t11;
-		t13 = (t10 + t12) * M5 >> 12;
-		v4 = t13 - (t10 * M2 >> 12);
-		v6 = t13 - (t12 * M4 >> 12) - v7;
-		v5 -= v6;
-		v4 -= v5;
-
-		src[8 * 0] = v0 + v7;
-		src[8 * 7] = v0 - v7;
-		src[8 * 1] = v1 + v6;
-		src[8 * 6] = v1 - v6;
-		src[8 * 2] = v2 + v5;
-		src[8 * 5] = v2 - v5;
-		src[8 * 3] = v3 + v4;
-		src[8 * 4] = v3 - v4;
+		v1 = src[8 * 1] - src[8 * 7];
+		v2 = src[8 * 2] - src[8 * 6];
+		v3 = src[8 * 3] - src[8 * 5];
+
+		e1 = v2 * M3 >> 12;
+		e0 = v0 + e1;
+		e1 = v0 - e1;
+		o0 = (v1 * M1 + v3 * M2) >> 12;
+		o1 = (v1 * M2 - v3 * M1) >> 12;
+
+		src[8 * 0] = e0 + o0;
+		src[8 * 3] = e0 - o0;
+		src[8 * 1] = e1 + o1;
+		src[8 * 2] = e1 - o1;
 
 		src++;
 	}
 
-	src -= 8;
-	for (i = 0; i < 8; i++) {
+	src -= 4;
+	for (i = 0; i < 4; i++) {	//Строки 0...3
 		v0 = src[0] + (128L << 8);
-		v1 = src[2];
-		v2 = src[4];
-		v3 = src[6];
-
-		t10 = v0 + v2;
-		t12 = v0 - v2;
-		t11 = (v1 - v3) * M13 >> 12;
-		v3 += v1;
-		t11 -= v3;
-		v0 = t10 + v3;
-		v3 = t10 - v3;
-		v1 = t11 + t12;
-		v2 = t12 - t11;
-
-		v4 = src[7];
-		v5 = src[1];
-		v6 = src[5];
-		v7 = src[3];
-
-		t10 = v5 - v4;
-		t11 = v5 + v4;
-		t12 = v6 - v7;
-		v7 += v6;
-		v5 = (t11 - v7) * M13 >> 12;
-		v7 += t11;
-		t13 = (t10 + t12) * M5 >> 12;
-		v4 = t13 - (t10 * M2 >> 12);
-		v6 = t13 - (t12 * M4 >> 12) - v7;
-		v5 -= v6;
-		v4 -= v5;
+		v1 = src[1];
+		v2 = src[2];
+		v3 = src[3];
+
+		e1 = v2 * M3 >> 12;
+		e0 = v0 + e1;
+		e1 = v0 - e1;
+		o0 = (v1 * M1 + v3 * M2) >> 12;
+		o1 = (v1 * M2 - v3 * M1) >> 12;
 
 #if JD_FASTDECODE >= 1
-		dst[0] = (int16_t)((v0 + v7) >> 8);
-		dst[7] = (int16_t)((v0 - v7) >> 8);
-		dst[1] = (int16_t)((v1 + v6) >> 8);
-		dst[6] = (int16_t)((v1 - v6) >> 8);
-		dst[2] = (int16_t)((v2 + v5) >> 8);
-		dst[5] = (int16_t)((v2 - v5) >> 8);
-		dst[3] = (int16_t)((v3 + v4) >> 8);
-		dst[4] = (int16_t)((v3 - v4) >> 8);
+		dst[0] = (int16_t)((e0 + o0) >> 8);
+		dst[3] = (int16_t)((e0 - o0) >> 8);
+		dst[1] = (int16_t)((e1 + o1) >> 8);
+		dst[2] = (int16_t)((e1 - o1) >> 8);
 #else
-		dst[0] = BYTECLIP((v0 + v7) >> 8);
-		dst[7] = BYTECLIP((v0 - v7) >> 8);
-		dst[1] = BYTECLIP((v1 + v6) >> 8);
-		dst[6] = BYTECLIP((v1 - v6) >> 8);
-		dst[2] = BYTECLIP((v2 + v5) >> 8);
-		dst[5] = BYTECLIP((v2 - v5) >> 8);
-		dst[3] = BYTECLIP((v3 + v4) >> 8);
-		dst[4] = BYTECLIP((v3 - v4) >> 8);
+		dst[0] = BYTECLIP((e0 + o0) >> 8);
+		dst[3] = BYTECLIP((e0 - o0) >> 8);
+		dst[1] = BYTECLIP((e1 + o1) >> 8);
+		dst[2] = BYTECLIP((e1 - o1) >> 8);
 #endif
 
-		dst += 8; src += 8;
+		dst += 4; src += 8;
 	}
 }
-//#endif
+
+static inline void block_idct_2x2 (int32_t* src, jd_yuv_t* dst)
+{
+	//Среднее базисной функции частоты 2 (и 6) по половине блока равно 0
+	const int32_t M1 = (int32_t)(0.65328*4096), M2 = (int32_t)(0.27060*4096);
+	int32_t v0, o;
+	int i;
+
+	for (i = 0; i < 8; i++) {	//Свертка частот по горизонтали
+		src[1] -= src[7];
+		src[3] -= src[5];
+		src += 8;
+	}
+
+	src -= 8 * 8;
+	for (i = 0; i < 4; i++) {	//Столбцы 0, 1, 3 со сверткой частот по вертикали
+		if (i == 2) continue;
+		v0 = src[8 * 0 + i];
+		o = ((src[8 * 1 + i] - src[8 * 7 + i]) * M1 - (src[8 * 3 + i] - src[8 * 5 + i]) * M2) >> 12;
+		src[8 * 0 + i] = v0 + o;
+		src[8 * 1 + i] = v0 - o;
+	}
+
+	for (i = 0; i < 2; i++) {	//Строки 0, 1
+		v0 = src[0] + (128L << 8);
+		o = (src[1] * M1 - src[3] * M2) >> 12;
+#if JD_FASTDECODE >= 1
+		dst[0] = (int16_t)((v0 + o) >> 8);
+		dst[1] = (int16_t)((v0 - o) >> 8);
+#else
+		dst[0] = BYTECLIP((v0 + o) >> 8);
+		dst[1] = BYTECLIP((v0 - o) >> 8);
+#endif
+		dst += 2; src += 8;
+	}
+}
+#endif
 
 /*-----------------------------------------------------------------------*/
 /* Load all blocks in an MCU into working buffer                         */
@@ -808,7 +1282,7 @@ static inline JRESULT mcu_load (
 	int32_t *tmp = (int32_t*)(jd->workbuf + jd->offset);
 	//+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 	int d, e;
-	unsigned int blk, nby, i, bc, z, id, cmp;
+	unsigned int blk, nby, i, bc, z, id, cmp, rows, cols;
 	jd_yuv_t *bp;
 	const int32_t *dqf;
 
@@ -850,11 +1324,23 @@ static inline JRESULT mcu_load (
 			memset_32(&tmp[1], 0, 63); //вариант оптимизации
 #endif
 			z = 1;		/* Top of the AC elements (in zigzag-order) */
+			rows = cols = 1;	//Маски строк и столбцов с ненулевыми коэффициентами (для block_idct_sparse)
 			do {
 				d = huffext(jd, id, 1);				/* Extract a huffman coded value (zero runs and bit length) */
 				if (d == 0) break;					/* EOB? */
 				if (d < 0) return (JRESULT)(0 - d);	/* Err: invalid code or input error */
 				bc = (unsigned int)d;
+#if JD_FASTDECODE == 2
+				if (bc & HUFF_VAL) {				//Значение коэффициента получено вместе с кодом
+					z += (bc >> 8) & 0x0F;
+					if (z >= 64) return JDR_FMT1;
+					i = Zig[z];
+					tmp[i] = (int8_t)bc * dqf[i] >> 8;
+					rows |= 1 << (i >> 3);
+					cols |= 1 << (i & 7);
+					continue;
+				}
+#endif
 				z += bc >> 4;						/* Skip leading zero run */
 				if (z >= 64) return JDR_FMT1;		/* Too long zero run */
 				if (bc &= 0x0F) {					/* Bit length? */
@@ -864,6 +1350,8 @@ static inline JRESULT mcu_load (
 					if (!(d & bc)) d -= (bc << 1) - 1;	/* Restore negative value if needed */
 					i = Zig[z];						/* Get raster-order index */
 					tmp[i] = d * dqf[i] >> 8;		/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+					rows |= 1 << (i >> 3);
+					cols |= 1 << (i & 7);
 				}
 			} while (++z < 64);		/* Next AC element */
 
@@ -885,8 +1373,17 @@ static inline JRESULT mcu_load (
 						memset_32(bp, (d << 24 ) | (d << 16) | (d << 8) | d, 64/4);
 #endif
 					}
-				} else {
-					block_idct(tmp, bp);	/* Apply IDCT and store the block to the MCU buffer */
+				}
+#if JD_USE_SCALE && (JD_FAST_OPTIMIZE == 1)
+				else if (jd->scale == 1) {
+					block_idct_4x4(tmp, bp);	//Масштаб 1/2: только отсчеты блока 4x4
+				}
+				else if (jd->scale == 2) {
+					block_idct_2x2(tmp, bp);	//Масштаб 1/4: только отсчеты блока 2x2
+				}
+#endif
+				else {
+					block_idct_sparse(tmp, bp, rows, cols);	/* Apply IDCT and store the block to the MCU buffer */
 				}
 			}
 		}
@@ -928,7 +1425,7 @@ static inline JRESULT mcu_output (
 	rect.left = x; rect.right = x + rx - 1;				//Формируем параметры (координаты левого верхнего и правого нижнего углов)
 	rect.top = y; rect.bottom = y + ry - 1;				//прямоугольной области с изображением в буфере кадра (на дисплее)
 
-	if (!JD_USE_SCALE || jd->scale != 3) {	//Не для масштабирования 1/8
+	if (!JD_USE_SCALE || !jd->scale) {	//Без масштабирования
 		if (jd->color_format == 0 || jd->color_format == 1) {
 			for (iy = 0; iy < my; iy++) {
 				pc = py = jd->mcubuf;
@@ -952,9 +1449,9 @@ static inline JRESULT mcu_output (
 					}
 					yy = *py++;			//Получаем компоненту интенсивности Y
 					if (jd->color_format == 0) {
-						*pix++ = usat(yy + ((45 * cr) >> 5), 5, 3);
-						*pix++ = usat(yy - ((23 * cr + 11 * cb) >> 5), 5, 3);
-						*pix++ = usat(yy + ((113 * cb) >> 6), 5, 3);
+						*pix++ = usat(yy + ((45 * cr) >> 5), 8, 0);
+						*pix++ = usat(yy - ((23 * cr + 11 * cb) >> 5), 8, 0);
+						*pix++ = usat(yy + ((113 * cb) >> 6), 8, 0);
 					}
 					else {
 #if (JD_BYTES_SWAP == 0)
@@ -1052,89 +1549,52 @@ static inline JRESULT mcu_output (
 			}
 #endif
 		}
-		//Масштабирование, если это необходимо
-		if (JD_USE_SCALE && jd->scale) {
-			unsigned int x, y, r, g, b, s, w, a;
-			uint8_t *op = (uint8_t*)workbuf;
-			//Расчет средних значений составляющих цвета для каждого квадрата, соответствующего пикселю
-			s = jd->scale * 2;	//Число значений для расчета среднего
-			w = 1 << jd->scale;	//Размерность квадрата
-			a = mx - w; //Количество байт, которое необходимо пропустить для перехода на следующую строку
-			int k_byte = 1;
-			if (jd->color_format == 0) { //RGB888 (24-bit/pix)
-				k_byte = 3;
-			}
-			else if (jd->color_format == 1 || jd->color_format == 3) {
-				k_byte = 2;
-			}
-			a *= k_byte;
-			for (iy = 0; iy < my; iy += w) {
-				for (ix = 0; ix < mx; ix += w) {
-					pix = (uint8_t*)workbuf + (iy * mx + ix) * k_byte;
-					r = g = b = 0;
-					for (y = 0; y < w; y++) {	//Накопление значений цветовых составляющих в квадрате
-						for (x = 0; x < w; x++) {
-							if (jd->color_format == 0) { //RGB888 (24-bit/pix)
-								r += *pix++;	//Накопление R
-								g += *pix++;	//Накопление G
-								b += *pix++;	//Накопление B
-							}
-							else if (jd->color_format == 1) { //RGB565 (16-bit/pix)
-								uint16_t pix16 = *((uint16_t*)pix);
-#if (JD_BYTES_SWAP == 1)
-								pix16 = (pix16 >> 8) | (pix16 << 8);
-#endif
-								r += (pix16 >> 11) & 0x1f;		//Накопление R
-								g += (pix16 >> 6) & 0x1f;		//Накопление G
-								b += pix16 & 0x1f;//Накопление B
-								pix += 2;
-							}
-							else if (jd->color_format == 2) { //Grayscale (8-bit/pix)
-								r += *pix++;			//Накопление Y (Grayscale 8-bit) */
-							}
-							else { //Grayscale_16 (16-bit/pix)
-								uint16_t pix16 = (*((uint16_t*)pix)) & 0x1f;
-#if (JD_BYTES_SWAP == 1)
-								pix16 = (pix16 >> 8) | (pix16 << 8);
-#endif
-								r += pix16;	//Накопление Y (Grayscale 16-bit) */
-								pix += 2;
-							}
-						}
-						pix += a; //Переход на следующую строку
-					}
-					//Запись в массив усредненных значений цветовых составляющих
-					if (jd->color_format == 0) { //RGB888 (24-bit/pix)
-						*op++ = (uint8_t)(r >> s);	//компонента R
-						*op++ = (uint8_t)(g >> s);	//компонента G
-						*op++ = (uint8_t)(b >> s);	//компонента B
-					}
-					else if (jd->color_format == 1) { //RGB565 (16-bit/pix)
+	}
+	else if (jd->scale != 3) {	//Масштабы 1/2 и 1/4: блоки в буфере MCU уже уменьшены (см. mcu_load)
+		unsigned int b = 8 >> jd->scale;	//Размер уменьшенного блока
+		unsigned int w = mx >> jd->scale, h = my >> jd->scale;
+		for (iy = 0; iy < h; iy++) {
+			py = jd->mcubuf + (iy & (b - 1)) * b;
+			if (iy >= b) py += 64 * 2;	//Нижние блоки Y (только при удвоенной высоте и ширине)
+			pc = jd->mcubuf + 64 * jd->msx * jd->msy + (iy >> (jd->msy - 1)) * b;
+			for (ix = 0; ix < w; ix++) {
+				if (ix == b) py += 64 - b;	//Правый блок Y
+				yy = *py++;	//Получение значения компоненты Y (интенсивность)
+				if (jd->color_format == 0 || jd->color_format == 1) {
+					cb = pc[ix >> (jd->msx - 1)] - 128;	//Получение значений компонент Cb/Cr
+					cr = pc[64 + (ix >> (jd->msx - 1))] - 128;
+				}
+				if (jd->color_format == 0) { //RGB888 (24-bit/pix)
+					//Преобразование YCbCr в R8G8B8
+					*pix++ = usat(yy + ((45 * cr) >> 5), 8, 0);
+					*pix++ = usat(yy - ((23 * cr + 11 * cb) >> 5), 8, 0);
+					*pix++ = usat(yy + ((113 * cb) >> 6), 8, 0);
+				}
+				else if (jd->color_format == 1) { //R5G6B5 (16-bit/pix)
 #if (JD_BYTES_SWAP == 0)
-						*((uint16_t*)op) = ((r >> s) << 11) |	//компонента R
-										   ((g >> s) << 6)  |	//компонента G
-										   (b >> s);		  	//компонента B
+					*((uint16_t*)pix) = ((usat(yy + ((45 * cr) >> 5), 5, 3)) << 11) | //Преобразование YCbCr в R5G6B5
+										((usat(yy - ((23 * cr + 11 * cb) >> 5), 5, 3)) << 6) |
+										usat(yy + ((113 * cb) >> 6), 5, 3);
 #else
-						uint16_t pix16 = ((r >> s) << 11) |	//компонента R
-								   	   	 ((g >> s) << 6)  |	//компонента G
-										 (b >> s);		  	//компонента B
-						*((uint16_t*)op) = (pix16 >> 8) | (pix16 << 8);
+					uint16_t pix16 = ((usat(yy + ((45 * cr) >> 5), 5, 3)) << 11) |
+									 ((usat(yy - ((23 * cr + 11 * cb) >> 5), 5, 3)) << 6) |
+									 usat(yy + ((113 * cb) >> 6), 5, 3);
+					*((uint16_t*)pix) = (pix16 >> 8) | (pix16 << 8);
 #endif
-						op += 2;
-					}
-					else if (jd->color_format == 2) { //Grayscale (8-bit/pix)
-						*op++ = (uint8_t)(r >> s);	/* средняя интенсивность Y (оттенки серого) */
-					}
-					else { //Grayscale_16 (16-bit/pix)
-						r >>= s; //средняя интенсивность Y (оттенки серого)
+					pix += 2;
+				}
+				else if (jd->color_format == 2) { //Grayscale (8-bit/pix)
+					*pix++ = usat(yy, 8, 0);
+				}
+				else { //Grayscale_16 (16-bit/pix)
+					uint8_t c = usat(yy, 5, 3);
 #if (JD_BYTES_SWAP == 0)
-						*((uint16_t*)op) = (r << 11) | (r << 6) | r; //значение компонент R, G, B одинаково
+					*((uint16_t*)pix) = (c << 11) | (c << 6) | c; //Преобразование Y в R5G6B5 (32 оттенка серого)
 #else
-						uint16_t pix16 = (r << 11) | (r << 6) | r;
-						*((uint16_t*)op) = (pix16 >> 8) | (pix16 << 8);
+					uint16_t pix16 =  (c << 11) | (c << 6) | c;
+					*((uint16_t*)pix) = (pix16 >> 8) | (pix16 << 8);
 #endif
-						op += 2;
-					}
+					pix += 2;
 				}
 			}
 		}
@@ -1151,9 +1611,9 @@ static inline JRESULT mcu_output (
 				py += 64;
 				if (jd->color_format == 0) { //RGB888 (24-bit/pix)
 					//Преобразование YCbCr в R8G8B8
-					*pix++ = usat(yy + ((45 * cr) >> 5), 5, 3);
-					*pix++ = usat(yy - ((23 * cr + 11 * cb) >> 5), 5, 3);
-					*pix++ = usat(yy + ((113 * cb) >> 6), 5, 3);
+					*pix++ = usat(yy + ((45 * cr) >> 5), 8, 0);
+					*pix++ = usat(yy - ((23 * cr + 11 * cb) >> 5), 8, 0);
+					*pix++ = usat(yy + ((113 * cb) >> 6), 8, 0);
 				}
 				else if (jd->color_format == 1) { //R5G6B5 (16-bit/pix)
 #if (JD_BYTES_SWAP == 0)
@@ -1396,46 +1856,36 @@ static JRESULT mcu_output (
 #define	LDB_WORD(ptr)		(uint16_t)(((uint16_t)*((uint8_t*)(ptr))<<8)|(uint16_t)*(uint8_t*)((ptr)+1))
 
 
-JRESULT jd_prepare (
-	JDEC* jd,				/* Blank decompressor object */
-	size_t (*infunc)(JDEC*, uint8_t*, size_t),	/* JPEG strem input function */
-	void* pool,				/* Working buffer for the decompression session */
-	size_t sz_pool,			/* Size of working buffer */
-	void* dev				/* I/O device identifier for the session */
+//Разбор заголовка изображения. Поля источника данных объекта декодера уже заполнены.
+static JRESULT parse_header (
+	JDEC* jd				/* Decompressor object with the stream source */
 )
 {
-	uint8_t *seg, b;
+	const uint8_t *seg;
+	uint8_t b;
 	uint16_t marker;
 	unsigned int n, i, ofs;
 	size_t len;
 	JRESULT rc;
 
-#if (JD_FAST_OPTIMIZE == 0)
-	memset(jd, 0, sizeof (JDEC));	/* Clear decompression object (this might be a problem if machine's null pointer is not all bits zero) */
-#else
-	memset_8(jd, 0, sizeof (JDEC));
+#if JD_FASTDECODE >= 1
+	if (!jd->mem)	/* Источник в памяти читается на месте, входной буфер не нужен */
 #endif
-	/****************************** +++++++++++++++++++++++++++ ****************************/
-	jd->color_format = AVI_color_mode; //записываем в переменную значение формата цвета
-	/***************************************************************************************/
-	jd->pool = pool;		/* Work memroy */
-	jd->sz_pool = sz_pool;	/* Size of given work memory */
-	jd->infunc = infunc;	/* Stream input function */
-	jd->device = dev;		/* I/O device identifier */
-
-	jd->inbuf = seg = alloc_pool(jd, JD_SZBUF);		/* Allocate stream input buffer */
-	if (!seg) return JDR_MEM1;
+	{
+		jd->inbuf = alloc_pool(jd, JD_SZBUF);		/* Allocate stream input buffer */
+		if (!jd->inbuf) return JDR_MEM1;
+	}
 
 	ofs = marker = 0;		/* Find SOI marker */
 	do {
-		if (jd->infunc(jd, seg, 1) != 1) return JDR_INP;	/* Err: SOI was not detected */
+		if (!(seg = stream_read(jd, 1))) return JDR_INP;	/* Err: SOI was not detected */
 		ofs++;
 		marker = marker << 8 | seg[0];
 	} while (marker != 0xFFD8);
 
 	for (;;) {				/* Parse JPEG segments */
 		/* Get a JPEG marker */
-		if (jd->infunc(jd, seg, 4) != 4) return JDR_INP;
+		if (!(seg = stream_read(jd, 4))) return JDR_INP;
 		marker = LDB_WORD(seg);		/* Marker */
 		len = LDB_WORD(seg + 2);	/* Length field */
 		if (len <= 2 || (marker >> 8) != 0xFF) return JDR_FMT1;
@@ -1445,7 +1895,7 @@ JRESULT jd_prepare (
 		switch (marker & 0xFF) {
 		case 0xC0:	/* SOF0 (baseline JPEG) */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
+			if (!(seg = stream_read(jd, len))) return JDR_INP;	/* Load segment data */
 
 			jd->width = LDB_WORD(&seg[3]);		/* Image width in unit of pixel */
 			jd->height = LDB_WORD(&seg[1]);		/* Image height in unit of pixel */
@@ -1470,14 +1920,14 @@ JRESULT jd_prepare (
 
 		case 0xDD:	/* DRI - Define Restart Interval */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
+			if (!(seg = stream_read(jd, len))) return JDR_INP;	/* Load segment data */
 
 			jd->nrst = LDB_WORD(seg);	/* Get restart interval (MCUs) */
 			break;
 
 		case 0xC4:	/* DHT - Define Huffman Tables */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
+			if (!(seg = stream_read(jd, len))) return JDR_INP;	/* Load segment data */
 
 			rc = create_huffman_tbl(jd, seg, len);	/* Create huffman tables */
 			if (rc) return rc;
@@ -1485,7 +1935,7 @@ JRESULT jd_prepare (
 
 		case 0xDB:	/* DQT - Define Quaitizer Tables */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
+			if (!(seg = stream_read(jd, len))) return JDR_INP;	/* Load segment data */
 
 			rc = create_qt_tbl(jd, seg, len);	/* Create de-quantizer tables */
 			if (rc) return rc;
@@ -1493,7 +1943,7 @@ JRESULT jd_prepare (
 
 		case 0xDA:	/* SOS - Start of Scan */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;	/* Load segment data */
+			if (!(seg = stream_read(jd, len))) return JDR_INP;	/* Load segment data */
 
 			if (!jd->width || !jd->height) return JDR_FMT1;	/* Err: Invalid image size */
 			if (seg[0] != jd->ncomp) return JDR_FMT3;		/* Err: Wrong color components */
@@ -1528,11 +1978,18 @@ JRESULT jd_prepare (
 			jd->mcubuf = alloc_pool(jd, (n + 2) * 64 * sizeof (jd_yuv_t));	/* Allocate MCU working buffer */
 			if (!jd->mcubuf) return JDR_MEM1;			/* Err: not enough memory */
 
+#if JD_FASTDECODE >= 1
+			if (jd->mem) {	/* Поток источника в памяти доступен сразу весь */
+				jd->mem_scan = jd->mem;
+				jd->dctr = stream_fill(jd, &jd->dptr);
+				return JDR_OK;
+			}
+#endif
 			/* Align stream read offset to JD_SZBUF */
 			if (ofs %= JD_SZBUF) {
-				jd->dctr = jd->infunc(jd, seg + ofs, (size_t)(JD_SZBUF - ofs));
+				jd->dctr = jd->infunc(jd, jd->inbuf + ofs, (size_t)(JD_SZBUF - ofs));
 			}
-			jd->dptr = seg + ofs - (JD_FASTDECODE ? 0 : 1);
+			jd->dptr = jd->inbuf + ofs - (JD_FASTDECODE ? 0 : 1);
 
 			return JDR_OK;		/* Initialization succeeded. Ready to decompress the JPEG image. */
 
@@ -1560,6 +2017,269 @@ JRESULT jd_prepare (
 }
 
 
+//Начальная инициализация объекта декодера
+static void init_object (
+	JDEC* jd,				/* Blank decompressor object */
+	void* pool,				/* Working buffer for the decompression session */
+	size_t sz_pool,			/* Size of working buffer */
+	void* dev,				/* I/O device identifier for the session */
+	JD_TBLCACHE* tc			//кэш таблиц (0 - не используется)
+)
+{
+#if (JD_FAST_OPTIMIZE == 0)
+	memset(jd, 0, sizeof (JDEC));	/* Clear decompression object (this might be a problem if machine's null pointer is not all bits zero) */
+#else
+	memset_8(jd, 0, sizeof (JDEC));
+#endif
+	jd->color_format = JD_FORMAT;	//формат цвета по умолчанию, после jd_prepare может быть изменен вызывающим
+	jd->pool = pool;		/* Work memroy */
+	jd->sz_pool = sz_pool;	/* Size of given work memory */
+	jd->device = dev;		/* I/O device identifier */
+	jd->tblcache = tc;
+	if (tc) tc->stamp++;	//новый разбор заголовка: его таблицы не вытесняются
+}
+
+
+JRESULT jd_prepare (
+	JDEC* jd,				/* Blank decompressor object */
+	size_t (*infunc)(JDEC*, uint8_t*, size_t),	/* JPEG strem input function */
+	void* pool,				/* Working buffer for the decompression session */
+	size_t sz_pool,			/* Size of working buffer */
+	void* dev				/* I/O device identifier for the session */
+)
+{
+	return jd_prepare_tc(jd, infunc, pool, sz_pool, dev, 0);
+}
+
+
+//Инициализация декодера с кэшем таблиц. Таблицы, найденные в кэше, не занимают рабочую память.
+JRESULT jd_prepare_tc (
+	JDEC* jd,				/* Blank decompressor object */
+	size_t (*infunc)(JDEC*, uint8_t*, size_t),	/* JPEG strem input function */
+	void* pool,				/* Working buffer for the decompression session */
+	size_t sz_pool,			/* Size of working buffer */
+	void* dev,				/* I/O device identifier for the session */
+	JD_TBLCACHE* tc			//кэш таблиц (0 - не используется)
+)
+{
+	init_object(jd, pool, sz_pool, dev, tc);
+	jd->infunc = infunc;	/* Stream input function */
+	return parse_header(jd);
+}
+
+
+//Инициализация декодера для изображения в памяти (Flash или RAM). Данные изображения
+//читаются декодером на месте, без копирования во входной буфер, и должны оставаться
+//доступными до окончания распаковки.
+JRESULT jd_prepare_mem (
+	JDEC* jd,				/* Blank decompressor object */
+	const uint8_t* data,	/* Данные изображения */
+	size_t size,			/* Размер данных */
+	void* pool,				/* Working buffer for the decompression session */
+	size_t sz_pool,			/* Size of working buffer */
+	void* dev				/* I/O device identifier for the session */
+)
+{
+	return jd_prepare_mem_tc(jd, data, size, pool, sz_pool, dev, 0);
+}
+
+
+//Инициализация декодера для изображения в памяти с кэшем таблиц
+JRESULT jd_prepare_mem_tc (
+	JDEC* jd,				/* Blank decompressor object */
+	const uint8_t* data,	/* Данные изображения */
+	size_t size,			/* Размер данных */
+	void* pool,				/* Working buffer for the decompression session */
+	size_t sz_pool,			/* Size of working buffer */
+	void* dev,				/* I/O device identifier for the session */
+	JD_TBLCACHE* tc			//кэш таблиц (0 - не используется)
+)
+{
+	init_object(jd, pool, sz_pool, dev, tc);
+	jd->infunc = mem_input;	/* Пропуск сегментов (и чтение при JD_FASTDECODE == 0) */
+	jd->mem = data;
+	jd->mem_left = size;
+	return parse_header(jd);
+}
+
+
+
+/*
+ * Оценка рабочей памяти по заголовку
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Заголовок разбирается без построения таблиц и без рабочей памяти: сегменты читаются
+ * короткими частями через небольшой буфер, данные таблиц пропускаются. Размер рабочей памяти
+ * складывается из тех же выделений, что делает parse_header, с тем же выравниванием.
+ * Формат цвета и масштаб вывода на размер не влияют: буфер workbuf рассчитан на RGB888.
+ */
+#define POOL_ALIGN(n)	(((n) + 3) & ~(size_t)3)	//выравнивание блока как в alloc_pool
+
+static JRESULT probe_segments (
+	JDEC* jd,				/* Decompressor object with the stream source */
+	JD_PROBE* info			//параметры изображения
+)
+{
+	const uint8_t *seg;
+	uint16_t marker;
+	unsigned int i, n, np, huff = 0, qt = 0;
+	size_t len, pool = 0;
+
+	memset(info, 0, sizeof (JD_PROBE));
+#if JD_FASTDECODE >= 1
+	if (!jd->mem)
+#endif
+	{
+		pool += POOL_ALIGN(JD_SZBUF);
+	}
+
+	marker = 0;				/* Find SOI marker */
+	do {
+		if (!(seg = stream_read(jd, 1))) return JDR_INP;
+		marker = marker << 8 | seg[0];
+	} while (marker != 0xFFD8);
+
+	for (;;) {
+		if (!(seg = stream_read(jd, 4))) return JDR_INP;
+		marker = LDB_WORD(seg);
+		len = LDB_WORD(seg + 2);
+		if (len <= 2 || (marker >> 8) != 0xFF) return JDR_FMT1;
+		len -= 2;
+		n = marker & 0xFF;
+		if ((n == 0xC0 || n == 0xDD || n == 0xC4 || n == 0xDB || n == 0xDA) && len > JD_SZBUF) return JDR_MEM2;
+
+		switch (n) {
+		case 0xC0:	/* SOF0 */
+			if (len < 6 || !(seg = stream_read(jd, 6))) return JDR_FMT1;
+			len -= 6;
+			info->height = LDB_WORD(&seg[1]);
+			info->width = LDB_WORD(&seg[3]);
+			info->ncomp = seg[5];
+			if (info->ncomp != 3 && info->ncomp != 1) return JDR_FMT3;
+			for (i = 0; i < info->ncomp; i++) {
+				if (len < 3 || !(seg = stream_read(jd, 3))) return JDR_FMT1;
+				len -= 3;
+				if (i == 0) {
+					if (seg[1] != 0x11 && seg[1] != 0x22 && seg[1] != 0x21) return JDR_FMT3;
+					info->msx = seg[1] >> 4; info->msy = seg[1] & 15;
+				} else if (seg[1] != 0x11) {
+					return JDR_FMT3;
+				}
+				if (seg[2] > 3) return JDR_FMT3;
+				jd->qtid[i] = seg[2];
+			}
+			break;
+
+		case 0xDD:	/* DRI */
+			if (len < 2 || !(seg = stream_read(jd, 2))) return JDR_FMT1;
+			len -= 2;
+			info->nrst = LDB_WORD(seg);
+			break;
+
+		case 0xC4:	/* DHT: таблица - 16 байт длин кодов, коды, значения (и LUT) */
+			while (len) {
+				if (len < 17 || !(seg = stream_read(jd, 17))) return JDR_FMT1;
+				len -= 17;
+				if (seg[0] & 0xEE) return JDR_FMT1;
+				for (np = 0, i = 1; i <= 16; i++) np += seg[i];
+				if (len < np || jd->infunc(jd, 0, np) != np) return JDR_FMT1;
+				len -= np;
+				huff |= 1U << ((seg[0] & 1) * 2 + (seg[0] >> 4));
+				pool += 16 + POOL_ALIGN(np * sizeof (uint16_t)) + POOL_ALIGN(np);
+#if JD_FASTDECODE == 2
+				pool += (seg[0] >> 4) ? HUFF_LEN * sizeof (uint16_t) : HUFF_LEN * sizeof (uint8_t);
+#endif
+			}
+			break;
+
+		case 0xDB:	/* DQT: таблица - 64 коэффициента int32_t */
+			while (len) {
+				if (len < 65 || !(seg = stream_read(jd, 1))) return JDR_FMT1;
+				if (seg[0] & 0xF0) return JDR_FMT1;
+				qt |= 1U << (seg[0] & 3);
+				if (jd->infunc(jd, 0, 64) != 64) return JDR_INP;
+				len -= 65;
+				pool += 64 * sizeof (int32_t);
+			}
+			break;
+
+		case 0xDA:	/* SOS */
+			if (!info->width || !info->height) return JDR_FMT1;
+			if (!(seg = stream_read(jd, 1))) return JDR_INP;
+			if (seg[0] != info->ncomp) return JDR_FMT3;
+			if (len < 1 + 2 * (size_t)info->ncomp) return JDR_FMT1;
+			for (i = 0; i < info->ncomp; i++) {
+				if (!(seg = stream_read(jd, 2))) return JDR_INP;
+				if (seg[1] != 0x00 && seg[1] != 0x11) return JDR_FMT3;
+				n = i ? 2 : 0;
+				if ((huff & (3U << n)) != (3U << n) || !(qt & (1U << jd->qtid[i]))) return JDR_FMT1;
+			}
+			n = info->msx * info->msy;
+			if (!n) return JDR_FMT1;
+			len = n * 64 * 2 + 64;
+			if (len < 256) len = 256;
+			pool += POOL_ALIGN(2 * len) + POOL_ALIGN((n + 2) * 64 * sizeof (jd_yuv_t));
+			info->sz_pool = pool;
+			return JDR_OK;
+
+		case 0xC1: case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+		case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+		case 0xD9:
+			return JDR_FMT3;	/* Unsuppoted JPEG standard (may be progressive JPEG) */
+		}
+		if (len && jd->infunc(jd, 0, len) != len) return JDR_INP;	/* Остаток сегмента */
+	}
+}
+
+//Разбор заголовка с входным буфером на стеке: по выходу jd->inbuf сбрасывается,
+//чтобы в объекте декодера не оставался указатель на освобожденный стек
+static JRESULT probe_header (
+	JDEC* jd,				/* Decompressor object with the stream source */
+	JD_PROBE* info			//параметры изображения
+)
+{
+	uint8_t buf[20];		//входной буфер коротких частей сегментов
+	JRESULT rc;
+
+	jd->inbuf = buf;
+	rc = probe_segments(jd, info);
+	jd->inbuf = 0;
+	return rc;
+}
+
+
+//Разбор заголовка потока infunc без распаковки. jd - объект декодера, используемый только
+//для чтения потока (после jd_probe поток прочитан до данных сканирования, для распаковки
+//его нужно открыть заново и вызвать jd_prepare с рабочей памятью не меньше info->sz_pool).
+JRESULT jd_probe (
+	JDEC* jd,				/* Blank decompressor object */
+	size_t (*infunc)(JDEC*, uint8_t*, size_t),	/* JPEG strem input function */
+	void* dev,				/* I/O device identifier for the session */
+	JD_PROBE* info			//параметры изображения
+)
+{
+	init_object(jd, 0, 0, dev, 0);
+	jd->infunc = infunc;
+	return probe_header(jd, info);
+}
+
+
+//Разбор заголовка изображения в памяти без распаковки
+JRESULT jd_probe_mem (
+	JDEC* jd,				/* Blank decompressor object */
+	const uint8_t* data,	/* Данные изображения */
+	size_t size,			/* Размер данных */
+	JD_PROBE* info			//параметры изображения
+)
+{
+	init_object(jd, 0, 0, 0, 0);
+	jd->infunc = mem_input;
+	jd->mem = data;
+	jd->mem_left = size;
+	return probe_header(jd, info);
+}
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -1601,3 +2321,399 @@ JRESULT jd_decomp (
 	}
 	return rc;
 }
+
+
+
+/*
+ * Конвейерная распаковка на двух задачах (ядрах)
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Этап загрузки (jd_decomp_load) декодирует поток Хаффмана, выполняет деквантование и IDCT
+ * в буфер jd->mcubuf и передает его функции putfunc, которая отдает буфер этапу вывода и
+ * записывает в jd->mcubuf следующий свободный буфер. Рабочий буфер jd->workbuf этапа загрузки
+ * используется только для IDCT (не менее 256 байт).
+ * Этап вывода (jd_mcu_output) работает со своей копией объекта декодера: преобразует YCbCr в RGB,
+ * масштабирует, обрезает блок и вызывает outfunc, чередуя половины своего буфера workbuf.
+ */
+JRESULT jd_decomp_load (
+	JDEC* jd,										/* Initialized decompression object */
+	int (*putfunc)(JDEC*, unsigned int, unsigned int),	/* Передача блока этапу вывода (0 - прервать) */
+	uint8_t scale									/* Output de-scaling factor (0 to 3) */
+)
+{
+	unsigned int x, y, mx, my;
+	uint16_t rst, rsc;
+	JRESULT rc;
+
+	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
+	jd->scale = scale;
+	jd->offset = 0;
+
+	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
+	rst = rsc = 0;
+
+	rc = JDR_OK;
+
+	for (y = 0; y < jd->height; y += my) {		/* Vertical loop of MCUs */
+		for (x = 0; x < jd->width; x += mx) {	/* Horizontal loop of MCUs */
+			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+				rc = restart(jd, rsc++);
+				if (rc != JDR_OK) return rc;
+				rst = 1;
+			}
+			rc = mcu_load(jd);					/* Load an MCU (decompress huffman coded stream, dequantize and apply IDCT) */
+			if (rc != JDR_OK) return rc;
+			if (!putfunc(jd, x, y)) return JDR_INTR;
+		}
+	}
+	return rc;
+}
+
+//Вывод блока, загруженного этапом jd_decomp_load в буфер mcubuf
+JRESULT jd_mcu_output (
+	JDEC* jd,								/* Копия объекта декодера этапа вывода */
+	jd_yuv_t* mcubuf,						/* Буфер с загруженным блоком */
+	int (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	unsigned int x,							/* MCU location in the image */
+	unsigned int y
+)
+{
+	JRESULT rc;
+	jd->mcubuf = mcubuf;
+	rc = mcu_output(jd, outfunc, x, y);
+	jd->offset = jd->offset_value - jd->offset;
+	return rc;
+}
+
+
+
+/*
+ * Распаковка диапазона блоков, начинающегося с интервала перезапуска
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Интервалы между маркерами RSTn независимы, поэтому несколько объектов декодера могут
+ * распаковывать разные диапазоны одного изображения. Входной поток объекта должен быть
+ * установлен на начало данных интервала (сразу после маркера RSTn, предшествующего блоку
+ * mcu_first), mcu_first должен быть кратен интервалу перезапуска jd->nrst.
+ * Таблицы Хаффмана и деквантования только читаются и могут быть общими для объектов,
+ * буферы inbuf, workbuf и mcubuf у каждого объекта свои.
+ */
+JRESULT jd_decomp_range (
+	JDEC* jd,								/* Initialized decompression object */
+	int (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	uint8_t scale,							/* Output de-scaling factor (0 to 3) */
+	uint32_t mcu_first,						/* Номер первого блока диапазона */
+	uint32_t mcu_num						/* Количество блоков в диапазоне */
+)
+{
+	unsigned int x, y, mx, my, mcx;
+	uint32_t mcu, mcu_end;
+	uint16_t rst, rsc;
+	JRESULT rc;
+
+	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
+	if (mcu_first && (!jd->nrst || mcu_first % jd->nrst)) return JDR_PAR;
+	jd->scale = scale;
+
+	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+	mcx = (jd->width + mx - 1) / mx;			/* Количество блоков в строке */
+
+	/* Начало интервала: пустой входной буфер, сброс регистра битов и значений DC */
+	jd->dctr = 0;
+	jd->dptr = jd->inbuf;
+	jd->dbit = 0;
+#if JD_FASTDECODE >= 1
+	jd->wreg = 0;
+	jd->marker = 0;
+#endif
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+	rst = 0;
+	rsc = jd->nrst ? mcu_first / jd->nrst : 0;
+
+	rc = JDR_OK;
+
+	mcu_end = mcu_first + mcu_num;
+	for (mcu = mcu_first; mcu < mcu_end; mcu++) {
+		x = (mcu % mcx) * mx;
+		y = (mcu / mcx) * my;
+		if (y >= jd->height) break;
+		if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+			rc = restart(jd, rsc++);
+			if (rc != JDR_OK) return rc;
+			rst = 1;
+		}
+		rc = mcu_load(jd);					/* Load an MCU (decompress huffman coded stream, dequantize and apply IDCT) */
+		if (rc != JDR_OK) return rc;
+		rc = mcu_output(jd, outfunc, x, y);	/* Output the MCU (YCbCr to RGB, scaling and output) */
+		if (rc != JDR_OK) return rc;
+		jd->offset = jd->offset_value - jd->offset;
+	}
+	return rc;
+}
+
+
+
+/*
+ * Распаковка области изображения (ROI)
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Блоки вне области только декодируются по Хаффману (для сохранения предсказания DC), без
+ * деквантования, IDCT и преобразования цвета. После последней строки блоков, пересекающей
+ * область, распаковка завершается. Блоки на границе области обрезаются на месте, в рабочем буфере.
+ * Функции вывода передаются координаты относительно левого верхнего угла области.
+ */
+
+//Пропуск блока: декодирование коэффициентов без деквантования и IDCT
+static JRESULT mcu_skip (
+	JDEC* jd		/* Pointer to the decompressor object */
+)
+{
+	int d, e;
+	unsigned int blk, nby, bc, z, cmp;
+
+	nby = jd->msx * jd->msy;	/* Number of Y blocks (1, 2 or 4) */
+	for (blk = 0; blk < nby + 2; blk++) {
+		cmp = (blk < nby) ? 0 : blk - nby + 1;	/* Component number 0:Y, 1:Cb, 2:Cr */
+		if (cmp && jd->ncomp != 3) continue;	/* Монохромное изображение: блоков цветности нет */
+		d = huffext(jd, cmp ? 1 : 0, 0);		/* Длина разности DC */
+		if (d < 0) return (JRESULT)(0 - d);
+		bc = (unsigned int)d;
+		if (bc) {
+			e = bitext(jd, bc);
+			if (e < 0) return (JRESULT)(0 - e);
+			d = 1 << (bc - 1);
+			if (!(e & d)) e -= (d << 1) - 1;
+			jd->dcv[cmp] += e;					/* Предсказание DC следующего блока */
+		}
+		z = 1;
+		do {
+			d = huffext(jd, cmp ? 1 : 0, 1);	/* Длина серии нулей и значения AC */
+			if (d == 0) break;					/* EOB */
+			if (d < 0) return (JRESULT)(0 - d);
+			bc = (unsigned int)d;
+#if JD_FASTDECODE == 2
+			if (bc & HUFF_VAL) {				/* Значение уже извлечено вместе с кодом */
+				z += (bc >> 8) & 0x0F;
+				if (z >= 64) return JDR_FMT1;
+				continue;
+			}
+#endif
+			z += bc >> 4;
+			if (z >= 64) return JDR_FMT1;
+			if (bc &= 0x0F) {
+				e = bitext(jd, bc);
+				if (e < 0) return (JRESULT)(0 - e);
+			}
+		} while (++z < 64);
+	}
+	return JDR_OK;
+}
+
+//Обрезка блока по области и вывод его пользовательской функцией
+static int roi_output (JDEC* jd, void* bitmap, JRECT* rect)
+{
+	const JRECT *roi = &jd->roi;
+	unsigned int bpp = jd->color_format == 0 ? 3 : 2;	/* Байт на пиксель: RGB888 или RGB565 */
+	unsigned int w = rect->right - rect->left + 1;
+	unsigned int left = rect->left < roi->left ? roi->left : rect->left;
+	unsigned int right = rect->right > roi->right ? roi->right : rect->right;
+	unsigned int top = rect->top < roi->top ? roi->top : rect->top;
+	unsigned int bottom = rect->bottom > roi->bottom ? roi->bottom : rect->bottom;
+	unsigned int cw = right - left + 1, iy;
+	uint8_t *src, *dst = (uint8_t*)bitmap;
+	JRECT r;
+
+	if (left > right || top > bottom) return JDR_OK;	/* Блок вне области по одной из координат */
+	if (cw != w || top != rect->top) {	/* Перенос строк области к началу буфера (dst <= src) */
+		src = (uint8_t*)bitmap + ((top - rect->top) * w + (left - rect->left)) * bpp;
+		for (iy = top; iy <= bottom; iy++) {
+			memmove(dst, src, cw * bpp);
+			dst += cw * bpp;
+			src += w * bpp;
+		}
+	}
+	r.left = left - roi->left; r.right = right - roi->left;
+	r.top = top - roi->top; r.bottom = bottom - roi->top;
+	return jd->roi_outfunc(jd, bitmap, &r);
+}
+
+//Сохранение состояния декодера в начале строки блоков
+static void row_save (JDEC* jd, JD_ROWPOS* pos, uint16_t rst, uint16_t rsc)
+{
+	pos->offset = (uint32_t)(jd->dptr - jd->mem_scan);
+	pos->dbit = jd->dbit;
+#if JD_FASTDECODE >= 1
+	pos->wreg = jd->wreg;
+	pos->marker = jd->marker;
+#endif
+	pos->dcv[0] = jd->dcv[0]; pos->dcv[1] = jd->dcv[1]; pos->dcv[2] = jd->dcv[2];
+	pos->rst = rst;
+	pos->rsc = rsc;
+}
+
+//Восстановление состояния декодера в начале строки блоков
+static void row_restore (JDEC* jd, const JD_ROWPOS* pos, uint16_t* rst, uint16_t* rsc)
+{
+	size_t scan_size = jd->index->scan_size;
+	jd->dptr = (uint8_t*)jd->mem_scan + pos->offset;
+	jd->dctr = scan_size - pos->offset;
+	jd->dbit = pos->dbit;
+#if JD_FASTDECODE >= 1
+	jd->wreg = pos->wreg;
+	jd->marker = pos->marker;
+#endif
+	jd->dcv[0] = pos->dcv[0]; jd->dcv[1] = pos->dcv[1]; jd->dcv[2] = pos->dcv[2];
+	*rst = pos->rst;
+	*rsc = pos->rsc;
+}
+
+JRESULT jd_decomp_rect (
+	JDEC* jd,								/* Initialized decompression object */
+	int (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	uint8_t scale,							/* Output de-scaling factor (0 to 3) */
+	const JRECT* roi						/* Область в координатах масштабированного изображения */
+)
+{
+	unsigned int x, y, mx, my, mleft, mright, mtop, mbottom;
+	uint16_t rst, rsc;
+	JRESULT rc;
+
+	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
+	if (roi->left > roi->right || roi->top > roi->bottom) return JDR_PAR;
+	jd->scale = scale;
+	jd->roi = *roi;
+	jd->roi_outfunc = outfunc;
+
+	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
+	rst = rsc = 0;
+
+	rc = JDR_OK;
+
+	y = 0;
+	if (jd->index) {	/* Распаковка начинается со строки блоков, содержащей верх области */
+		y = ((unsigned int)roi->top << scale) / my;
+		if (y >= jd->index->rows) return JDR_PAR;
+		row_restore(jd, &jd->index->pos[y], &rst, &rsc);
+		y *= my;
+	}
+
+	for ( ; y < jd->height; y += my) {		/* Vertical loop of MCUs */
+		mtop = y >> scale;
+		if (mtop > roi->bottom) break;			/* Ниже области блоков нет */
+		mbottom = (y + my - 1) >> scale;
+		for (x = 0; x < jd->width; x += mx) {	/* Horizontal loop of MCUs */
+			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+				rc = restart(jd, rsc++);
+				if (rc != JDR_OK) return rc;
+				rst = 1;
+			}
+			mleft = x >> scale;
+			mright = (x + mx - 1) >> scale;
+			if (mbottom < roi->top || mright < roi->left || mleft > roi->right) {
+				rc = mcu_skip(jd);				/* Блок вне области */
+				if (rc != JDR_OK) return rc;
+				continue;
+			}
+			rc = mcu_load(jd);					/* Load an MCU (decompress huffman coded stream, dequantize and apply IDCT) */
+			if (rc != JDR_OK) return rc;
+			rc = mcu_output(jd, roi_output, x, y);	/* Output the MCU (YCbCr to RGB, scaling and output) */
+			if (rc != JDR_OK) return rc;
+			jd->offset = jd->offset_value - jd->offset;
+		}
+	}
+	return rc;
+}
+
+
+
+/*
+ * Индекс строк блоков
+ * Copyright (C) 2024, VadRov, all right reserved.
+ *
+ * Для изображения в памяти (jd_prepare_mem, JD_FASTDECODE >= 1) один раз строится индекс:
+ * смещение в потоке, регистр битов, предсказания DC и счетчики интервалов перезапуска в начале
+ * каждой строки блоков. С подключенным индексом jd_decomp_rect начинает распаковку со строки,
+ * содержащей верх области, а не с начала изображения.
+ */
+
+//Размер индекса изображения в байтах (0 - индекс для источника невозможен)
+size_t jd_index_size (
+	JDEC* jd					/* Initialized decompression object */
+)
+{
+	if (JD_FASTDECODE < 1 || !jd->mem_scan) return 0;
+	return sizeof (JD_INDEX) + ((jd->height + jd->msy * 8 - 1) / (jd->msy * 8)) * sizeof (JD_ROWPOS);
+}
+
+//Построение индекса: все блоки декодируются только по Хаффману. После построения
+//декодер возвращается к началу данных сканирования.
+JRESULT jd_build_index (
+	JDEC* jd,					/* Initialized decompression object */
+	JD_INDEX* index				/* Буфер индекса размером jd_index_size() */
+)
+{
+	unsigned int x, y, mx, my, row;
+	uint16_t rst, rsc;
+	JRESULT rc;
+	uint8_t* dptr = jd->dptr;
+	size_t dctr = jd->dctr;
+
+	if (!jd_index_size(jd)) return JDR_PAR;
+	mx = jd->msx * 8; my = jd->msy * 8;
+
+	index->version = JD_INDEX_VERSION;
+	index->scan_size = (uint32_t)(jd->dptr + jd->dctr - jd->mem_scan);
+	index->width = jd->width; index->height = jd->height;
+	index->msx = jd->msx; index->msy = jd->msy;
+	index->rows = (jd->height + my - 1) / my;
+
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+	rst = rsc = 0;
+	rc = JDR_OK;
+
+	for (y = 0, row = 0; y < jd->height; y += my, row++) {
+		row_save(jd, &index->pos[row], rst, rsc);
+		for (x = 0; x < jd->width; x += mx) {
+			if (jd->nrst && rst++ == jd->nrst) {
+				rc = restart(jd, rsc++);
+				if (rc != JDR_OK) break;
+				rst = 1;
+			}
+			rc = mcu_skip(jd);
+			if (rc != JDR_OK) break;
+		}
+		if (rc != JDR_OK) break;
+	}
+
+	/* Возврат к началу данных сканирования */
+	jd->dptr = dptr; jd->dctr = dctr;
+	jd->dbit = 0;
+#if JD_FASTDECODE >= 1
+	jd->wreg = 0; jd->marker = 0;
+#endif
+	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+	return rc;
+}
+
+//Подключение индекса к декодеру (0 - отключение). Индекс должен быть построен для этого изображения.
+JRESULT jd_set_index (
+	JDEC* jd,					/* Initialized decompression object */
+	const JD_INDEX* index		/* Индекс строк блоков */
+)
+{
+	if (index) {
+		if (!jd_index_size(jd)) return JDR_PAR;
+		if (index->version != JD_INDEX_VERSION || index->width != jd->width || index->height != jd->height ||
+			index->msx != jd->msx || index->msy != jd->msy ||
+			index->scan_size != (uint32_t)(jd->dptr + jd->dctr - jd->mem_scan)) {
+			return JDR_PAR;	/* Индекс построен для другого изображения */
+		}
+	}
+	jd->index = index;
+	return JDR_OK;
+}
+
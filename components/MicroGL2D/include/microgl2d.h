@@ -68,11 +68,19 @@ typedef struct {
 	void *next;				//указатель на следующую ключевую точку (так формируется список ключевых точек градиента)
 } MGL_GRADIENT_POINT;
 
+//Количество элементов таблицы цветов градиента (смещения 0 - 100 %)
+#define MGL_GRADIENT_LUT_SIZE	101
+
 //Данные градиента
 typedef struct {
 	MGL_GRADIENT_TYPES g_type;		 //тип градиента
 	int deg;						 //угол
 	MGL_GRADIENT_POINT *points_list; //список с ключевыми точками градиента (список смен цвета)
+	uint32_t version;				 //номер изменения ключевых точек
+	uint32_t lut_version;			 //номер изменения, для которого построена таблица цветов
+	uint32_t lut[MGL_GRADIENT_LUT_SIZE]; //таблица цветов R8G8B8 для смещений 0 - 100 % (строится при отрисовке)
+	uint32_t lut_build[MGL_GRADIENT_LUT_SIZE]; //буфер построения таблицы цветов
+	uint8_t lut_building;			 //таблица строится одним из исполнителей
 } MGL_GRADIENT;
 
 //Режим цвета изображения
@@ -104,6 +112,11 @@ typedef struct {
 	uint8_t features;	//свойства текстуры
 } MGL_TEXTURE;
 
+//Прямоугольная область экрана (включая граничные пиксели)
+typedef struct {
+	int x1, y1, x2, y2;		//координаты левой верхней и правой нижней вершин
+} MGL_RECT;
+
 //Обработчик графического объекта
 typedef struct {
 	MGL_OBJ_TYPES obj_type; //тип объекта
@@ -118,6 +131,9 @@ typedef struct {
 	void *parent;			//указатель на родительский объект
 	void *next;				//указатель на следующий объект
 	void *prev;				//указатель на предыдущий объект
+	uint8_t dirty;			//объект изменен после последнего сбора областей перерисовки
+	uint8_t drawn;			//объект выведен на экран и занимает область drawn_rect
+	MGL_RECT drawn_rect;	//область, занятая объектом на момент последнего сбора областей перерисовки
 } MGL_OBJ;
 
 //Данные треугольника
@@ -167,6 +183,41 @@ typedef struct {
 	uint32_t color;					//цвет фона
 } MGL_OBJ_SLIDER;
 
+//Элемент таблицы объектов кадра
+typedef struct {
+	MGL_OBJ *obj;			//объект
+	int y1, y2;				//первая и последняя строки, занимаемые объектом
+	int index;				//порядковый номер объекта в списке (определяет порядок отрисовки)
+} MGL_RENDER_ENTRY;
+
+//Таблица объектов кадра: видимые объекты списка, попавшие в строки кадра и распределенные по корзинам
+//в соответствии с верхней строкой. Позволяет при построчной отрисовке обходить только объекты,
+//пересекающие текущую строку (список активных объектов).
+typedef struct {
+	int y0, y1;					//первая и последняя строки кадра
+	MGL_RENDER_ENTRY *entries;	//объекты, упорядоченные по верхней строке (с одной строки - в порядке списка)
+	MGL_RENDER_ENTRY *list;		//те же объекты в порядке списка
+	int entries_num;			//количество объектов в таблице
+	int entries_max;			//размер массивов entries и list
+	int *buckets;				//buckets[y - y0] - индекс в entries первого объекта с верхней строкой y
+								//(объекты, начинающиеся выше кадра, относятся к его первой строке)
+	int buckets_max;			//размер массива buckets
+	MGL_RENDER_ENTRY **active;	//списки активных объектов: slots массивов по entries_max элементов
+	int slots;					//количество списков активных объектов (полос, отрисовываемых одновременно)
+} MGL_RENDER_TABLE;
+
+//Максимальное количество прямоугольников перерисовки
+#define MGL_DIRTY_RECTS_MAX	8
+
+//Области перерисовки кадра: прямоугольники, в которых изменилось изображение.
+//Пересекающиеся и соприкасающиеся прямоугольники объединяются. При заполнении массива
+//новый прямоугольник объединяется с тем, для которого прирост площади минимален.
+typedef struct {
+	MGL_RECT clip;							//область экрана, за пределами которой перерисовка не нужна
+	MGL_RECT rects[MGL_DIRTY_RECTS_MAX];	//прямоугольники перерисовки
+	int rects_num;							//количество прямоугольников
+} MGL_DIRTY;
+
 //Добавляет объект
 MGL_OBJ* MGL_ObjectAdd(MGL_OBJ *obj, MGL_OBJ_TYPES type);
 //Удаляет объект
@@ -195,6 +246,9 @@ void MGL_GradientAddColor(MGL_GRADIENT *gradient, uint8_t offset, uint32_t color
 void MGL_GradientDelete(MGL_GRADIENT *gradient);
 //Задает угол градиента
 void MGL_GradientSetDeg(MGL_GRADIENT *gradient, int deg);
+//Сообщает об изменении ключевых точек градиента (после прямого изменения смещений, цветов, флагов смешивания),
+//таблица цветов будет построена заново при следующей отрисовке
+void MGL_GradientInvalidate(MGL_GRADIENT *gradient);
 //Устанавливает прозрачность объекта
 void MGL_ObjectSetTransparency(MGL_OBJ *obj, uint8_t tr);
 //Устанавливает план объекта (на самом переднем плане - 0... на самом заднем плане - 255)
@@ -207,8 +261,49 @@ void MGL_ObjectMove(MGL_OBJ *obj, int dx, int dy);
 void MGL_ObjectListMove(MGL_OBJ *obj_list, int dx, int dy);
 //Задает прозрачность для объектов списка (0 - абсолютно непрозрачен. 255 - невидим)
 void MGL_ObjectListTransparency(MGL_OBJ *obj_list, uint8_t tr);
+//Помечает объект как измененный. Функции MGL_Set*, MGL_ObjectSet*, MGL_ObjectMove делают это сами,
+//вызов нужен после прямого изменения данных объекта, его градиента или текстуры.
+void MGL_ObjectInvalidate(MGL_OBJ *obj);
+//Инициализирует области перерисовки для экрана x1, y1, x2, y2
+void MGL_DirtyInit(MGL_DIRTY *dirty, int x1, int y1, int x2, int y2);
+//Очищает список прямоугольников перерисовки (после вывода кадра)
+void MGL_DirtyReset(MGL_DIRTY *dirty);
+//Добавляет прямоугольник перерисовки (например, весь экран для первого кадра
+//или область drawn_rect объекта перед его удалением)
+void MGL_DirtyAddRect(MGL_DIRTY *dirty, int x1, int y1, int x2, int y2);
+//Добавляет прежнюю и текущую области измененных объектов списка, запоминает текущие области
+//и снимает пометки. Возвращает количество прямоугольников перерисовки.
+int MGL_DirtyCollect(MGL_DIRTY *dirty, MGL_OBJ *obj_list);
 
 void MGL_RenderObj(MGL_OBJ *obj, uint16_t *render_buf, int x0, int x1, int y);
 //Отрисовывает в буфер объекты (их части), попавшие в текущее окно вывода
 void MGL_RenderObjects(MGL_OBJ *obj, int x0, int y0, int x1, int y1, uint16_t *data);
+//Возвращает в x1, y1, x2, y2 прямоугольник, ограничивающий объект.
+//Возвращает 0, если объект невидим или не имеет размеров.
+int MGL_ObjectGetBounds(MGL_OBJ *obj, int *x1, int *y1, int *x2, int *y2);
+//Создает таблицу объектов кадра, допускающую одновременную отрисовку slots полос
+//(slots - не меньше числа исполнителей планировщика, иначе число полос ограничивается slots)
+MGL_RENDER_TABLE* MGL_RenderTableCreate(int slots);
+//Удаляет таблицу объектов кадра
+void MGL_RenderTableDelete(MGL_RENDER_TABLE *table);
+//Заполняет таблицу видимыми объектами списка obj, попавшими в строки кадра y0...y1 (проход подготовки кадра).
+//Возвращает 0 при успехе, 1 - при нехватке памяти.
+int MGL_RenderTablePrepare(MGL_RENDER_TABLE *table, MGL_OBJ *obj, int y0, int y1);
+//Отрисовывает в буфер объекты таблицы, попавшие в окно вывода (строки окна должны лежать в пределах кадра)
+void MGL_RenderTableObjects(MGL_RENDER_TABLE *table, int x0, int y0, int x1, int y1, uint16_t *data);
+
+//Планировщик отрисовки: постоянные задачи-исполнители, закрепленные за ядрами,
+//получают из очереди полосы строк окна вывода и отрисовывают их в буфер
+typedef struct MGL_RENDER_SCHEDULER_ MGL_RENDER_SCHEDULER;
+
+//Создает планировщик с workers_num исполнителями (исполнитель i закрепляется за ядром i % числа ядер)
+MGL_RENDER_SCHEDULER* MGL_RenderSchedulerCreate(int workers_num, uint32_t stack_size, uint32_t priority);
+//Завершает задачи-исполнители и удаляет планировщик
+void MGL_RenderSchedulerDelete(MGL_RENDER_SCHEDULER *sched);
+//Отрисовывает в буфер окно вывода, распределяя его строки между исполнителями.
+//Возвращает управление после отрисовки всех строк. При sched = 0 отрисовка выполняется в вызывающей задаче.
+//Планировщиком могут пользоваться несколько задач: их окна отрисовываются по очереди.
+void MGL_RenderSchedulerRender(MGL_RENDER_SCHEDULER *sched, MGL_OBJ *obj, int x0, int y0, int x1, int y1, uint16_t *data);
+//То же для объектов подготовленной таблицы кадра
+void MGL_RenderSchedulerRenderTable(MGL_RENDER_SCHEDULER *sched, MGL_RENDER_TABLE *table, int x0, int y0, int x1, int y1, uint16_t *data);
 #endif /* MICROGL2D_H_ */
@@ -42,6 +42,8 @@
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 
 #define malloc(par1) 		heap_caps_malloc(par1, MALLOC_CAP_8BIT)
 #define calloc(par1, par2) 	heap_caps_calloc(par1, par2, MALLOC_CAP_8BIT)
@@ -131,6 +133,9 @@ MGL_GRADIENT* MGL_GradientCreate(MGL_GRADIENT_TYPES type)
 	gradient->g_type = type;
 	gradient->deg = 0;
 	gradient->points_list = 0;
+	gradient->version = 1;
+	gradient->lut_version = 0;
+	gradient->lut_building = 0;
 	return gradient;
 }
 
@@ -158,6 +163,7 @@ void MGL_GradientAddColor(MGL_GRADIENT *gradient, uint8_t offset, uint32_t color
 	point->color = color;
 	point->flag_mix = flag_mix;
 	point->next = 0;
+	gradient->version++;
 	if (!ptr) {
 		gradient->points_list = point;
 		return;
@@ -185,6 +191,12 @@ void MGL_GradientAddColor(MGL_GRADIENT *gradient, uint8_t offset, uint32_t color
 	prev->next = point;	//Добавляем ключевую точку в конец списка
 }
 
+//Сообщает об изменении ключевых точек градиента
+inline void MGL_GradientInvalidate(MGL_GRADIENT *gradient)
+{
+	gradient->version++;
+}
+
 //Устанавливает угол для линейного градиента
 inline void MGL_GradientSetDeg(MGL_GRADIENT *gradient, int deg)
 {
@@ -198,6 +210,7 @@ MGL_OBJ* MGL_ObjectAdd(MGL_OBJ *obj_list, MGL_OBJ_TYPES type)
 	if (!obj) return 0;
 	obj->obj_type = type;
 	obj->visible = 1;
+	obj->dirty = 1;
 	switch (type) {
 		case MGL_OBJ_TYPE_TRIANGLE:
 		case MGL_OBJ_TYPE_FILLTRIANGLE:
@@ -276,30 +289,35 @@ void MGL_ObjectsListDelete(MGL_OBJ *obj)
 inline void MGL_ObjectSetTexture(MGL_OBJ *obj, MGL_TEXTURE *texture)
 {
 	obj->texture = texture;
+	obj->dirty = 1;
 }
 
 //Устанавливает градиент для указанного объекта
 inline void MGL_ObjectSetGradient(MGL_OBJ *obj, MGL_GRADIENT *gradient)
 {
 	obj->gradient = gradient;
+	obj->dirty = 1;
 }
 
 //Устанавливает прозрачность объекта
 inline void MGL_ObjectSetTransparency(MGL_OBJ *obj, uint8_t tr)
 {
 	obj->transparency = tr;
+	obj->dirty = 1;
 }
 
 //Устанавливает план объекта
 inline void MGL_ObjectSetPlane(MGL_OBJ *obj, uint8_t plane)
 {
 	obj->plane = plane;
+	obj->dirty = 1;
 }
 
 //Устанавливает видимость объекта
 inline void MGL_ObjectSetVisible(MGL_OBJ *obj, uint8_t visible)
 {
 	obj->visible = visible;
+	obj->dirty = 1;
 }
 
 //Устанавливает параметры прямоугольника
@@ -318,6 +336,7 @@ void MGL_SetRectangle(MGL_OBJ *obj, int x1, int y1, int x2, int y2, uint32_t col
 	obj_rectangle->x2 = x2;
 	obj_rectangle->y2 = y2;
 	obj_rectangle->color = color;
+	obj->dirty = 1;
 }
 
 //Устанавливает параметры треугольника
@@ -344,6 +363,7 @@ void MGL_SetTriangle(MGL_OBJ *obj, int x1, int y1, int x2, int y2, int x3, int y
 	obj_triangle->x3 = x3;
 	obj_triangle->y3 = y3;
 	obj_triangle->color = color;
+	obj->dirty = 1;
 }
 
 //Устанавливает параметры окружности
@@ -354,6 +374,7 @@ void MGL_SetCircle(MGL_OBJ *obj, int x, int y, int r, uint32_t color)
 	obj_circle->y = y;
 	obj_circle->r = r;
 	obj_circle->color = color;
+	obj->dirty = 1;
 }
 
 //Устанавливает параметры текста
@@ -366,6 +387,7 @@ void MGL_SetText(MGL_OBJ *obj, int x, int y, char *txt, FontDef *font, uint8_t b
 	obj_txt->font = font;
 	obj_txt->bold = bold;
 	obj_txt->color = color;
+	obj->dirty = 1;
 }
 
 //Устанавливает данные ползунка
@@ -389,6 +411,7 @@ void MGL_SetSlider(MGL_OBJ *obj,  MGL_SLIDER_TYPES type, int x1, int y1, int x2,
 	obj_slider->value_max = value_max;
 	obj_slider->value = value;
 	obj_slider->unit = unit;
+	obj->dirty = 1;
 	obj_slider->obj_fon = MGL_ObjectAdd(0, MGL_OBJ_TYPE_FILLRECTANGLE);
 	obj_slider->obj_rectangle1 = MGL_ObjectAdd(obj_slider->obj_fon, MGL_OBJ_TYPE_FILLRECTANGLE);
 	obj_slider->obj_rectangle2 = MGL_ObjectAdd(obj_slider->obj_fon, MGL_OBJ_TYPE_FILLRECTANGLE);
@@ -448,6 +471,82 @@ static inline uint32_t MGL_Color_gradient(uint32_t color1, uint32_t color2, uint
 		return (r_col1 << 16) | (g_col1 << 8) | b_col1;
 }
 
+//Защищает публикацию таблиц цветов градиентов исполнителями планировщика отрисовки
+static portMUX_TYPE MGL_GradientMux = portMUX_INITIALIZER_UNLOCKED;
+
+//Строит таблицу цветов градиента lut для смещений 0 - 100 %. Цвет для смещения dist определяется так же,
+//как при обходе списка ключевых точек: до первой точки - цвет первой точки, после последней - цвет последней,
+//между точками - смешанный цвет соседних точек.
+static void MGL_GradientBuild(MGL_GRADIENT *gradient, uint32_t *lut)
+{
+	MGL_GRADIENT_POINT *list = gradient->points_list;
+	uint32_t color1 = 0, color2 = 0, col_gr = 0;
+	int pr1 = 0, pr2 = 0, pr11, pr12, dist;
+	uint8_t a;
+	if (list) {
+		pr1 = list->offset;
+		color1 = list->color;
+		while (list->next) {
+			list = (MGL_GRADIENT_POINT *)list->next;
+		}
+		pr2 = list->offset;
+		color2 = list->color;
+	}
+	for (dist = 0; dist < MGL_GRADIENT_LUT_SIZE; dist++) {
+		if (dist <= pr1) col_gr = color1;
+		else if (dist >= pr2 || (pr2 == pr1)) col_gr = color2;
+		else {
+			list = gradient->points_list;
+			pr11 = list->offset;
+			while (list->next) {
+				pr12 = ((MGL_GRADIENT_POINT *)list->next)->offset;
+				if (pr11 <= dist && dist <= pr12) {
+					if (list->flag_mix && !(pr12 == pr11)) {
+						a = (255 * (dist - pr11)) / (pr12 - pr11);
+						col_gr = MGL_Color_gradient(list->color, ((MGL_GRADIENT_POINT *)list->next)->color, a);
+					}
+					else {
+						col_gr = list->color;
+					}
+					break;
+				}
+				pr11 = pr12;
+				list = (MGL_GRADIENT_POINT *)list->next;
+			}
+		}
+		lut[dist] = col_gr;
+	}
+}
+
+//Возвращает таблицу цветов градиента, при изменении ключевых точек строит ее заново.
+//Таблицу строит один исполнитель: он занимает буфер построения градиента и заполняет его без блокировки
+//(ключевые точки не изменяются во время отрисовки), в критической секции таблица только копируется
+//и публикуется. Остальные исполнители уступают процессор до ее публикации. Буфер построения - в градиенте,
+//а не в стеке: стек исполнителей планировщика мал.
+static const uint32_t* MGL_GradientLUT(MGL_GRADIENT *gradient)
+{
+	uint32_t version = gradient->version;
+	int build;
+	while (1) {
+		if (__atomic_load_n(&gradient->lut_version, __ATOMIC_ACQUIRE) == version) {
+			return gradient->lut;
+		}
+		portENTER_CRITICAL(&MGL_GradientMux);
+		build = !gradient->lut_building && gradient->lut_version != version;
+		if (build) gradient->lut_building = 1;
+		portEXIT_CRITICAL(&MGL_GradientMux);
+		if (build) break;
+		taskYIELD();
+	}
+	MGL_GradientBuild(gradient, gradient->lut_build);
+	portENTER_CRITICAL(&MGL_GradientMux);
+	memcpy(gradient->lut, gradient->lut_build, sizeof(gradient->lut));
+	__atomic_store_n(&gradient->lut_version, version, __ATOMIC_RELEASE);
+	gradient->lut_building = 0;
+	portEXIT_CRITICAL(&MGL_GradientMux);
+	return gradient->lut;
+}
+
 //Вычисляет результирующий цвет в точке при наложении объектов с учетом прозрачности
 static inline uint16_t MGL_NewColor(uint16_t col_f, uint32_t color_obj, uint16_t a)
 {
@@ -628,39 +727,11 @@ static void MGL_setcolorbuffer(MGL_OBJ *obj, uint16_t *buffer,
 	}
 
 	if (!obj->gradient) return;
-	uint32_t color1, color2;
-	int pr1, pr2, pr11, pr12;
-	MGL_GRADIENT_POINT *list = obj->gradient->points_list;
-	pr1 = list->offset;
-	color1 = list->color;
-	while (list->next) {
-		list = (MGL_GRADIENT_POINT *)list->next;
-	}
-	pr2 = list->offset;
-	color2 = list->color;
+	//цвет по смещению (в %) берется из таблицы: смещения вне 0 - 100 % получают цвет крайних точек
+	const uint32_t *lut = MGL_GradientLUT(obj->gradient);
 	if (obj->gradient->g_type == MGL_GRADIENT_LINEAR && obj->gradient->deg == 0) {
 		uint8_t yp = 100 - 100 * (y - y_min) / y_h;
-		if (yp <= pr1) col_gr = color1;
-		else if (yp >= pr2 || (pr2 == pr1)) col_gr = color2;
-		else {
-			list = obj->gradient->points_list;
-			pr11 = list->offset;
-			while (list->next) {
-				pr12 = ((MGL_GRADIENT_POINT *)list->next)->offset;
-				if (pr11 <= yp && yp <= pr12)	{
-					if (list->flag_mix && !(pr12 == pr11)) {
-						a = (255 * (yp - pr11)) / (pr12 - pr11);
-						col_gr = MGL_Color_gradient(list->color, ((MGL_GRADIENT_POINT *)list->next)->color, a);
-					}
-					else {
-						col_gr = list->color;
-					}
-					break;
-				}
-				pr11 = pr12;
-				list = (MGL_GRADIENT_POINT *)list->next;
-			}
-		}
+		col_gr = lut[min(yp, MGL_GRADIENT_LUT_SIZE - 1)];
 		for (x = x_start; x <= x_end; x++) {
 			buffer[x - x0] = MGL_NewColor(buffer[x - x0], col_gr, tr);
 		}
@@ -670,27 +741,7 @@ static void MGL_setcolorbuffer(MGL_OBJ *obj, uint16_t *buffer,
 		uint8_t xp;
 		for (x = x_start; x <= x_end; x++) {
 			xp = (100 * (x - x_min)) / x_w;
-			if (xp <= pr1) col_gr = color1;
-			else if (xp >= pr2 || (pr2 == pr1)) col_gr = color2;
-			else {
-				list = obj->gradient->points_list;
-				pr11 = list->offset;
-				while (list->next) {
-					pr12 = ((MGL_GRADIENT_POINT *)list->next)->offset;
-					if (pr11 <= xp && xp <= pr12) {
-						if (list->flag_mix && !(pr12 == pr11)) {
-							a = (255 * (xp - pr11)) / (pr12 - pr11);
-							col_gr = MGL_Color_gradient(list->color, ((MGL_GRADIENT_POINT *)list->next)->color, a);
-						}
-						else {
-							col_gr = list->color;
-						}
-						break;
-					}
-					pr11 = pr12;
-					list = (MGL_GRADIENT_POINT *)list->next;
-				}
-			}
+			col_gr = lut[min(xp, MGL_GRADIENT_LUT_SIZE - 1)];
 			buffer[x - x0] = MGL_NewColor(buffer[x - x0], col_gr, tr);
 		}
 		return;
@@ -706,7 +757,6 @@ static void MGL_setcolorbuffer(MGL_OBJ *obj, uint16_t *buffer,
 	else {
 		len = ((int)MGL_sqrt(x_w * x_w + y_h * y_h)) >> 1;
 	}
-	list = obj->gradient->points_list;
 	for (x = x_start; x <= x_end; x++) {
 		if (obj->gradient->g_type == MGL_GRADIENT_LINEAR) {
 			dist = 50 - 100 * ((x_min + (x_w >> 1) - x) * sin_a + a_y) / len;
@@ -714,28 +764,9 @@ static void MGL_setcolorbuffer(MGL_OBJ *obj, uint16_t *buffer,
 		else {
 			dist = 100 * MGL_sqrt((x - x_min - (x_w >> 1)) * (x - x_min - (x_w >> 1)) + (y - y_min - (y_h >> 1)) * (y - y_min - (y_h >> 1))) / len;
 		}
-		if (dist <= pr1) col_gr = color1;
-		else if (dist >= pr2 || (pr2 == pr1)) col_gr = color2;
-		else {
-			list = obj->gradient->points_list;
-			pr11 = list->offset;
-			while (list->next) {
-				pr12 = ((MGL_GRADIENT_POINT *)list->next)->offset;
-				if (pr11 <= dist && dist <= pr12) {
-					if (list->flag_mix && !(pr12 == pr11)) {
-						a = (255 * (dist - pr11)) / (pr12 - pr11);
-						col_gr = MGL_Color_gradient(list->color, ((MGL_GRADIENT_POINT *)list->next)->color, a);
-					}
-					else {
-						col_gr = list->color;
-					}
-					break;
-				}
-				pr11 = pr12;
-				list = (MGL_GRADIENT_POINT *)list->next;
-			}
-		}
-		buffer[x - x0] = MGL_NewColor(buffer[x - x0], col_gr, tr);
+		if (dist < 0) dist = 0;
+		else if (dist >= MGL_GRADIENT_LUT_SIZE) dist = MGL_GRADIENT_LUT_SIZE - 1;
+		buffer[x - x0] = MGL_NewColor(buffer[x - x0], lut[dist], tr);
 	}
 }
 
@@ -839,6 +870,9 @@ void MGL_RenderObj(MGL_OBJ *obj, uint16_t *render_buf, int x0, int x1, int y)
 				float tmp_s = obj_circle->r * obj_circle->r - (y - obj_circle->y) * (y - obj_circle->y);
 				if (tmp_s < 0) break;
 				tmp_s = MGL_sqrt(tmp_s);
+				//приближенный корень может превышать радиус: строка ограничивается квадратом,
+				//описанным вокруг круга, иначе результат зависел бы от границ окна вывода
+				if (tmp_s > obj_circle->r) tmp_s = obj_circle->r;
 				x_start = obj_circle->x - (int)tmp_s;
 				x_end = obj_circle->x + (int)tmp_s;
 				if (x_start < x0) x_start = x0;
@@ -1079,6 +1113,328 @@ void MGL_RenderObjects(MGL_OBJ *obj, int x0, int y0, int x1, int y1, uint16_t *d
 	}
 }
 
+//Возвращает прямоугольник, ограничивающий объект
+int MGL_ObjectGetBounds(MGL_OBJ *obj, int *x1, int *y1, int *x2, int *y2)
+{
+	if (!obj || !obj->visible || !obj->object) return 0;
+	MGL_OBJ_TRIANGLE *obj_triangle;
+	MGL_OBJ_RECTANGLE *obj_rectangle;
+	MGL_OBJ_CIRCLE *obj_circle;
+	MGL_OBJ_TEXT *obj_text;
+	MGL_OBJ_SLIDER *obj_slider;
+	switch(obj->obj_type) {
+		case MGL_OBJ_TYPE_TRIANGLE:
+		case MGL_OBJ_TYPE_FILLTRIANGLE:
+			obj_triangle = (MGL_OBJ_TRIANGLE*)obj->object;
+			*x1 = min3(obj_triangle->x1, obj_triangle->x2, obj_triangle->x3);
+			*x2 = max3(obj_triangle->x1, obj_triangle->x2, obj_triangle->x3);
+			*y1 = min3(obj_triangle->y1, obj_triangle->y2, obj_triangle->y3);
+			*y2 = max3(obj_triangle->y1, obj_triangle->y2, obj_triangle->y3);
+			return 1;
+		case MGL_OBJ_TYPE_RECTANGLE:
+		case MGL_OBJ_TYPE_FILLRECTANGLE:
+			obj_rectangle = (MGL_OBJ_RECTANGLE*)obj->object;
+			*x1 = obj_rectangle->x1;
+			*y1 = obj_rectangle->y1;
+			*x2 = obj_rectangle->x2;
+			*y2 = obj_rectangle->y2;
+			return 1;
+		case MGL_OBJ_TYPE_CIRCLE:
+		case MGL_OBJ_TYPE_FILLCIRCLE:
+			obj_circle = (MGL_OBJ_CIRCLE*)obj->object;
+			*x1 = obj_circle->x - obj_circle->r;
+			*y1 = obj_circle->y - obj_circle->r;
+			*x2 = obj_circle->x + obj_circle->r;
+			*y2 = obj_circle->y + obj_circle->r;
+			return 1;
+		case MGL_OBJ_TYPE_TEXT:
+			obj_text = (MGL_OBJ_TEXT*)obj->object;
+			if (!obj_text->txt || !obj_text->font || !obj_text->txt[0]) return 0;
+			*x1 = obj_text->x;
+			*y1 = obj_text->y;
+			*x2 = obj_text->x + strlen(obj_text->txt) * obj_text->font->width - 1;
+			*y2 = obj_text->y + obj_text->font->height - 1;
+			return 1;
+		case MGL_OBJ_TYPE_SLIDER:
+			obj_slider = (MGL_OBJ_SLIDER*)obj->object;
+			*x1 = obj_slider->x1;
+			*y1 = obj_slider->y1;
+			*x2 = obj_slider->x2 + 1; //ползунок и полоса прокрутки по строке не отсекаются и выходят на пиксель вправо
+			*y2 = obj_slider->y2;
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+//Создает таблицу объектов кадра
+MGL_RENDER_TABLE* MGL_RenderTableCreate(int slots)
+{
+	MGL_RENDER_TABLE *table = (MGL_RENDER_TABLE*)calloc(1, sizeof(MGL_RENDER_TABLE));
+	if (table) table->slots = slots > 0 ? slots : 1;
+	return table;
+}
+
+//Удаляет таблицу объектов кадра
+void MGL_RenderTableDelete(MGL_RENDER_TABLE *table)
+{
+	if (!table) return;
+	free(table->entries);
+	free(table->list);
+	free(table->buckets);
+	free(table->active);
+	free(table);
+}
+
+//Заполняет таблицу объектов кадра: объекты распределяются по корзинам верхних строк
+//сортировкой подсчетом, которая сохраняет порядок объектов списка внутри корзины
+int MGL_RenderTablePrepare(MGL_RENDER_TABLE *table, MGL_OBJ *obj, int y0, int y1)
+{
+	int x_min, x_max, y_min, y_max, index = 0, n = 0;
+	int lines = y1 - y0 + 1;
+	if (!table) return 1;
+	table->y0 = y0;
+	table->y1 = y1;
+	table->entries_num = 0;
+	if (lines <= 0) return 0;
+	MGL_OBJ *obj_ptr;
+	for (obj_ptr = obj; obj_ptr; obj_ptr = obj_ptr->next) {
+		n++;
+	}
+	if (n > table->entries_max) {
+		free(table->entries);
+		free(table->list);
+		free(table->active);
+		table->entries = (MGL_RENDER_ENTRY*)malloc(n * sizeof(MGL_RENDER_ENTRY));
+		table->list = (MGL_RENDER_ENTRY*)malloc(n * sizeof(MGL_RENDER_ENTRY));
+		table->active = (MGL_RENDER_ENTRY**)malloc(n * table->slots * sizeof(MGL_RENDER_ENTRY*));
+		table->entries_max = n;
+		if (!table->entries || !table->list || !table->active) {
+			table->entries_max = 0;
+			return 1;
+		}
+	}
+	if (lines + 1 > table->buckets_max) {
+		free(table->buckets);
+		table->buckets = (int*)malloc((lines + 1) * sizeof(int));
+		table->buckets_max = lines + 1;
+		if (!table->buckets) {
+			table->buckets_max = 0;
+			return 1;
+		}
+	}
+	memset(table->buckets, 0, (lines + 1) * sizeof(int));
+	MGL_RENDER_ENTRY *entry = table->list;
+	for (obj_ptr = obj; obj_ptr; obj_ptr = obj_ptr->next, index++) {
+		if (!MGL_ObjectGetBounds(obj_ptr, &x_min, &y_min, &x_max, &y_max)) continue;
+		if (y_max < y0 || y_min > y1) continue;
+		entry->obj = obj_ptr;
+		entry->y1 = y_min;
+		entry->y2 = y_max;
+		entry->index = index;
+		table->buckets[(y_min < y0 ? y0 : y_min) - y0 + 1]++;
+		entry++;
+	}
+	table->entries_num = entry - table->list;
+	for (int i = 1; i <= lines; i++) {		//buckets[i] - начало корзины строки y0 + i
+		table->buckets[i] += table->buckets[i - 1];
+	}
+	for (int i = 0; i < table->entries_num; i++) {
+		entry = &table->list[i];
+		table->entries[table->buckets[(entry->y1 < y0 ? y0 : entry->y1) - y0]++] = *entry;
+	}
+	for (int i = lines; i > 0; i--) {		//после раскладки buckets[i] указывает на конец корзины i
+		table->buckets[i] = table->buckets[i - 1];
+	}
+	table->buckets[0] = 0;
+	return 0;
+}
+
+//Добавляет объект в список активных объектов, упорядоченный по порядку объектов в списке
+static inline void MGL_ActiveInsert(MGL_RENDER_ENTRY **active, int *active_num, MGL_RENDER_ENTRY *entry)
+{
+	int i = (*active_num)++;
+	while (i && active[i - 1]->index > entry->index) {
+		active[i] = active[i - 1];
+		i--;
+	}
+	active[i] = entry;
+}
+
+//Отрисовывает в буфер объекты таблицы кадра, попавшие в окно вывода. На каждой строке обходятся только
+//активные объекты: в список добавляются объекты корзины текущей строки и удаляются закончившиеся выше.
+//slot - номер списка активных объектов таблицы, занимаемого полосой.
+static void MGL_RenderTableSlot(MGL_RENDER_TABLE *table, int slot, int x0, int y0, int x1, int y1, uint16_t *data)
+{
+	int y, i, k;
+	if (y0 < table->y0) {
+		data += (table->y0 - y0) * (x1 - x0 + 1);
+		y0 = table->y0;
+	}
+	if (y1 > table->y1) y1 = table->y1;
+	if (y0 > y1 || !table->entries_num) return;
+	MGL_RENDER_ENTRY **active = table->active + slot * table->entries_max;
+	int active_num = 0;
+	//объекты, начинающиеся не ниже первой строки окна и пересекающие ее
+	int next = table->buckets[y0 - table->y0 + 1];
+	for (i = 0; i < next; i++) {
+		if (table->entries[i].y2 >= y0) {
+			MGL_ActiveInsert(active, &active_num, &table->entries[i]);
+		}
+	}
+	for (y = y0; y <= y1; y++) {
+		if (y > y0) {
+			int end = table->buckets[y - table->y0 + 1];
+			for (; next < end; next++) {
+				MGL_ActiveInsert(active, &active_num, &table->entries[next]);
+			}
+		}
+		for (i = 0, k = 0; i < active_num; i++) {
+			MGL_RenderObj(active[i]->obj, data, x0, x1, y);
+			if (active[i]->y2 > y) {
+				active[k++] = active[i];
+			}
+		}
+		active_num = k;
+		data += (x1 - x0) + 1;
+	}
+}
+
+//Отрисовывает в буфер объекты таблицы кадра, попавшие в окно вывода
+void MGL_RenderTableObjects(MGL_RENDER_TABLE *table, int x0, int y0, int x1, int y1, uint16_t *data)
+{
+	MGL_RenderTableSlot(table, 0, x0, y0, x1, y1, data);
+}
+
+//Полоса строк окна вывода - задание для исполнителя планировщика
+typedef struct {
+	MGL_OBJ *obj;				//список объектов
+	MGL_RENDER_TABLE *table;	//либо таблица объектов кадра (obj = table = 0 - команда на завершение исполнителя)
+	int slot;					//номер списка активных объектов таблицы для полосы
+	int x0, y0, x1, y1;			//окно полосы
+	uint16_t *data;				//буфер полосы
+} MGL_RENDER_BAND;
+
+struct MGL_RENDER_SCHEDULER_ {
+	int workers_num;			//количество исполнителей
+	QueueHandle_t bands;		//очередь полос
+	SemaphoreHandle_t done;		//барьер завершения: отдается исполнителем по каждой полосе
+	SemaphoreHandle_t lock;		//мьютекс отрисовки: окна вызывающих задач отрисовываются по очереди
+};
+
+//Задача-исполнитель планировщика
+static void MGL_RenderWorker(void *param)
+{
+	MGL_RENDER_SCHEDULER *sched = (MGL_RENDER_SCHEDULER *)param;
+	MGL_RENDER_BAND band;
+	while (1) {
+		xQueueReceive(sched->bands, &band, portMAX_DELAY);
+		if (band.table) {
+			MGL_RenderTableSlot(band.table, band.slot, band.x0, band.y0, band.x1, band.y1, band.data);
+		}
+		else if (band.obj) {
+			MGL_RenderObjects(band.obj, band.x0, band.y0, band.x1, band.y1, band.data);
+		}
+		else break;
+		xSemaphoreGive(sched->done);
+	}
+	xSemaphoreGive(sched->done);
+	vTaskDelete(NULL);
+}
+
+//Создает планировщик отрисовки и запускает задачи-исполнители
+MGL_RENDER_SCHEDULER* MGL_RenderSchedulerCreate(int workers_num, uint32_t stack_size, uint32_t priority)
+{
+	if (workers_num <= 0) return 0;
+	MGL_RENDER_SCHEDULER *sched = (MGL_RENDER_SCHEDULER *)calloc(1, sizeof(MGL_RENDER_SCHEDULER));
+	if (!sched) return 0;
+	sched->bands = xQueueCreate(workers_num, sizeof(MGL_RENDER_BAND));
+	sched->done = xSemaphoreCreateCounting(workers_num, 0);
+	sched->lock = xSemaphoreCreateMutex();
+	if (!sched->bands || !sched->done || !sched->lock) {
+		if (sched->bands) vQueueDelete(sched->bands);
+		if (sched->done) vSemaphoreDelete(sched->done);
+		if (sched->lock) vSemaphoreDelete(sched->lock);
+		free(sched);
+		return 0;
+	}
+	for (int i = 0; i < workers_num; i++) {
+		if (xTaskCreatePinnedToCore(MGL_RenderWorker, "mgl_render", stack_size, (void*)sched, priority, NULL, i % portNUM_PROCESSORS) != pdPASS) {
+			break;
+		}
+		sched->workers_num++;
+	}
+	if (!sched->workers_num) {
+		MGL_RenderSchedulerDelete(sched);
+		return 0;
+	}
+	return sched;
+}
+
+//Завершает задачи-исполнители и удаляет планировщик
+void MGL_RenderSchedulerDelete(MGL_RENDER_SCHEDULER *sched)
+{
+	if (!sched) return;
+	MGL_RENDER_BAND band = { 0 };
+	for (int i = 0; i < sched->workers_num; i++) {
+		xQueueSend(sched->bands, &band, portMAX_DELAY);
+	}
+	for (int i = 0; i < sched->workers_num; i++) {
+		xSemaphoreTake(sched->done, portMAX_DELAY);
+	}
+	vQueueDelete(sched->bands);
+	vSemaphoreDelete(sched->done);
+	vSemaphoreDelete(sched->lock);
+	free(sched);
+}
+
+//Делит строки окна вывода на полосы по числу исполнителей, но не более числа списков активных объектов таблицы
+//(первые полосы на строку длиннее при неравном делении)
+//и ставит полосы в очередь. Свободный исполнитель забирает очередную полосу, вызывающая задача ожидает
+//на барьере завершения всех полос. Барьер общий, поэтому окна разных задач отрисовываются по очереди.
+static void MGL_RenderSchedulerBands(MGL_RENDER_SCHEDULER *sched, MGL_OBJ *obj, MGL_RENDER_TABLE *table,
+									 int x0, int y0, int x1, int y1, uint16_t *data)
+{
+	int lines = y1 - y0 + 1;
+	int w = x1 - x0 + 1;
+	int bands_num = lines < sched->workers_num ? lines : sched->workers_num;
+	if (table && bands_num > table->slots) bands_num = table->slots;
+	MGL_RENDER_BAND band = { .obj = obj, .table = table, .x0 = x0, .x1 = x1, .y0 = y0, .data = data };
+	xSemaphoreTake(sched->lock, portMAX_DELAY);
+	for (int i = 0; i < bands_num; i++) {
+		int band_lines = lines / bands_num + (i < lines % bands_num ? 1 : 0);
+		band.slot = i;
+		band.y1 = band.y0 + band_lines - 1;
+		xQueueSend(sched->bands, &band, portMAX_DELAY);
+		band.y0 += band_lines;
+		band.data += band_lines * w;
+	}
+	for (int i = 0; i < bands_num; i++) {
+		xSemaphoreTake(sched->done, portMAX_DELAY);
+	}
+	xSemaphoreGive(sched->lock);
+}
+
+//Отрисовывает в буфер окно вывода силами исполнителей планировщика
+void MGL_RenderSchedulerRender(MGL_RENDER_SCHEDULER *sched, MGL_OBJ *obj, int x0, int y0, int x1, int y1, uint16_t *data)
+{
+	if (!sched || !obj || y1 <= y0) {
+		MGL_RenderObjects(obj, x0, y0, x1, y1, data);
+		return;
+	}
+	MGL_RenderSchedulerBands(sched, obj, 0, x0, y0, x1, y1, data);
+}
+
+//Отрисовывает в буфер окно вывода объектами таблицы кадра силами исполнителей планировщика
+void MGL_RenderSchedulerRenderTable(MGL_RENDER_SCHEDULER *sched, MGL_RENDER_TABLE *table, int x0, int y0, int x1, int y1, uint16_t *data)
+{
+	if (!sched || y1 <= y0) {
+		MGL_RenderTableObjects(table, x0, y0, x1, y1, data);
+		return;
+	}
+	MGL_RenderSchedulerBands(sched, 0, table, x0, y0, x1, y1, data);
+}
+
 //Перемещает объект на расстояние по оси x на dx, по оси y на dy
 void MGL_ObjectMove(MGL_OBJ *obj, int dx, int dy)
 {
@@ -1111,6 +1467,7 @@ void MGL_ObjectMove(MGL_OBJ *obj, int dx, int dy)
 		default:
 			break;
 	}
+	obj->dirty = 1;
 }
 
 //Перемещает все объекты в списке на расстояние по оси x на dx, по оси y на dy
@@ -1132,3 +1489,99 @@ void MGL_ObjectListTransparency(MGL_OBJ *obj_list, uint8_t tr)
 	}
 }
 
+//Помечает объект как измененный
+inline void MGL_ObjectInvalidate(MGL_OBJ *obj)
+{
+	obj->dirty = 1;
+}
+
+//Инициализирует области перерисовки
+void MGL_DirtyInit(MGL_DIRTY *dirty, int x1, int y1, int x2, int y2)
+{
+	dirty->clip.x1 = x1;
+	dirty->clip.y1 = y1;
+	dirty->clip.x2 = x2;
+	dirty->clip.y2 = y2;
+	dirty->rects_num = 0;
+}
+
+//Очищает список прямоугольников перерисовки
+inline void MGL_DirtyReset(MGL_DIRTY *dirty)
+{
+	dirty->rects_num = 0;
+}
+
+//Площадь прямоугольника, объединяющего прямоугольник r и прямоугольник x1, y1, x2, y2
+static inline int MGL_RectUnionArea(MGL_RECT *r, int x1, int y1, int x2, int y2)
+{
+	return (max(r->x2, x2) - min(r->x1, x1) + 1) * (max(r->y2, y2) - min(r->y1, y1) + 1);
+}
+
+//Добавляет прямоугольник перерисовки
+void MGL_DirtyAddRect(MGL_DIRTY *dirty, int x1, int y1, int x2, int y2)
+{
+	x1 = max(x1, dirty->clip.x1);
+	y1 = max(y1, dirty->clip.y1);
+	x2 = min(x2, dirty->clip.x2);
+	y2 = min(y2, dirty->clip.y2);
+	if (x1 > x2 || y1 > y2) return;
+	MGL_RECT *r;
+	int i, best = -1, best_area = 0, area;
+	//прямоугольник, пересекающийся или соприкасающийся с уже добавленным, объединяется с ним,
+	//а объединение добавляется заново, т.к. может задеть другие прямоугольники
+	for (i = 0; i < dirty->rects_num; i++) {
+		r = &dirty->rects[i];
+		if (x1 <= r->x2 + 1 && x2 >= r->x1 - 1 && y1 <= r->y2 + 1 && y2 >= r->y1 - 1) {
+			best = i;
+			break;
+		}
+	}
+	//нет места - объединение с прямоугольником, дающим наименьший прирост площади
+	if (best < 0 && dirty->rects_num == MGL_DIRTY_RECTS_MAX) {
+		for (i = 0; i < dirty->rects_num; i++) {
+			r = &dirty->rects[i];
+			area = MGL_RectUnionArea(r, x1, y1, x2, y2) - (r->x2 - r->x1 + 1) * (r->y2 - r->y1 + 1);
+			if (best < 0 || area < best_area) {
+				best = i;
+				best_area = area;
+			}
+		}
+	}
+	if (best >= 0) {
+		r = &dirty->rects[best];
+		x1 = min(x1, r->x1);
+		y1 = min(y1, r->y1);
+		x2 = max(x2, r->x2);
+		y2 = max(y2, r->y2);
+		dirty->rects[best] = dirty->rects[--dirty->rects_num];
+		MGL_DirtyAddRect(dirty, x1, y1, x2, y2);
+		return;
+	}
+	r = &dirty->rects[dirty->rects_num++];
+	r->x1 = x1;
+	r->y1 = y1;
+	r->x2 = x2;
+	r->y2 = y2;
+}
+
+//Добавляет прежнюю и текущую области измененных объектов списка
+int MGL_DirtyCollect(MGL_DIRTY *dirty, MGL_OBJ *obj_list)
+{
+	MGL_RECT rect;
+	while (obj_list) {
+		if (obj_list->dirty) {
+			if (obj_list->drawn) {
+				MGL_DirtyAddRect(dirty, obj_list->drawn_rect.x1, obj_list->drawn_rect.y1,
+										obj_list->drawn_rect.x2, obj_list->drawn_rect.y2);
+			}
+			obj_list->drawn = MGL_ObjectGetBounds(obj_list, &rect.x1, &rect.y1, &rect.x2, &rect.y2);
+			if (obj_list->drawn) {
+				obj_list->drawn_rect = rect;
+				MGL_DirtyAddRect(dirty, rect.x1, rect.y1, rect.x2, rect.y2);
+			}
+			obj_list->dirty = 0;
+		}
+		obj_list = (MGL_OBJ *)obj_list->next;
+	}
+	return dirty->rects_num;
+}
@@ -0,0 +1,15 @@
+/*
+ *  Хост-сборка (Linux): заглушки атрибутов размещения ESP-IDF
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_ESP_ATTR_H_
+#define HOST_ESP_ATTR_H_
+
+//на хосте нет IRAM/DRAM - атрибуты размещения игнорируются
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define WORD_ALIGNED_ATTR	__attribute__((aligned(4)))
+
+#endif /* HOST_ESP_ATTR_H_ */
@@ -0,0 +1,17 @@
+/*
+ *  Хост-сборка (Linux): коды ошибок ESP-IDF
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_ESP_ERR_H_
+#define HOST_ESP_ERR_H_
+
+typedef int esp_err_t;
+
+#define ESP_OK				0
+#define ESP_FAIL			-1
+#define ESP_ERR_NO_MEM		0x101
+#define ESP_ERR_INVALID_ARG	0x102
+
+#endif /* HOST_ESP_ERR_H_ */
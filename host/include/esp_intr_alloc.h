@@ -0,0 +1,25 @@
+/*
+ *  Хост-сборка (Linux): регистрация обработчиков прерываний
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_ESP_INTR_ALLOC_H_
+#define HOST_ESP_INTR_ALLOC_H_
+
+#include "esp_err.h"
+
+#define ESP_INTR_FLAG_LEVEL1	(1 << 1)
+#define ESP_INTR_FLAG_LOWMED	(ESP_INTR_FLAG_LEVEL1 | (1 << 2) | (1 << 3))
+#define ESP_INTR_FLAG_IRAM		(1 << 10)
+
+#define ETS_SPI2_INTR_SOURCE	30
+#define ETS_SPI3_INTR_SOURCE	31
+
+typedef void (*intr_handler_t)(void *arg);
+typedef struct intr_handle_data_t *intr_handle_t;
+
+//обработчик вызывается симулятором SPI по завершении транзакции при разрешенном прерывании
+esp_err_t esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *ret_handle);
+
+#endif /* HOST_ESP_INTR_ALLOC_H_ */
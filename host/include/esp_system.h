@@ -0,0 +1,17 @@
+/*
+ *  Хост-сборка (Linux): системные определения ESP-IDF
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_ESP_SYSTEM_H_
+#define HOST_ESP_SYSTEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_intr_alloc.h"
+
+#endif /* HOST_ESP_SYSTEM_H_ */
@@ -0,0 +1,15 @@
+/*
+ *  Хост-сборка (Linux): таймер высокого разрешения ESP-IDF
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_ESP_TIMER_H_
+#define HOST_ESP_TIMER_H_
+
+#include <stdint.h>
+
+//время монотонных часов, мкс (на кристалле - от запуска)
+int64_t esp_timer_get_time(void);
+
+#endif /* HOST_ESP_TIMER_H_ */
@@ -0,0 +1,53 @@
+/*
+ *  Хост-сборка (Linux): минимальная прослойка FreeRTOS поверх POSIX threads
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int32_t		BaseType_t;
+typedef uint32_t	UBaseType_t;
+typedef uint32_t	TickType_t;
+typedef uint32_t	StackType_t;
+
+#define configTICK_RATE_HZ		100		//как CONFIG_FREERTOS_HZ в sdkconfig
+#define portNUM_PROCESSORS		2
+#define portTICK_PERIOD_MS		((TickType_t)1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY			((TickType_t)0xFFFFFFFFUL)
+#define pdMS_TO_TICKS(ms)		((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+#define pdFALSE		((BaseType_t)0)
+#define pdTRUE		((BaseType_t)1)
+#define pdPASS		pdTRUE
+#define pdFAIL		pdFALSE
+
+#define tskNO_AFFINITY	((BaseType_t)0x7FFFFFFF)
+
+#define portYIELD_FROM_ISR(x)	((void)(x))
+
+//поток выполняет обработчик прерывания симулятора
+BaseType_t xPortInIsrContext(void);
+
+//критическая секция: спин-блокировка (прерывания симулятора не запрещаются, поэтому
+//внутри критической секции нельзя писать в регистры периферии)
+typedef struct {
+	volatile int lock;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED	{ 0 }
+#define portMUX_INITIALIZE(mux)			((mux)->lock = 0)
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux)			vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)			vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux)		vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux)		vPortExitCritical(mux)
+
+#endif /* HOST_FREERTOS_H_ */
@@ -0,0 +1,32 @@
+/*
+ *  Хост-сборка (Linux): очереди FreeRTOS
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_FREERTOS_QUEUE_H_
+#define HOST_FREERTOS_QUEUE_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct QueueDefinition *QueueHandle_t;
+
+#define queueSEND_TO_BACK		((BaseType_t)0)
+#define queueSEND_TO_FRONT		((BaseType_t)1)
+
+//очередь с элементами нулевого размера используется как семафор (как и во FreeRTOS)
+QueueHandle_t xQueueGenericCreate(UBaseType_t length, UBaseType_t item_size, uint32_t initial_count);
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait, BaseType_t position);
+BaseType_t xQueueGenericSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_task_woken, BaseType_t position);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+void vQueueDelete(QueueHandle_t queue);
+
+#define xQueueCreate(length, item_size)					xQueueGenericCreate(length, item_size, 0)
+#define xQueueSend(queue, item, ticks)					xQueueGenericSend(queue, item, ticks, queueSEND_TO_BACK)
+#define xQueueSendToBack(queue, item, ticks)			xQueueGenericSend(queue, item, ticks, queueSEND_TO_BACK)
+#define xQueueSendToFront(queue, item, ticks)			xQueueGenericSend(queue, item, ticks, queueSEND_TO_FRONT)
+#define xQueueSendFromISR(queue, item, woken)			xQueueGenericSendFromISR(queue, item, woken, queueSEND_TO_BACK)
+#define xQueueSendToBackFromISR(queue, item, woken)		xQueueGenericSendFromISR(queue, item, woken, queueSEND_TO_BACK)
+
+#endif /* HOST_FREERTOS_QUEUE_H_ */
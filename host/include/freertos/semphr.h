@@ -0,0 +1,23 @@
+/*
+ *  Хост-сборка (Linux): семафоры FreeRTOS
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_FREERTOS_SEMPHR_H_
+#define HOST_FREERTOS_SEMPHR_H_
+
+#include "freertos/queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define xSemaphoreCreateCounting(max_count, initial_count)	xQueueGenericCreate(max_count, 0, initial_count)
+#define xSemaphoreCreateBinary()							xQueueGenericCreate(1, 0, 0)
+#define xSemaphoreCreateMutex()								xQueueGenericCreate(1, 0, 1)
+#define xSemaphoreTake(sem, ticks)							xQueueReceive(sem, NULL, ticks)
+#define xSemaphoreGive(sem)									xQueueGenericSend(sem, NULL, 0, queueSEND_TO_BACK)
+#define xSemaphoreGiveFromISR(sem, woken)					xQueueGenericSendFromISR(sem, NULL, woken, queueSEND_TO_BACK)
+#define uxSemaphoreGetCount(sem)							uxQueueMessagesWaiting(sem)
+#define vSemaphoreDelete(sem)								vQueueDelete(sem)
+
+#endif /* HOST_FREERTOS_SEMPHR_H_ */
@@ -0,0 +1,37 @@
+/*
+ *  Хост-сборка (Linux): задачи FreeRTOS
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *  Каждая задача - отдельный поток POSIX. Номер ядра запоминается и возвращается
+ *  xPortGetCoreID(), приоритеты игнорируются. Поток, созданный не через xTaskCreate
+ *  (например, main), получает дескриптор задачи при первом вызове xTaskGetCurrentTaskHandle().
+ */
+
+#ifndef HOST_FREERTOS_TASK_H_
+#define HOST_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct tskTaskControlBlock *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth,
+								   void *param, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xPortGetCoreID(void);
+
+//уведомления задач (один счетчик на задачу)
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
+
+#define taskYIELD()		vTaskDelay(0)
+
+#define xTaskCreate(task, name, stack_depth, param, priority, created_task) \
+	xTaskCreatePinnedToCore(task, name, stack_depth, param, priority, created_task, tskNO_AFFINITY)
+
+#endif /* HOST_FREERTOS_TASK_H_ */
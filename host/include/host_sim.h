@@ -0,0 +1,44 @@
+/*
+ *  Хост-сборка (Linux): модель шины SPI и дисплея
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *  Драйвер дисплея работает с регистрами SPI/GPIO так же, как на кристалле. Запись в регистры
+ *  перехватывается симулятором, транзакции (в том числе с DMA) исполняются сразу, а байты,
+ *  попавшие на шину, разбираются моделью контроллера дисплея (CASET/RASET/RAMWR/MADCTL)
+ *  и складываются в его память (GRAM). Время занятости шины считается по настройкам
+ *  делителя частоты SPI.
+ */
+
+#ifndef HOST_SIM_H_
+#define HOST_SIM_H_
+
+#include <stdint.h>
+#include "soc/spi_struct.h"
+
+//статистика шины SPI
+typedef struct {
+	uint64_t transactions;		//всего транзакций
+	uint64_t dma_transactions;	//из них с DMA
+	uint64_t cmd_bytes;			//байт команд (DC = 0)
+	uint64_t data_bytes;		//байт данных (DC = 1)
+	uint64_t windows;			//установок окна вывода (команд CASET)
+	uint64_t pixels;			//пикселей, записанных в GRAM
+	uint64_t interrupts;		//вызовов обработчика прерывания
+	uint64_t bus_time_ns;		//расчетное время занятости шины, нс
+} SIM_SpiStats;
+
+typedef struct SIM_Panel SIM_Panel;
+
+//подключает к шине spi модель контроллера дисплея с GRAM размером width_controller x height_controller
+//cs_pin < 0 - дисплей выбран всегда
+SIM_Panel* SIM_PanelAttach(spi_dev_t *spi, int cs_pin, int dc_pin, uint16_t width_controller, uint16_t height_controller);
+//возвращает цвет точки GRAM в формате R5G6B5
+uint16_t SIM_PanelGetPixel(SIM_Panel *panel, uint16_t x, uint16_t y);
+//сохраняет область GRAM в файл формата PPM (P6), возвращает 0 при успехе
+int SIM_PanelSavePPM(SIM_Panel *panel, uint16_t x, uint16_t y, uint16_t w, uint16_t h, const char *path);
+//статистика шины
+void SIM_SpiGetStats(spi_dev_t *spi, SIM_SpiStats *stats);
+void SIM_SpiResetStats(spi_dev_t *spi);
+
+#endif /* HOST_SIM_H_ */
@@ -0,0 +1,68 @@
+/*
+ *  Хост-сборка (Linux): структура регистров GPIO ESP32
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_SOC_GPIO_STRUCT_H_
+#define HOST_SOC_GPIO_STRUCT_H_
+
+#include <stdint.h>
+#include "soc/soc.h"
+
+typedef volatile struct gpio_dev_s {
+	uint32_t bt_select;
+	uint32_t out;							//состояние выходов 0 - 31
+	uint32_t out_w1ts;						//запись 1 устанавливает бит в out
+	uint32_t out_w1tc;						//запись 1 сбрасывает бит в out
+	union {
+		struct {
+			uint32_t data:      8;
+			uint32_t reserved8: 24;
+		};
+		uint32_t val;
+	} out1;									//состояние выходов 32 - 39
+	union {
+		struct {
+			uint32_t data:      8;
+			uint32_t reserved8: 24;
+		};
+		uint32_t val;
+	} out1_w1ts;
+	union {
+		struct {
+			uint32_t data:      8;
+			uint32_t reserved8: 24;
+		};
+		uint32_t val;
+	} out1_w1tc;
+	uint32_t sdio_select;
+	uint32_t enable;
+	uint32_t enable_w1ts;
+	uint32_t enable_w1tc;
+	union {
+		struct {
+			uint32_t data:      8;
+			uint32_t reserved8: 24;
+		};
+		uint32_t val;
+	} enable1;
+	union {
+		struct {
+			uint32_t data:      8;
+			uint32_t reserved8: 24;
+		};
+		uint32_t val;
+	} enable1_w1ts;
+	union {
+		struct {
+			uint32_t data:      8;
+			uint32_t reserved8: 24;
+		};
+		uint32_t val;
+	} enable1_w1tc;
+} gpio_dev_t;
+
+#define GPIO	(*(gpio_dev_t *)DR_REG_GPIO_BASE)
+
+#endif /* HOST_SOC_GPIO_STRUCT_H_ */
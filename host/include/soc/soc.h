@@ -0,0 +1,19 @@
+/*
+ *  Хост-сборка (Linux): карта адресов периферии ESP32
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *  Симулятор отображает страницы регистров по тем же адресам, что и на кристалле.
+ */
+
+#ifndef HOST_SOC_H_
+#define HOST_SOC_H_
+
+#define DR_REG_PERIPH_BASE	0x3FF00000	//начало области периферии
+#define DR_REG_GPIO_BASE	0x3FF44000
+#define DR_REG_SPI2_BASE	0x3FF64000
+#define DR_REG_SPI3_BASE	0x3FF65000
+#define SOC_DRAM_LOW		0x3FF80000	//внутренняя память, доступная для DMA
+#define SOC_DRAM_HIGH		0x40000000
+
+#endif /* HOST_SOC_H_ */
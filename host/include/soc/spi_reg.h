@@ -0,0 +1,25 @@
+/*
+ *  Хост-сборка (Linux): биты регистров SPI ESP32, используемые драйвером
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_SOC_SPI_REG_H_
+#define HOST_SOC_SPI_REG_H_
+
+#include "soc/soc.h"
+
+//SPI_USER_REG
+#define SPI_DOUTDIN				(1UL << 0)
+#define SPI_USR_MOSI			(1UL << 27)
+
+//SPI_DMA_CONF_REG
+#define SPI_IN_RST				(1UL << 2)
+#define SPI_OUT_RST				(1UL << 3)
+#define SPI_AHBM_FIFO_RST		(1UL << 4)
+#define SPI_AHBM_RST			(1UL << 5)
+#define SPI_OUT_EOF_MODE		(1UL << 9)
+#define SPI_OUTDSCR_BURST_EN	(1UL << 10)
+#define SPI_OUT_DATA_BURST_EN	(1UL << 12)
+
+#endif /* HOST_SOC_SPI_REG_H_ */
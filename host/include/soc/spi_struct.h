@@ -0,0 +1,118 @@
+/*
+ *  Хост-сборка (Linux): структура регистров SPI ESP32
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *  Описаны только регистры, к которым обращается драйвер. Имена полей и разрядность
+ *  совпадают с soc/spi_struct.h из ESP-IDF, поэтому драйвер компилируется без изменений.
+ */
+
+#ifndef HOST_SOC_SPI_STRUCT_H_
+#define HOST_SOC_SPI_STRUCT_H_
+
+#include <stdint.h>
+#include "soc/soc.h"
+
+typedef volatile struct spi_dev_s {
+	union {
+		struct {
+			uint32_t reserved0:     18;
+			uint32_t usr:            1;		//запуск транзакции, сбрасывается по ее завершении
+			uint32_t reserved19:    13;
+		};
+		uint32_t val;
+	} cmd;
+	union {
+		struct {
+			uint32_t reserved0:     26;
+			uint32_t wr_bit_order:   1;
+			uint32_t rd_bit_order:   1;
+			uint32_t reserved28:     4;
+		};
+		uint32_t val;
+	} ctrl;
+	union {
+		struct {
+			uint32_t setup_time:     4;
+			uint32_t hold_time:      4;
+			uint32_t reserved8:     24;
+		};
+		uint32_t val;
+	} ctrl2;
+	union {
+		struct {
+			uint32_t clkcnt_l:       6;
+			uint32_t clkcnt_h:       6;
+			uint32_t clkcnt_n:       6;
+			uint32_t clkdiv_pre:    13;
+			uint32_t clk_equ_sysclk: 1;
+		};
+		uint32_t val;
+	} clock;
+	union {
+		struct {
+			uint32_t doutdin:           1;
+			uint32_t reserved1:         6;
+			uint32_t ck_out_edge:       1;
+			uint32_t reserved8:        17;
+			uint32_t usr_mosi_highpart: 1;	//данные MOSI берутся из data_buf[8] - data_buf[15]
+			uint32_t reserved26:        1;
+			uint32_t usr_mosi:          1;
+			uint32_t reserved28:        4;
+		};
+		uint32_t val;
+	} user;
+	union {
+		struct {
+			uint32_t usr_mosi_dbitlen: 24;	//длина данных фазы MOSI в битах минус 1
+			uint32_t reserved24:        8;
+		};
+		uint32_t val;
+	} mosi_dlen;
+	union {
+		struct {
+			uint32_t reserved0:     29;
+			uint32_t ck_idle_edge:   1;
+			uint32_t reserved30:     2;
+		};
+		uint32_t val;
+	} pin;
+	union {
+		struct {
+			uint32_t reserved0:      4;
+			uint32_t trans_done:     1;		//статус прерывания "транзакция завершена"
+			uint32_t reserved5:      4;
+			uint32_t trans_inten:    1;		//разрешение прерывания "транзакция завершена"
+			uint32_t reserved10:    22;
+		};
+		uint32_t val;
+	} slave;
+	uint32_t data_buf[16];					//буфер данных W0 - W15
+	union {
+		struct {
+			uint32_t st:             3;
+			uint32_t reserved3:     29;
+		};
+		uint32_t val;
+	} ext2;
+	union {
+		uint32_t val;
+	} dma_conf;
+	union {
+		struct {
+			uint32_t addr:          20;		//младшие 20 бит адреса первого дескриптора
+			uint32_t reserved20:     8;
+			uint32_t stop:           1;
+			uint32_t start:          1;
+			uint32_t restart:        1;
+			uint32_t reserved31:     1;
+		};
+		uint32_t val;
+	} dma_out_link;
+	uint32_t dma_rx_status;
+} spi_dev_t;
+
+#define SPI2	(*(spi_dev_t *)DR_REG_SPI2_BASE)
+#define SPI3	(*(spi_dev_t *)DR_REG_SPI3_BASE)
+
+#endif /* HOST_SOC_SPI_STRUCT_H_ */
@@ -0,0 +1,1112 @@
+/*
+ *  Host (Linux) build of the display driver, MicroGL2D and JPEG decoder
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *  The components are compiled unchanged against a simulated SPI/DMA peripheral (see host/sim).
+ *  The program decodes a JPEG picture (from memory and from the file) and renders frames of the MicroGL2D demo scene,
+ *  prints CPU time and SPI bus statistics for every stage and saves the display memory
+ *  to PPM files. With -r the saved pictures are compared pixel-for-pixel with reference files.
+ *
+ *  Usage: lcd_host [-f frames] [-j file.jpg] [-o out_prefix] [-r ref_prefix]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "soc/spi_reg.h"
+#include "soc/spi_struct.h"
+#include "soc/gpio_struct.h"
+#include "host_sim.h"
+
+//--------------------------------------------- User defines ---------------------------------------------
+#define CS_PIN   		17		/* -1 if not used */
+#define DC_PIN   		21
+#define RST_PIN  		19
+#define BCKL_PIN 		5
+#define SPI_			SPI3
+#define DMA_ch			1 		/* DMA channel 1 or 2, 0 - if DMA not used */
+#define HI_SPEED				/* if uncommented f_clk spi = 80 MHz, else 40 MHz */
+#define RENDER_USE_TWO_CORES 	/* Use two (simulated) cores for graphics rendering. */
+#define RENDER_BUFFER_LINES		8
+//--------------------------------------------------------------------------------------------------------
+
+#include "display.h"
+#include "st7789.h"
+#include "microgl2d.h"
+#include "textures.h"
+#include "jpeg_chan.h"
+#include "avi.h"
+
+static uint16_t *render_buf1, *render_buf2; //render buffers
+
+#ifdef RENDER_USE_TWO_CORES
+static MGL_RENDER_SCHEDULER *render_sched; //render workers pinned to cores 0 and 1
+#else
+#define render_sched	NULL
+#endif
+static MGL_RENDER_TABLE *render_table; //objects of the frame bucketed by their top line
+
+static void Render2D (LCD_Handler *lcd, MGL_OBJ *obj, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, int x_c, int y_c)
+{
+	int lines = y1 - y0 + 1;
+	uint32_t w = x1 - x0 + 1;
+	uint16_t *render_ptr = render_buf1;
+	int buffers = render_buf2 ? 2 : 1;
+	int queued = 0; //bands queued for output and not yet sent
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	//a buffer holds RENDER_BUFFER_LINES full lines: narrow windows are sent in taller bands
+	uint32_t band_lines = (RENDER_BUFFER_LINES * lcd->Width) / w;
+	//each band walks only the objects that cross its lines
+	uint8_t use_table = !MGL_RenderTablePrepare(render_table, obj, y_c, y_c + lines - 1);
+	//the window and the bands are sent from the SPI interrupt while the next band is being rendered
+	LCD_QueueSetActiveWindow(lcd, x0, y0, x1, y1);
+	uint32_t r_lines;
+	while (lines) {
+		r_lines = lines < band_lines ? lines : band_lines;
+		if (queued == buffers) { //wait until the oldest band is sent and its buffer is free
+			ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+			queued--;
+		}
+		if (use_table) {
+			MGL_RenderSchedulerRenderTable(render_sched, render_table, x_c, y_c, x_c + w - 1, y_c + r_lines - 1, render_ptr);
+		}
+		else {
+			MGL_RenderSchedulerRender(render_sched, obj, x_c, y_c, x_c + w - 1, y_c + r_lines - 1, render_ptr);
+		}
+		LCD_QueueWriteData(lcd, render_ptr, r_lines * w, LCD_QueueNotifyCallback, (void*)task);
+		queued++;
+		if (buffers == 2) {
+			render_ptr = (render_ptr == render_buf1) ? render_buf2 : render_buf1;
+		}
+		lines -= r_lines;
+		y_c += r_lines;
+	}
+	for (; queued; queued--) {
+		ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+	}
+}
+
+/* renders and sends only the areas of the screen changed since the previous call */
+static void Render2D_Dirty (LCD_Handler *lcd, MGL_OBJ *obj, MGL_DIRTY *dirty)
+{
+	MGL_DirtyCollect(dirty, obj);
+	for (int i = 0; i < dirty->rects_num; i++) {
+		MGL_RECT *r = &dirty->rects[i];
+		Render2D(lcd, obj, r->x1, r->y1, r->x2, r->y2, r->x1, r->y1);
+	}
+	MGL_DirtyReset(dirty);
+}
+
+/* The demo scene of main.c: objects and animation state */
+typedef struct {
+	MGL_OBJ *rect, *obj1, *slider, *slider1, *text, *text1, *img_obj, *loshad, *melnica;
+	MGL_GRADIENT *grad_fon;
+	MGL_TEXTURE texture, melnica_tex, loshad_tex;
+	int z, z1, z2, z3, z4, z5, z6, step_z6, zz1, zz2;
+	uint32_t counter;
+} demo_scene;
+
+static void Scene_Create(LCD_Handler *lcd, demo_scene *s)
+{
+	//gradients
+	MGL_GRADIENT *grad1 = MGL_GradientCreate(MGL_GRADIENT_LINEAR);
+	MGL_GradientAddColor(grad1, 0,   COLOR_WHITE,    1);
+	MGL_GradientAddColor(grad1, 50,  COLOR_DARKGREY, 1);
+	MGL_GradientAddColor(grad1, 100, COLOR_WHITE,    1);
+	MGL_GradientSetDeg(grad1, 0);
+
+	MGL_GRADIENT *grad2 = MGL_GradientCreate(MGL_GRADIENT_LINEAR);
+	MGL_GradientAddColor(grad2, 0, COLOR_BLUE, 1);
+	MGL_GradientAddColor(grad2, 100, COLOR_WHITE, 1);
+	MGL_GradientSetDeg(grad2, 0);
+
+	MGL_GRADIENT *gradt = MGL_GradientCreate(MGL_GRADIENT_LINEAR);
+	MGL_GradientAddColor(gradt, 0, COLOR_BLUE, 1);
+	MGL_GradientAddColor(gradt, 100, COLOR_CYAN, 1);
+	MGL_GradientSetDeg(gradt, 0);
+
+	//backgroung
+	MGL_GRADIENT *grad_fon = MGL_GradientCreate(MGL_GRADIENT_LINEAR);
+	MGL_GradientSetDeg(grad_fon, 0);
+	MGL_GradientAddColor(grad_fon, 0,   0xFF0000, 1);
+	MGL_GradientAddColor(grad_fon, 25,  0x00FFFF, 1);
+	MGL_GradientAddColor(grad_fon, 40,  0xFFFFFF, 1);
+	MGL_GradientAddColor(grad_fon, 50,  0x00FF00, 1);
+	MGL_GradientAddColor(grad_fon, 60,  COLOR_ORANGE, 1);
+	MGL_GradientAddColor(grad_fon, 75,  0xFFFF00, 1);
+	MGL_GradientAddColor(grad_fon, 100, 0x0000FF, 1);
+	MGL_OBJ *rect = MGL_ObjectAdd(0, MGL_OBJ_TYPE_FILLRECTANGLE);
+	MGL_SetRectangle(rect, 0, 0, lcd->Width-1, lcd->Height-1, COLOR_WHITE);
+	MGL_ObjectSetGradient(rect, grad_fon);
+
+	//info window
+	MGL_OBJ *obj1 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_FILLRECTANGLE);
+	MGL_SetRectangle(obj1, 0, 0, 200, 14, COLOR_BLUE);
+	MGL_ObjectSetGradient(obj1, grad2);
+	MGL_OBJ *obj2 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_FILLRECTANGLE);
+	MGL_SetRectangle(obj2, 0, 14, 200, 100, COLOR_WHITE);
+	MGL_ObjectSetGradient(obj2, grad1);
+	MGL_ObjectSetTransparency(obj2, 50);
+	MGL_OBJ *obj3 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_FILLRECTANGLE);
+	MGL_SetRectangle(obj3, 200-12, 2, 200-4, 12, COLOR_RED);
+	MGL_OBJ *obj4 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_TEXT);
+	MGL_SetText(obj4, 200-12, 1, "X", &Font_8x13, 1, COLOR_WHITE);
+	MGL_OBJ *obj5 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_TEXT);
+	MGL_SetText(obj5, 4, 1, "Message", &Font_8x13, 0, COLOR_WHITE);
+	MGL_OBJ *obj6 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_TEXT);
+	MGL_SetText(obj6, 8, 20, "Hello, YouTube!", &Font_12x20, 1, COLOR_BLACK);
+	MGL_ObjectSetGradient(obj6, gradt);
+	MGL_OBJ *rect1 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_RECTANGLE);
+	MGL_SetRectangle(rect1, 0, 0, 200, 100, COLOR_BLACK);
+	MGL_OBJ *img_obj = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_FILLCIRCLE);
+	MGL_SetCircle(img_obj, 30, 70, 20, COLOR_WHITE);
+	s->texture = (MGL_TEXTURE){(MGL_IMAGE *)&image_avatar, 0, 0};
+	MGL_ObjectSetTexture(img_obj, &s->texture);
+
+	//horizontal slider
+	MGL_GRADIENT *grad3 = MGL_GradientCreate(MGL_GRADIENT_RADIAL);
+	MGL_GradientAddColor(grad3, 0, COLOR_WHITE, 1);
+	MGL_GradientAddColor(grad3, 100, COLOR_BLUE, 1);
+	MGL_GRADIENT *grad4 = MGL_GradientCreate(MGL_GRADIENT_LINEAR);
+	MGL_GradientAddColor(grad4, 0, COLOR_CYAN, 1);
+	MGL_GradientAddColor(grad4, 100, COLOR_RED, 1);
+	MGL_GradientSetDeg(grad4, 90);
+	MGL_GRADIENT *grad5 = MGL_GradientCreate(MGL_GRADIENT_LINEAR);
+	MGL_GradientAddColor(grad5, 0, COLOR_CYAN, 1);
+	MGL_GradientAddColor(grad5, 100, COLOR_RED, 1);
+	MGL_OBJ *slider = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_SLIDER);
+	MGL_SetSlider(slider, MGL_SLIDER_HORIZONTAL, 0, lcd->Height/2, lcd->Width - 20, lcd->Height/2 + 19, COLOR_LIGHTGREY, 0, 100, 50, "");
+	MGL_SetRectangle(((MGL_OBJ_SLIDER*)slider->object)->obj_rectangle1, 0, 0, 0, 0, COLOR_CYAN);
+	MGL_ObjectSetGradient(((MGL_OBJ_SLIDER*)slider->object)->obj_rectangle1, grad4);
+	MGL_SetRectangle(((MGL_OBJ_SLIDER*)slider->object)->obj_rectangle2, 0, 0, 0, 0, COLOR_DARKGREY);
+	MGL_ObjectSetGradient(((MGL_OBJ_SLIDER*)slider->object)->obj_circle, grad3);
+	//vertical slider
+	MGL_OBJ *slider1 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_SLIDER);
+	MGL_SetSlider(slider1, MGL_SLIDER_VERTICAL, lcd->Width - 20, 0, lcd->Width - 1, lcd->Height - 1, COLOR_LIGHTGREY, 0, 100, 100, "");
+	MGL_SetRectangle(((MGL_OBJ_SLIDER*)slider1->object)->obj_rectangle1, 0, 0, 0, 0, COLOR_CYAN);
+	MGL_ObjectSetGradient(((MGL_OBJ_SLIDER*)slider1->object)->obj_rectangle1, grad5);
+	MGL_SetRectangle(((MGL_OBJ_SLIDER*)slider1->object)->obj_rectangle2, 0, 0, 0, 0, COLOR_DARKGREY);
+	MGL_ObjectSetGradient(((MGL_OBJ_SLIDER*)slider1->object)->obj_circle, grad3);
+
+	//mill
+	s->melnica_tex = (MGL_TEXTURE){(MGL_IMAGE *)&image_melnica, 0, 0};
+	MGL_OBJ *melnica = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_FILLRECTANGLE);
+	MGL_SetRectangle(melnica, 0, 0, 60, 90, COLOR_RED);
+	MGL_ObjectSetTransparency(melnica, 0);
+	MGL_ObjectSetTexture(melnica, &s->melnica_tex);
+
+	//horse
+	s->loshad_tex = (MGL_TEXTURE){(MGL_IMAGE *)&image_loshad, 0, MGL_TEXTURE_FLIP_X};
+	MGL_OBJ *loshad = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_FILLCIRCLE);
+	MGL_SetCircle(loshad, 100, 60, 30, COLOR_RED);
+	MGL_ObjectSetTexture(loshad, &s->loshad_tex);
+
+	//text - copyright
+	MGL_GRADIENT *grad_cprt = MGL_GradientCreate(MGL_GRADIENT_LINEAR);
+	MGL_GradientAddColor(grad_cprt, 0, COLOR_WHITE, 1);
+	MGL_GradientAddColor(grad_cprt, 100, COLOR_BLUE, 1);
+	MGL_GradientSetDeg(grad_cprt, 45);
+	MGL_OBJ *text = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_TEXT);
+	MGL_SetText(text, (lcd->Width - 14*12)/2 - 1, (lcd->Height - 20)/2 - 1, "(c)2022 VadRov", &Font_12x20, 1, COLOR_RED);
+	MGL_ObjectSetGradient(text, grad_cprt);
+	MGL_OBJ *text1 = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_TEXT);
+	MGL_SetText(text1, (lcd->Width - 8*12)/2 - 1, (lcd->Height - 20)/2 + 20 - 1, "mGL Demo", &Font_12x20, 1, COLOR_WHITE);
+
+	//text "fps = ..." is constant here: the picture must not depend on the host speed
+	MGL_OBJ *fps = MGL_ObjectAdd(rect, MGL_OBJ_TYPE_TEXT);
+	MGL_SetText(fps, 0, lcd->Height - 21, "FPS = ", &Font_12x20, 0, COLOR_WHITE);
+
+	s->rect = rect; s->obj1 = obj1; s->slider = slider; s->slider1 = slider1;
+	s->text = text; s->text1 = text1; s->img_obj = img_obj; s->loshad = loshad; s->melnica = melnica;
+	s->grad_fon = grad_fon;
+	s->z = 1; s->z1 = 1; s->z2 = 1; s->z3 = 1; s->z4 = -2; s->z5 = -1; s->z6 = -1;
+	s->step_z6 = 0; s->zz1 = 1; s->zz2 = 1; s->counter = 0;
+}
+
+/* One step of the demo animation (the loop body of demo() in main.c) */
+static void Scene_Step(LCD_Handler *lcd, demo_scene *s)
+{
+	MGL_ObjectListMove(s->obj1, s->z, s->z1);
+	MGL_ObjectListMove(s->slider, -s->z, -s->z1);
+
+	if (((MGL_OBJ_RECTANGLE*)s->obj1->object)->x1 <= 0)   s->z = -s->z;
+	if (((MGL_OBJ_RECTANGLE*)s->obj1->object)->x2 >= lcd->Width - 1) s->z = -s->z;
+
+	if (((MGL_OBJ_RECTANGLE*)s->obj1->object)->y1 <= 0)   s->z1 = -s->z1;
+	if (((MGL_OBJ_RECTANGLE*)s->obj1->object)->y2 >= lcd->Height - 1 - 86) s->z1 = -s->z1;
+
+	MGL_ObjectMove(s->text, 0, -1);
+	MGL_ObjectMove(s->text1, 0, -1);
+	if (((MGL_OBJ_TEXT*)s->text1->object)->y < -30) {
+		((MGL_OBJ_TEXT*)s->text->object)->y = lcd->Height + 30;
+		((MGL_OBJ_TEXT*)s->text1->object)->y = lcd->Height + 50;
+		MGL_ObjectInvalidate(s->text);
+		MGL_ObjectInvalidate(s->text1);
+	}
+
+	((MGL_OBJ_CIRCLE*)s->img_obj->object)->r += s->z2;
+	if (((MGL_OBJ_CIRCLE*)s->img_obj->object)->r < 15 ||
+		((MGL_OBJ_CIRCLE*)s->img_obj->object)->r > 25)
+		s->z2 = -s->z2;
+
+	s->img_obj->texture->alpha += 10;
+	if (s->img_obj->texture->alpha > 360) s->img_obj->texture->alpha %= 360;
+	MGL_ObjectInvalidate(s->img_obj);
+
+	((MGL_OBJ_SLIDER*)s->slider->object)->value += s->z3;
+	if (((MGL_OBJ_SLIDER*)s->slider->object)->value <= 0 ||
+		((MGL_OBJ_SLIDER*)s->slider->object)->value >= 100)
+		s->z3 = -s->z3;
+	MGL_ObjectInvalidate(s->slider);
+
+	((MGL_OBJ_SLIDER*)s->slider1->object)->value += s->z4;
+	if (((MGL_OBJ_SLIDER*)s->slider1->object)->value <= 0 ||
+		((MGL_OBJ_SLIDER*)s->slider1->object)->value >= 100)
+		s->z4 = -s->z4;
+	MGL_ObjectInvalidate(s->slider1);
+
+	s->loshad_tex.alpha += s->z5;
+	if (!(s->counter % 5))  {
+		MGL_ObjectMove(s->loshad, -s->z5, 0);
+	}
+	if (s->loshad_tex.alpha == 20 ||
+		s->loshad_tex.alpha == -20) s->z5 = -s->z5;
+	MGL_ObjectInvalidate(s->loshad);
+
+	MGL_ObjectMove(s->melnica, s->zz1, s->zz2);
+	if (((MGL_OBJ_RECTANGLE*)s->melnica->object)->x1 < 0 ||
+		((MGL_OBJ_RECTANGLE*)s->melnica->object)->x1 > lcd->Width - 60)
+		s->zz1 = -s->zz1;
+	if (((MGL_OBJ_RECTANGLE*)s->melnica->object)->y1 < 0 ||
+		((MGL_OBJ_RECTANGLE*)s->melnica->object)->y1 > lcd->Height - 90)
+		s->zz2 = -s->zz2;
+
+	s->grad_fon->deg += 2;
+
+	s->counter++;
+
+	MGL_GRADIENT_POINT *points_list = s->grad_fon->points_list;
+	int f = 0;
+	while (points_list) {
+		if (f) {
+			if (points_list->next) {
+				points_list->offset += s->z6;
+			}
+		}
+		else {
+			f = 1;
+		}
+		points_list = (MGL_GRADIENT_POINT*)points_list->next;
+	}
+	MGL_GradientInvalidate(s->grad_fon);
+	s->step_z6++;
+	if (s->step_z6 > 20) {
+		s->step_z6 = 0;
+		s->z6 = -s->z6;
+	}
+	MGL_ObjectInvalidate(s->rect); //the background gradient changes every frame
+}
+
+/* The same scene with a still background: only the sliders, the mill and the text change */
+static void Scene_StepForeground(LCD_Handler *lcd, demo_scene *s)
+{
+	MGL_ObjectMove(s->text, 0, -1);
+	MGL_ObjectMove(s->text1, 0, -1);
+	if (((MGL_OBJ_TEXT*)s->text1->object)->y < -30) {
+		((MGL_OBJ_TEXT*)s->text->object)->y = lcd->Height + 30;
+		((MGL_OBJ_TEXT*)s->text1->object)->y = lcd->Height + 50;
+		MGL_ObjectInvalidate(s->text);
+		MGL_ObjectInvalidate(s->text1);
+	}
+
+	((MGL_OBJ_SLIDER*)s->slider1->object)->value += s->z4;
+	if (((MGL_OBJ_SLIDER*)s->slider1->object)->value <= 0 ||
+		((MGL_OBJ_SLIDER*)s->slider1->object)->value >= 100)
+		s->z4 = -s->z4;
+	MGL_ObjectInvalidate(s->slider1);
+
+	MGL_ObjectMove(s->melnica, s->zz1, s->zz2);
+	if (((MGL_OBJ_RECTANGLE*)s->melnica->object)->x1 < 0 ||
+		((MGL_OBJ_RECTANGLE*)s->melnica->object)->x1 > lcd->Width - 60)
+		s->zz1 = -s->zz1;
+	if (((MGL_OBJ_RECTANGLE*)s->melnica->object)->y1 < 0 ||
+		((MGL_OBJ_RECTANGLE*)s->melnica->object)->y1 > lcd->Height - 90)
+		s->zz2 = -s->zz2;
+}
+
+/*
+ * SPI initialization (registers of the simulated peripheral, as SPI_Init in main.c)
+ */
+static void SPI_Init (spi_dev_t *spi, uint32_t spi_mode, uint32_t dma_channel)
+{
+	if (dma_channel) {
+		esp_intr_alloc(spi == &SPI3 ? ETS_SPI3_INTR_SOURCE : ETS_SPI2_INTR_SOURCE, ESP_INTR_FLAG_LOWMED, LCD_TC_Callback, (void*)spi, NULL);
+	}
+	uint8_t polarity_modes[] = {0, 0, 0, 1, 1, 0, 1, 1};
+	spi->pin.ck_idle_edge = polarity_modes[2 * spi_mode];
+	spi->user.ck_out_edge = polarity_modes[2 * spi_mode + 1];
+	spi->slave.val = 0;
+	spi->ctrl.val = 0;
+	spi->user.val = SPI_USR_MOSI | SPI_DOUTDIN;
+	spi->ctrl2.val = 0;
+	//SPI clock 40 MHz
+	spi->clock.clk_equ_sysclk = 0;
+	spi->clock.clkdiv_pre = 0;
+	spi->clock.clkcnt_l = 1;
+	spi->clock.clkcnt_n = 1;
+	spi->clock.clkcnt_h = 0;
+}
+
+static void GPIO_Init (void)
+{
+	GPIO.out_w1ts = (1UL << CS_PIN) | (1UL << DC_PIN) | (1UL << RST_PIN);
+	GPIO.out_w1tc = 1UL << BCKL_PIN;
+}
+
+/* CPU time of the calling thread and of the whole process, us */
+typedef struct {
+	struct timespec wall, cpu;
+} stage_time;
+
+static void stage_begin(stage_time *t)
+{
+	clock_gettime(CLOCK_MONOTONIC, &t->wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t->cpu);
+	SIM_SpiResetStats(&SPI_);
+}
+
+static double ts_diff_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+static void stage_end(stage_time *t, const char *name, uint32_t repeat)
+{
+	struct timespec wall, cpu;
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	SIM_SpiStats st;
+	SIM_SpiGetStats(&SPI_, &st);
+	if (!repeat) repeat = 1;
+	printf("%-6s x%-4u wall %9.3f ms  cpu %9.3f ms | spi: %6.3f ms bus, %8llu bytes (%llu cmd), %6llu trans (%llu dma), %5llu windows, %8llu pixels, %llu irq  (per run)\n",
+		   name, repeat, ts_diff_ms(&t->wall, &wall) / repeat, ts_diff_ms(&t->cpu, &cpu) / repeat,
+		   st.bus_time_ns / 1e6 / repeat,
+		   (unsigned long long)((st.cmd_bytes + st.data_bytes) / repeat), (unsigned long long)(st.cmd_bytes / repeat),
+		   (unsigned long long)(st.transactions / repeat), (unsigned long long)(st.dma_transactions / repeat),
+		   (unsigned long long)(st.windows / repeat), (unsigned long long)(st.pixels / repeat),
+		   (unsigned long long)(st.interrupts / repeat));
+}
+
+static uint8_t* load_file(const char *path, uint32_t *size)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *data = (uint8_t *)malloc(len > 0 ? len : 1);
+	if (data && fread(data, 1, len, f) != (size_t)len) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	*size = (uint32_t)len;
+	return data;
+}
+
+/* Compares two PPM files, returns the number of different pixels or -1 on error */
+static long compare_ppm(const char *path1, const char *path2)
+{
+	uint32_t size1, size2;
+	uint8_t *p1 = load_file(path1, &size1), *p2 = load_file(path2, &size2);
+	long diff = -1;
+	if (p1 && p2 && size1 == size2) {
+		diff = 0;
+		uint32_t hdr = 0, nl = 0;
+		while (hdr < size1 && nl < 3) if (p1[hdr++] == '\n') nl++;
+		if (memcmp(p1, p2, hdr)) diff = -1;
+		else for (uint32_t i = hdr; i + 2 < size1; i += 3) {
+			if (memcmp(&p1[i], &p2[i], 3)) diff++;
+		}
+	}
+	free(p1);
+	free(p2);
+	return diff;
+}
+
+static int save_and_check(SIM_Panel *panel, LCD_Handler *lcd, const char *out_prefix, const char *ref_prefix, const char *name)
+{
+	char path[512], ref[512];
+	snprintf(path, sizeof(path), "%s_%s.ppm", out_prefix, name);
+	while (LCD_GetState(lcd) == LCD_STATE_BUSY) ;
+	if (SIM_PanelSavePPM(panel, lcd->x_offs, lcd->y_offs, lcd->Width, lcd->Height, path)) {
+		printf("%s: write error\n", path);
+		return 1;
+	}
+	if (!ref_prefix) return 0;
+	snprintf(ref, sizeof(ref), "%s_%s.ppm", ref_prefix, name);
+	long diff = compare_ppm(path, ref);
+	if (diff) {
+		printf("%s: %s %ld pixels differ from %s\n", name, diff < 0 ? "error," : "FAIL,", diff, ref);
+		return 1;
+	}
+	printf("%s: matches %s\n", name, ref);
+	return 0;
+}
+
+/* Compares the w x h area at (x1, y1) of the first PPM file with the area at (x2, y2) of the second one,
+   returns the number of different pixels or -1 on error */
+static long compare_ppm_area(const char *path1, int x1, int y1, const char *path2, int x2, int y2, int w, int h)
+{
+	uint32_t size1, size2;
+	uint8_t *p1 = load_file(path1, &size1), *p2 = load_file(path2, &size2);
+	long diff = -1;
+	int width1, width2;
+	uint32_t hdr1 = 0, hdr2 = 0, nl = 0;
+	if (p1 && p2 && sscanf((char *)p1, "P6 %d", &width1) == 1 && sscanf((char *)p2, "P6 %d", &width2) == 1) {
+		while (hdr1 < size1 && nl < 3) if (p1[hdr1++] == '\n') nl++;
+		nl = 0;
+		while (hdr2 < size2 && nl < 3) if (p2[hdr2++] == '\n') nl++;
+		diff = 0;
+		for (int j = 0; j < h && diff >= 0; j++) {
+			for (int i = 0; i < w; i++) {
+				uint32_t o1 = hdr1 + ((uint32_t)(y1 + j) * width1 + x1 + i) * 3;
+				uint32_t o2 = hdr2 + ((uint32_t)(y2 + j) * width2 + x2 + i) * 3;
+				if (o1 + 3 > size1 || o2 + 3 > size2) { diff = -1; break; }
+				if (memcmp(&p1[o1], &p2[o2], 3)) diff++;
+			}
+		}
+	}
+	free(p1);
+	free(p2);
+	return diff;
+}
+
+/* Decoding of a half of the picture by its own decoder instance */
+typedef struct {
+	JPEG_Decoder dec;
+	LCD_Handler *lcd;
+	iPicture_jpg file;
+	uint16_t x, w;
+	uint8_t rc;
+	SemaphoreHandle_t done;
+} jtwo_job;
+
+static void JPEG_HalfTask(void *param)
+{
+	jtwo_job *job = (jtwo_job *)param;
+	job->rc = LCD_Load_JPG_dec_rect(&job->dec, job->lcd, job->x, 0, job->w, job->lcd->Height, &job->file,
+									PICTURE_IN_MEMORY, job->x, 0, 0, NULL);
+	xSemaphoreGive(job->done);
+	vTaskDelete(NULL);
+}
+
+/* Compares two pictures saved by save_and_check */
+static int check_same(const char *out_prefix, const char *name1, const char *name2)
+{
+	char path1[512], path2[512];
+	snprintf(path1, sizeof(path1), "%s_%s.ppm", out_prefix, name1);
+	snprintf(path2, sizeof(path2), "%s_%s.ppm", out_prefix, name2);
+	long diff = compare_ppm(path1, path2);
+	if (diff) {
+		printf("%s: %s %ld pixels differ from %s\n", name1, diff < 0 ? "error," : "FAIL,", diff, path2);
+		return 1;
+	}
+	printf("%s: matches %s\n", name1, path2);
+	return 0;
+}
+
+/* Writes an MJPEG AVI file of the given number of copies of a JPEG picture.
+   The frames are listed in the idx1 index (offsets from the 'movi' label) when with_index is set */
+static void avi_put32(FILE *f, uint32_t v)
+{
+	uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+	fwrite(b, 1, 4, f);
+}
+
+static void avi_put_chunk(FILE *f, const char *id, uint32_t size)
+{
+	fwrite(id, 1, 4, f);
+	avi_put32(f, size);
+}
+
+static int write_test_avi(const char *path, const uint8_t *jpeg, uint32_t size, uint16_t w, uint16_t h,
+						  uint32_t frames, uint32_t us_per_frame, int with_index)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) return 1;
+	uint32_t chunk = 8 + size + (size & 1);
+	uint32_t movi_size = 4 + frames * chunk;
+	uint32_t hdrl_size = 4 + (8 + 56) + (8 + 4 + (8 + 56) + (8 + 40));
+	uint32_t idx1_size = with_index ? frames * 16 : 0;
+	avi_put_chunk(f, "RIFF", 4 + (8 + hdrl_size) + (8 + movi_size) + (with_index ? 8 + idx1_size : 0));
+	fwrite("AVI ", 1, 4, f);
+	avi_put_chunk(f, "LIST", hdrl_size);
+	fwrite("hdrl", 1, 4, f);
+	avi_put_chunk(f, "avih", 56);
+	uint32_t avih[14] = { us_per_frame, 0, 0, with_index ? 0x10 : 0, frames, 0, 1, size, w, h };
+	for (int i = 0; i < 14; i++) avi_put32(f, avih[i]);
+	avi_put_chunk(f, "LIST", 4 + (8 + 56) + (8 + 40));
+	fwrite("strl", 1, 4, f);
+	avi_put_chunk(f, "strh", 56);
+	fwrite("vidsMJPG", 1, 8, f);
+	uint32_t strh[12] = { 0, 0, 0, us_per_frame, 1000000, 0, frames, size, (uint32_t)-1, 0, 0, (uint32_t)h << 16 | w };
+	for (int i = 0; i < 12; i++) avi_put32(f, strh[i]);
+	avi_put_chunk(f, "strf", 40);
+	uint32_t strf[10] = { 40, w, h, 24 << 16 | 1, 0, (uint32_t)w * h * 3, 0, 0, 0, 0 };
+	memcpy(&strf[4], "MJPG", 4);
+	for (int i = 0; i < 10; i++) avi_put32(f, strf[i]);
+	avi_put_chunk(f, "LIST", movi_size);
+	fwrite("movi", 1, 4, f);
+	for (uint32_t i = 0; i < frames; i++) {
+		avi_put_chunk(f, "00dc", size);
+		fwrite(jpeg, 1, size, f);
+		if (size & 1) fputc(0, f);
+	}
+	if (with_index) {
+		avi_put_chunk(f, "idx1", idx1_size);
+		for (uint32_t i = 0; i < frames; i++) {
+			fwrite("00dc", 1, 4, f);
+			avi_put32(f, 0x10);
+			avi_put32(f, 4 + i * chunk);
+			avi_put32(f, size);
+		}
+	}
+	return fclose(f) ? 1 : 0;
+}
+
+/* Plays an AVI file on the whole display and prints the playback statistics */
+static int play_avi(LCD_Handler *lcd, const char *name, const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		printf("%s: %s: read error\n", name, path);
+		return 1;
+	}
+	JPEG_Decoder dec;
+	JPEG_Decoder_Init(&dec, NULL, 0, 1, NULL);
+	JD_TBLCACHE *tables = (JD_TBLCACHE*)heap_caps_malloc(sizeof(JD_TBLCACHE), MALLOC_CAP_8BIT);
+	jd_tblcache_init(tables);
+	JPEG_Decoder_SetTableCache(&dec, tables);
+	AVI_Player avi;
+	AVI_Stats st;
+	AVI_Result res = AVI_Open(&avi, f, &dec);
+	if (res == AVI_OK) res = AVI_Play(&avi, lcd, 0, 0, lcd->Width, lcd->Height, &st);
+	fclose(f);
+	if (res != AVI_OK) {
+		printf("%s: %s: player error %d\n", name, path, res);
+		AVI_Close(&avi);
+		heap_caps_free(tables);
+		return 1;
+	}
+	int fail = st.errors || st.shown + st.dropped + st.repeated != avi.frames_count;
+	printf("%s: %s%ux%u, %u frames at %.2f fps: %u shown, %u dropped, %u repeated, %u errors, %.2f fps sustained, "
+		   "%.3f ms max late, %.3f s, tables %u built, %u reused\n", name, fail ? "FAIL, " : "", avi.width, avi.height,
+		   avi.frames_count, avi.us_per_frame ? 1e6 / avi.us_per_frame : 0.0, st.shown, st.dropped, st.repeated, st.errors,
+		   st.time_us ? st.shown * 1e6 / st.time_us : 0.0, st.late_us / 1e3, st.time_us / 1e6,
+		   tables->misses, tables->hits);
+	AVI_Close(&avi);
+	heap_caps_free(tables);
+	return fail;
+}
+
+/* Builds a JPEG picture with a thumbnail in an Exif APP1 segment (exif = 1) or in a JFIF JFXX
+   APP0 extension (exif = 0): SOI, the thumbnail segment, then the picture after its SOI marker.
+   Returns the buffer allocated with malloc and the offset of the thumbnail in it */
+static uint8_t* make_thumb_jpeg(const uint8_t *jpeg, uint32_t jpeg_size, const uint8_t *thumb, uint32_t thumb_size,
+								int exif, uint32_t *size, uint32_t *thumb_offset)
+{
+	static const uint8_t tiff[44] = {
+		'I', 'I', 42, 0, 8, 0, 0, 0,						/* little endian, IFD0 at 8 */
+		0, 0, 14, 0, 0, 0,									/* IFD0: no entries, IFD1 at 14 */
+		2, 0,												/* IFD1: 2 entries */
+		0x01, 0x02, 4, 0, 1, 0, 0, 0, 44, 0, 0, 0,			/* JPEGInterchangeFormat = 44 */
+		0x02, 0x02, 4, 0, 1, 0, 0, 0, 0, 0, 0, 0,			/* JPEGInterchangeFormatLength */
+		0, 0, 0, 0 };										/* no next IFD */
+	uint32_t head = exif ? 6 + sizeof(tiff) : 6;
+	uint32_t seg_len = 2 + head + thumb_size;
+	if (seg_len > 0xFFFF) return NULL;
+	*size = 2 + 4 + head + thumb_size + jpeg_size - 2;
+	uint8_t *p = (uint8_t *)malloc(*size), *d = p;
+	if (!p) return NULL;
+	*d++ = 0xFF; *d++ = 0xD8;
+	*d++ = 0xFF; *d++ = exif ? 0xE1 : 0xE0;
+	*d++ = seg_len >> 8; *d++ = seg_len;
+	if (exif) {
+		memcpy(d, "Exif\0\0", 6);
+		memcpy(d + 6, tiff, sizeof(tiff));
+		d[6 + 36] = thumb_size; d[6 + 37] = thumb_size >> 8; d[6 + 38] = thumb_size >> 16;
+	}
+	else memcpy(d, "JFXX\0\x10", 6);
+	d += head;
+	*thumb_offset = d - p;
+	memcpy(d, thumb, thumb_size);
+	memcpy(d + thumb_size, jpeg + 2, jpeg_size - 2);
+	return p;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = 100;
+	const char *jpeg_path = HOST_IMAGE1_JPG;
+	const char *out_prefix = "lcd_host";
+	const char *ref_prefix = NULL;
+	const char *avi_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "a:f:j:o:r:")) != -1) {
+		switch (opt) {
+			case 'a': avi_path = optarg; break;
+			case 'f': frames = atoi(optarg); break;
+			case 'j': jpeg_path = optarg; break;
+			case 'o': out_prefix = optarg; break;
+			case 'r': ref_prefix = optarg; break;
+			default:
+				fprintf(stderr, "Usage: %s [-f frames] [-j file.jpg] [-a file.avi] [-o out_prefix] [-r ref_prefix]\n", argv[0]);
+				return 2;
+		}
+	}
+	//------------------------------------- SPI initialization ---------------------------
+	GPIO_Init();
+	SPI_Init(&SPI_, 2, DMA_ch);
+	SIM_Panel *panel = SIM_PanelAttach(&SPI_, CS_PIN, DC_PIN, ST7789_CONTROLLER_WIDTH, ST7789_CONTROLLER_HEIGHT);
+	//------------------- Display initialization -----------------------------------------
+	LCD_BackLight_data bl_dat = { .blk_pin = BCKL_PIN,
+								  .bk_percent = 75 };
+	LCD_SPI_Connected_data spi_dat = { .spi = &SPI_,
+									   .dma_channel = DMA_ch,
+									   .reset_pin = RST_PIN,
+									   .dc_pin = DC_PIN,
+									   .cs_pin = CS_PIN  };
+	LCD = LCD_DisplayAdd( LCD, 240, 240, ST7789_CONTROLLER_WIDTH, ST7789_CONTROLLER_HEIGHT, 0, 0,
+						  ST7789_Init, ST7789_SetWindow, ST7789_SleepIn, ST7789_SleepOut, ST7789_SetOrientation,
+						  &spi_dat, bl_dat );
+	LCD_Handler *lcd = LCD;
+	if (!panel || !lcd) {
+		fprintf(stderr, "display initialization error\n");
+		return 1;
+	}
+	LCD_Init(lcd);
+#ifdef HI_SPEED
+	SPI_.clock.clk_equ_sysclk = 1; //SPI_clock = APB_clock = 80 MHz
+#endif
+	LCD_SetOrientation(lcd, PAGE_ORIENTATION_PORTRAIT);
+
+	int errors = 0;
+	stage_time t;
+
+	//fill
+	stage_begin(&t);
+	LCD_Fill(lcd, 0x319bb1);
+	LCD_WriteString(lcd, 0, 0, "Hello, world!", &Font_15x25, COLOR_YELLOW, 0x319bb1, LCD_SYMBOL_PRINT_FAST);
+	stage_end(&t, "fill", 1);
+	errors += save_and_check(panel, lcd, out_prefix, ref_prefix, "fill");
+
+	//jpeg decoding
+	uint32_t jpeg_size = 0;
+	uint8_t *jpeg_data = load_file(jpeg_path, &jpeg_size);
+	if (!jpeg_data) {
+		fprintf(stderr, "%s: read error\n", jpeg_path);
+		return 1;
+	}
+	iPicture_jpg file;
+	stage_begin(&t);
+	for (int i = 0; i < 5; i++) {
+		file.data = jpeg_data;
+		file.size = jpeg_size;
+		LCD_Load_JPG_chan(lcd, 0, 0, lcd->Width, lcd->Height, &file, PICTURE_IN_MEMORY);
+	}
+	stage_end(&t, "jpeg", 5);
+	errors += save_and_check(panel, lcd, out_prefix, ref_prefix, "jpeg");
+
+	//the same picture read from the file through the read-ahead task, must match the in-memory decoding
+	LCD_Fill(lcd, 0);
+	iFile_jpg jpeg_file;
+	stage_begin(&t);
+	for (int i = 0; i < 5; i++) {
+		FILE *f = fopen(jpeg_path, "rb");
+		if (!f) {
+			fprintf(stderr, "%s: read error\n", jpeg_path);
+			return 1;
+		}
+		jpeg_file.file = f;
+		jpeg_file.size = jpeg_size;
+		LCD_Load_JPG_chan(lcd, 0, 0, lcd->Width, lcd->Height, &jpeg_file, PICTURE_IN_FILE);
+		fclose(f);
+	}
+	stage_end(&t, "jfile", 5);
+	errors += save_and_check(panel, lcd, out_prefix, NULL, "jfile");
+	errors += check_same(out_prefix, "jfile", "jpeg");
+
+	//area of the picture: the window must show the same pixels as the whole decoded picture,
+	//the second area is clipped by the right and bottom edges of the picture
+	//the areas after the first one start from the row found in the row index of the picture
+	static const struct { int x, y, w, h, src_x, src_y, vis_w, vis_h; } roi_test[] = {
+		{ 10, 20, 120, 100, 37, 53, 120, 100 },
+		{ 150, 160, 80, 70, 190, 205, 50, 35 },
+		{ 140, 10, 90, 60, 100, 150, 90, 60 }
+	};
+	file.data = jpeg_data;
+	file.size = jpeg_size;
+	uint32_t index_size = 0;
+	void *index = LCD_Index_JPG_chan(&file, &index_size);
+	if (!index) {
+		printf("jroi: index error\n");
+		errors++;
+	}
+	char roi_path[512], jpeg_ppm[512];
+	LCD_Fill(lcd, 0);
+	stage_begin(&t);
+	for (int i = 0; i < 5; i++) {
+		file.data = jpeg_data;
+		file.size = jpeg_size;
+		for (int k = 0; k < 3; k++) {
+			LCD_Load_JPG_chan_rect(lcd, roi_test[k].x, roi_test[k].y, roi_test[k].w, roi_test[k].h, &file, PICTURE_IN_MEMORY,
+								   roi_test[k].src_x, roi_test[k].src_y, 0, k ? index : NULL);
+		}
+	}
+	stage_end(&t, "jroi", 5);
+	errors += save_and_check(panel, lcd, out_prefix, NULL, "jroi");
+	snprintf(roi_path, sizeof(roi_path), "%s_jroi.ppm", out_prefix);
+	snprintf(jpeg_ppm, sizeof(jpeg_ppm), "%s_jpeg.ppm", out_prefix);
+	for (int k = 0; k < 3; k++) {
+		long diff = compare_ppm_area(roi_path, roi_test[k].x, roi_test[k].y, jpeg_ppm, roi_test[k].src_x, roi_test[k].src_y,
+									 roi_test[k].vis_w, roi_test[k].vis_h);
+		if (diff) {
+			printf("jroi: %s %ld pixels of area %d differ from %s\n", diff < 0 ? "error," : "FAIL,", diff, k, jpeg_ppm);
+			errors++;
+		}
+		else printf("jroi: area %d matches %s\n", k, jpeg_ppm);
+	}
+	printf("jroi: row index %u bytes\n", index_size);
+	heap_caps_free(index);
+
+	//cache of decoded pictures: the first draw decodes, the next ones send the cached pixels;
+	//the budget holds one full-size picture, so the half-size one evicts it and back again
+	JPEG_Decoder cache_dec;
+	JPEG_Decoder_Init(&cache_dec, NULL, 0, 1, NULL);
+	JPEG_Cache *cache = JPEG_CacheCreate(&cache_dec, 130000, MALLOC_CAP_DMA);
+	file.data = jpeg_data;
+	file.size = jpeg_size;
+	LCD_Fill(lcd, 0);
+	stage_begin(&t);
+	LCD_Load_JPG_cached(cache, lcd, 0, 0, &file, 0);
+	stage_end(&t, "jcmiss", 1);
+	stage_begin(&t);
+	for (int i = 0; i < 5; i++) {
+		LCD_Load_JPG_cached(cache, lcd, 0, 0, &file, 0);
+	}
+	stage_end(&t, "jchit", 5);
+	errors += save_and_check(panel, lcd, out_prefix, NULL, "jcache");
+	errors += check_same(out_prefix, "jcache", "jpeg");
+	LCD_Load_JPG_cached(cache, lcd, 0, 0, &file, 1);
+	LCD_Load_JPG_cached(cache, lcd, 0, 0, &file, 0);
+	JPEG_CacheStats cache_stats;
+	JPEG_CacheGetStats(cache, &cache_stats);
+	if (cache_stats.hits != 5 || cache_stats.misses != 3 || cache_stats.evictions != 2 || cache_stats.entries != 1) {
+		printf("jcache: FAIL, ");
+		errors++;
+	}
+	else printf("jcache: ");
+	printf("%u hits, %u misses, %u evictions, %u entries, %u bytes\n", cache_stats.hits, cache_stats.misses,
+		   cache_stats.evictions, cache_stats.entries, cache_stats.used);
+	JPEG_CacheDelete(cache);
+
+	//header probe: the decoder must fit exactly into the reported work pool
+	JD_PROBE probe;
+	JDEC probe_jd;
+	file.data = jpeg_data;
+	file.size = jpeg_size;
+	if (LCD_Probe_JPG_chan(&file, PICTURE_IN_MEMORY, &probe) != JDR_OK) {
+		printf("jprobe: error\n");
+		errors++;
+	}
+	else {
+		uint8_t *probe_pool = (uint8_t*)heap_caps_malloc(probe.sz_pool, MALLOC_CAP_8BIT);
+		JRESULT rc_less = jd_prepare_mem(&probe_jd, jpeg_data, jpeg_size, probe_pool, probe.sz_pool - 4, NULL);
+		JRESULT rc_exact = jd_prepare_mem(&probe_jd, jpeg_data, jpeg_size, probe_pool, probe.sz_pool, NULL);
+		if (rc_exact != JDR_OK || probe_jd.sz_pool || rc_less != JDR_MEM1) {
+			printf("jprobe: FAIL, pool %zu bytes, prepare %d (%zu bytes left), %d with 4 bytes less\n",
+				   probe.sz_pool, rc_exact, probe_jd.sz_pool, rc_less);
+			errors++;
+		}
+		else printf("jprobe: %ux%u, %ux%u blocks, restart interval %u, pool %zu bytes\n",
+					probe.width, probe.height, probe.msx, probe.msy, probe.nrst, probe.sz_pool);
+		heap_caps_free(probe_pool);
+	}
+
+	//header setup with the table cache: the tables of the same picture are built once,
+	//the next headers take them from the cache; the decoded picture must stay the same
+	JD_TBLCACHE *tables = (JD_TBLCACHE*)heap_caps_malloc(sizeof(JD_TBLCACHE), MALLOC_CAP_8BIT);
+	uint8_t *prep_pool = (uint8_t*)heap_caps_malloc(probe.sz_pool, MALLOC_CAP_8BIT);
+	jd_tblcache_init(tables);
+	size_t pool_left = 0, pool_left_tc = 0;
+	JRESULT prep_rc = JDR_OK;
+	stage_begin(&t);
+	for (int i = 0; i < 1000 && prep_rc == JDR_OK; i++) {
+		prep_rc = jd_prepare_mem(&probe_jd, jpeg_data, jpeg_size, prep_pool, probe.sz_pool, NULL);
+		pool_left = probe_jd.sz_pool;
+	}
+	stage_end(&t, "jprep", 1000);
+	stage_begin(&t);
+	for (int i = 0; i < 1000 && prep_rc == JDR_OK; i++) {
+		prep_rc = jd_prepare_mem_tc(&probe_jd, jpeg_data, jpeg_size, prep_pool, probe.sz_pool, NULL, tables);
+		pool_left_tc = probe_jd.sz_pool;
+	}
+	stage_end(&t, "jtprep", 1000);
+	uint32_t tables_built = tables->misses;
+	if (prep_rc != JDR_OK || tables->hits != 999 * tables_built) {
+		printf("jtables: FAIL, prepare %d, ", prep_rc);
+		errors++;
+	}
+	else printf("jtables: ");
+	printf("%u tables built, %u reused, %zu pool bytes saved\n", tables_built, tables->hits, pool_left_tc - pool_left);
+	heap_caps_free(prep_pool);
+	JPEG_Decoder tables_dec;
+	JPEG_Decoder_Init(&tables_dec, NULL, 0, 1, NULL);
+	JPEG_Decoder_SetTableCache(&tables_dec, tables);
+	file.data = jpeg_data;
+	file.size = jpeg_size;
+	LCD_Fill(lcd, 0);
+	LCD_Load_JPG_dec(&tables_dec, lcd, 0, 0, lcd->Width, lcd->Height, &file, PICTURE_IN_MEMORY);
+	errors += save_and_check(panel, lcd, out_prefix, NULL, "jtables");
+	errors += check_same(out_prefix, "jtables", "jpeg");
+	heap_caps_free(tables);
+
+	//two decoder instances with work pools sized by the header run at the same time on both cores,
+	//each one draws a half of the picture; the screen must match the single decoding
+	SemaphoreHandle_t jtwo_lock = xSemaphoreCreateMutex();
+	jtwo_job jtwo[2];
+	LCD_Fill(lcd, 0);
+	stage_begin(&t);
+	for (int i = 0; i < 5; i++) {
+		for (int k = 0; k < 2; k++) {
+			JPEG_Decoder_Init(&jtwo[k].dec, NULL, 0, 1, jtwo_lock);
+			jtwo[k].lcd = lcd;
+			jtwo[k].file.data = jpeg_data;
+			jtwo[k].file.size = jpeg_size;
+			jtwo[k].x = k * lcd->Width / 2;
+			jtwo[k].w = k ? lcd->Width - lcd->Width / 2 : lcd->Width / 2;
+			jtwo[k].done = xSemaphoreCreateBinary();
+			xTaskCreatePinnedToCore(JPEG_HalfTask, "jtwo", 4096, &jtwo[k], 4, NULL, k);
+		}
+		for (int k = 0; k < 2; k++) {
+			xSemaphoreTake(jtwo[k].done, portMAX_DELAY);
+			vSemaphoreDelete(jtwo[k].done);
+			if (jtwo[k].rc) {
+				printf("jtwo: decoder %d error %u\n", k, jtwo[k].rc);
+				errors++;
+			}
+		}
+	}
+	stage_end(&t, "jtwo", 5);
+	vSemaphoreDelete(jtwo_lock);
+	errors += save_and_check(panel, lcd, out_prefix, NULL, "jtwo");
+	errors += check_same(out_prefix, "jtwo", "jpeg");
+
+	//graphic rendering
+	render_buf1 = (uint16_t*)heap_caps_malloc(RENDER_BUFFER_LINES * lcd->Width * sizeof(uint16_t), MALLOC_CAP_DMA);
+	render_buf2 = (uint16_t*)heap_caps_malloc(RENDER_BUFFER_LINES * lcd->Width * sizeof(uint16_t), MALLOC_CAP_DMA);
+#ifdef RENDER_USE_TWO_CORES
+	render_sched = MGL_RenderSchedulerCreate(2, 2048, 4);
+#endif
+	render_table = MGL_RenderTableCreate(2);
+	demo_scene scene;
+	Scene_Create(lcd, &scene);
+	MGL_DIRTY dirty;
+	MGL_DirtyInit(&dirty, 0, 0, lcd->Width - 1, lcd->Height - 1);
+	stage_begin(&t);
+	for (int i = 0; i < frames; i++) {
+		Render2D_Dirty(lcd, scene.rect, &dirty);
+		Scene_Step(lcd, &scene);
+	}
+	stage_end(&t, "render", frames);
+	errors += save_and_check(panel, lcd, out_prefix, ref_prefix, "render");
+
+	//incremental rendering: only the changed areas are sent, the result must match a full redraw
+	Render2D_Dirty(lcd, scene.rect, &dirty);
+	stage_begin(&t);
+	for (int i = 0; i < frames; i++) {
+		Scene_StepForeground(lcd, &scene);
+		Render2D_Dirty(lcd, scene.rect, &dirty);
+	}
+	stage_end(&t, "dirty", frames);
+	errors += save_and_check(panel, lcd, out_prefix, NULL, "dirty");
+	Render2D(lcd, scene.rect, 0, 0, lcd->Width - 1, lcd->Height - 1, 0, 0);
+	errors += save_and_check(panel, lcd, out_prefix, NULL, "redraw");
+	errors += check_same(out_prefix, "dirty", "redraw");
+
+	//picture decoded into a MicroGL2D image and drawn as the texture of a rectangle
+	//must match the picture decoded straight to the display
+	JPEG_Decoder image_dec;
+	JPEG_Decoder_Init(&image_dec, NULL, 0, 1, NULL);
+	MGL_IMAGE jimage = { NULL, 0, 0, MGL_IMAGE_COLOR_R5G6B5 };
+	file.data = jpeg_data;
+	file.size = jpeg_size;
+	stage_begin(&t);
+	uint8_t jimage_rc = JPEG_DecodeImage(&image_dec, &file, PICTURE_IN_MEMORY, 0, &jimage);
+	stage_end(&t, "jimage", 1);
+	if (jimage_rc != JDR_OK) {
+		printf("jimage: decoder error %u\n", jimage_rc);
+		errors++;
+	}
+	else {
+		MGL_TEXTURE jimage_tex = { &jimage, 0, 0 };
+		MGL_OBJ *jimage_obj = MGL_ObjectAdd(0, MGL_OBJ_TYPE_FILLRECTANGLE);
+		MGL_SetRectangle(jimage_obj, 0, 0, jimage.w - 1, jimage.h - 1, COLOR_BLACK);
+		MGL_ObjectSetTexture(jimage_obj, &jimage_tex);
+		LCD_Fill(lcd, 0);
+		Render2D(lcd, jimage_obj, 0, 0, jimage.w - 1, jimage.h - 1, 0, 0);
+		MGL_ObjectsListDelete(jimage_obj);
+		errors += save_and_check(panel, lcd, out_prefix, NULL, "jimage");
+		errors += check_same(out_prefix, "jimage", "jpeg");
+		//the half-size picture in R8G8B8 must agree with the one in R5G6B5
+		MGL_IMAGE half565 = { NULL, 0, 0, MGL_IMAGE_COLOR_R5G6B5 }, half888 = { NULL, 0, 0, MGL_IMAGE_COLOR_R8G8B8 };
+		long diff = -1;
+		if (JPEG_DecodeImage(&image_dec, &file, PICTURE_IN_MEMORY, 1, &half565) == JDR_OK &&
+			JPEG_DecodeImage(&image_dec, &file, PICTURE_IN_MEMORY, 1, &half888) == JDR_OK &&
+			half565.w == half888.w && half565.h == half888.h) {
+			const uint16_t *p16 = (const uint16_t*)half565.data;
+			const uint8_t *p24 = (const uint8_t*)half888.data;
+			diff = 0;
+			for (int i = 0; i < half565.w * half565.h; i++, p24 += 3) {
+				uint16_t c = (p24[0] >> 3) << 11 | (p24[1] >> 3) << 6 | p24[2] >> 3;
+				if (c != p16[i]) diff++;
+			}
+		}
+		if (diff) {
+			printf("jimage: %s %ld pixels of R8G8B8 1/2 differ from R5G6B5\n", diff < 0 ? "error," : "FAIL,", diff);
+			errors++;
+		}
+		else printf("jimage: R8G8B8 1/2 (%dx%d) matches R5G6B5\n", half888.w, half888.h);
+		heap_caps_free((void*)half565.data);
+		heap_caps_free((void*)half888.data);
+
+		//MicroGL2D objects drawn over the picture bands while it is decoded must give the same screen
+		//as the whole scene rendered with the picture as the texture of the bottom rectangle
+		MGL_OBJ *ov_pic = MGL_ObjectAdd(0, MGL_OBJ_TYPE_FILLRECTANGLE);
+		MGL_SetRectangle(ov_pic, 0, 0, jimage.w - 1, jimage.h - 1, COLOR_BLACK);
+		MGL_ObjectSetTexture(ov_pic, &jimage_tex);
+		MGL_OBJ *ov_obj = MGL_ObjectAdd(ov_pic, MGL_OBJ_TYPE_FILLRECTANGLE);
+		MGL_SetRectangle(ov_obj, 10, 150, 229, 200, COLOR_BLUE);
+		MGL_ObjectSetTransparency(ov_obj, 120);
+		ov_obj = MGL_ObjectAdd(ov_pic, MGL_OBJ_TYPE_TEXT);
+		MGL_SetText(ov_obj, 20, 162, "Photo + UI", &Font_15x25, 1, COLOR_YELLOW);
+		ov_obj = MGL_ObjectAdd(ov_pic, MGL_OBJ_TYPE_FILLCIRCLE);
+		MGL_SetCircle(ov_obj, 200, 40, 25, COLOR_RED);
+		MGL_ObjectSetTransparency(ov_obj, 60);
+		JPEG_Decoder ov_dec;
+		JPEG_Decoder_Init(&ov_dec, NULL, 0, 1, NULL);
+		JPEG_Decoder_SetOverlay(&ov_dec, ov_pic->next);
+		LCD_Fill(lcd, 0);
+		stage_begin(&t);
+		for (int i = 0; i < 5; i++) {
+			LCD_Load_JPG_dec(&ov_dec, lcd, 0, 0, lcd->Width, lcd->Height, &file, PICTURE_IN_MEMORY);
+		}
+		stage_end(&t, "jover", 5);
+		errors += save_and_check(panel, lcd, out_prefix, NULL, "jover");
+		LCD_Fill(lcd, 0);
+		Render2D(lcd, ov_pic, 0, 0, jimage.w - 1, jimage.h - 1, 0, 0);
+		errors += save_and_check(panel, lcd, out_prefix, NULL, "joverscene");
+		errors += check_same(out_prefix, "jover", "joverscene");
+		MGL_ObjectsListDelete(ov_pic);
+		heap_caps_free((void*)jimage.data);
+	}
+
+	//preview from the thumbnail embedded in the header: the thumbnail is the same picture, so
+	//the preview alone must already match it; the file is shown with the preview and the refinement
+	uint32_t thumb_jpeg_size = 0, thumb_ofs = 0, found_ofs = 0, found_size = 0;
+	JPEG_Decoder thumb_dec;
+	JPEG_Decoder_Init(&thumb_dec, NULL, 0, 1, NULL);
+	file.data = jpeg_data;
+	file.size = jpeg_size;
+	if (JPEG_FindThumbnail(&file, PICTURE_IN_MEMORY, &found_ofs, &found_size) != JDR_FMT2) {
+		printf("jthumb: FAIL, thumbnail found in %s\n", jpeg_path);
+		errors++;
+	}
+	for (int exif = 1; exif >= 0; exif--) {
+		const char *name = exif ? "jthumb" : "jjfxx";
+		uint8_t *thumb_jpeg = make_thumb_jpeg(jpeg_data, jpeg_size, jpeg_data, jpeg_size, exif, &thumb_jpeg_size, &thumb_ofs);
+		if (!thumb_jpeg) {
+			printf("%s: picture is too large for a thumbnail\n", name);
+			continue;
+		}
+		file.data = thumb_jpeg;
+		file.size = thumb_jpeg_size;
+		if (JPEG_FindThumbnail(&file, PICTURE_IN_MEMORY, &found_ofs, &found_size) != JDR_OK ||
+			found_ofs != thumb_ofs || found_size != jpeg_size) {
+			printf("%s: FAIL, thumbnail not found\n", name);
+			errors++;
+		}
+		LCD_Fill(lcd, 0);
+		stage_begin(&t);
+		uint8_t thumb_rc = LCD_Load_JPG_preview(&thumb_dec, lcd, 0, 0, lcd->Width, lcd->Height, &file, PICTURE_IN_MEMORY, 0);
+		stage_end(&t, name, 1);
+		if (thumb_rc != JDR_OK) {
+			printf("%s: decoder error %u\n", name, thumb_rc);
+			errors++;
+		}
+		errors += save_and_check(panel, lcd, out_prefix, NULL, name);
+		errors += check_same(out_prefix, name, "jpeg");
+		if (exif) {
+			char thumb_path[512];
+			snprintf(thumb_path, sizeof(thumb_path), "%s_thumb.jpg", out_prefix);
+			FILE *f = fopen(thumb_path, "w+b");
+			if (f && fwrite(thumb_jpeg, 1, thumb_jpeg_size, f) == thumb_jpeg_size && !fseek(f, 0, SEEK_SET)) {
+				jpeg_file.file = f;
+				jpeg_file.size = thumb_jpeg_size;
+				LCD_Fill(lcd, 0);
+				stage_begin(&t);
+				thumb_rc = LCD_Load_JPG_preview(&thumb_dec, lcd, 0, 0, lcd->Width, lcd->Height, &jpeg_file, PICTURE_IN_FILE, 1);
+				stage_end(&t, "jtfile", 1);
+				if (thumb_rc != JDR_OK) {
+					printf("jtfile: decoder error %u\n", thumb_rc);
+					errors++;
+				}
+				errors += save_and_check(panel, lcd, out_prefix, NULL, "jtfile");
+				errors += check_same(out_prefix, "jtfile", "jpeg");
+			}
+			else {
+				printf("jtfile: %s: write error\n", thumb_path);
+				errors++;
+			}
+			if (f) fclose(f);
+			remove(thumb_path);
+		}
+		free(thumb_jpeg);
+	}
+
+	//MJPEG AVI of copies of the picture: at 25 fps every frame is shown in its time,
+	//at 1000 fps the frames that are late are skipped; the last frame must match the picture.
+	//The fast file has no idx1 index, its frames are found in the 'movi' list
+	char avi_test[512];
+	snprintf(avi_test, sizeof(avi_test), "%s_test.avi", out_prefix);
+	LCD_Fill(lcd, 0);
+	if (write_test_avi(avi_test, jpeg_data, jpeg_size, probe.width, probe.height, 25, 40000, 1)) {
+		printf("avi: %s: write error\n", avi_test);
+		errors++;
+	}
+	else {
+		errors += play_avi(lcd, "avi", avi_test);
+		errors += save_and_check(panel, lcd, out_prefix, NULL, "avi");
+		errors += check_same(out_prefix, "avi", "jpeg");
+	}
+	if (write_test_avi(avi_test, jpeg_data, jpeg_size, probe.width, probe.height, 100, 1000, 0)) {
+		printf("avi: %s: write error\n", avi_test);
+		errors++;
+	}
+	else errors += play_avi(lcd, "avifast", avi_test);
+	remove(avi_test);
+	if (avi_path) errors += play_avi(lcd, "avifile", avi_path);
+	free(jpeg_data);
+
+	printf("Free memory MALLOC_CAP_8BIT: %zu bytes\n", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+/*
+ *  Хост-сборка (Linux): задачи и очереди FreeRTOS поверх POSIX threads
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+struct tskTaskControlBlock {
+	pthread_t thread;
+	TaskFunction_t task;
+	void *param;
+	BaseType_t core_id;
+	pthread_mutex_t notify_mutex;
+	pthread_cond_t notify_cond;
+	uint32_t notify_count;
+};
+
+struct QueueDefinition {
+	pthread_mutex_t mutex;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	uint32_t length;
+	uint32_t item_size;
+	uint32_t count;
+	uint32_t head;
+	uint8_t *storage;
+};
+
+static __thread struct tskTaskControlBlock *current_task = NULL;
+
+static struct tskTaskControlBlock* task_alloc(TaskFunction_t task, void *param, BaseType_t core_id)
+{
+	struct tskTaskControlBlock *tcb = (struct tskTaskControlBlock *)calloc(1, sizeof(struct tskTaskControlBlock));
+	if (!tcb) return NULL;
+	tcb->task = task;
+	tcb->param = param;
+	tcb->core_id = core_id;
+	pthread_mutex_init(&tcb->notify_mutex, NULL);
+	pthread_cond_init(&tcb->notify_cond, NULL);
+	return tcb;
+}
+
+static void task_free(struct tskTaskControlBlock *tcb)
+{
+	pthread_mutex_destroy(&tcb->notify_mutex);
+	pthread_cond_destroy(&tcb->notify_cond);
+	free(tcb);
+}
+
+static void* task_entry(void *arg)
+{
+	struct tskTaskControlBlock *tcb = (struct tskTaskControlBlock *)arg;
+	current_task = tcb;
+	tcb->task(tcb->param);
+	vTaskDelete(NULL);	//задача FreeRTOS не должна завершаться возвратом
+	return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stack_depth,
+								   void *param, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+	(void)name; (void)stack_depth; (void)priority;
+	struct tskTaskControlBlock *tcb = task_alloc(task, param, core_id);
+	if (!tcb) return pdFAIL;
+	if (created_task) *created_task = tcb;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int res = pthread_create(&tcb->thread, &attr, task_entry, tcb);
+	pthread_attr_destroy(&attr);
+	if (res) {
+		task_free(tcb);
+		return pdFAIL;
+	}
+	return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+	if (!task || task == current_task) {
+		struct tskTaskControlBlock *tcb = current_task;
+		current_task = NULL;
+		if (tcb) task_free(tcb);
+		pthread_exit(NULL);
+	}
+	pthread_cancel(task->thread);
+	task_free(task);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	if (!ticks) {
+		sched_yield();
+		return;
+	}
+	uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+	struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+	while (nanosleep(&ts, &ts) && errno == EINTR) ;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (TickType_t)(((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / portTICK_PERIOD_MS);
+}
+
+int64_t esp_timer_get_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	if (!current_task) {
+		current_task = task_alloc(NULL, NULL, tskNO_AFFINITY);
+		if (current_task) {
+			current_task->thread = pthread_self();
+		}
+	}
+	return current_task;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+	if (!current_task || current_task->core_id == tskNO_AFFINITY) return 0;
+	return current_task->core_id;
+}
+
+//ожидание условия с таймаутом в тиках; возвращает 0 по таймауту
+static int queue_wait(QueueHandle_t queue, pthread_cond_t *cond, TickType_t ticks_to_wait, const struct timespec *deadline)
+{
+	if (!ticks_to_wait) return 0;
+	if (ticks_to_wait == portMAX_DELAY) {
+		pthread_cond_wait(cond, &queue->mutex);
+		return 1;
+	}
+	return pthread_cond_timedwait(cond, &queue->mutex, deadline) != ETIMEDOUT;
+}
+
+static void queue_deadline(TickType_t ticks_to_wait, struct timespec *deadline)
+{
+	clock_gettime(CLOCK_REALTIME, deadline);
+	if (ticks_to_wait == portMAX_DELAY) return;
+	uint64_t ns = (uint64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000000ULL + deadline->tv_nsec;
+	deadline->tv_sec += ns / 1000000000ULL;
+	deadline->tv_nsec = ns % 1000000000ULL;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+	struct tskTaskControlBlock *tcb = xTaskGetCurrentTaskHandle();
+	struct timespec deadline;
+	queue_deadline(ticks_to_wait, &deadline);
+	pthread_mutex_lock(&tcb->notify_mutex);
+	while (!tcb->notify_count && ticks_to_wait) {
+		if (ticks_to_wait == portMAX_DELAY) {
+			pthread_cond_wait(&tcb->notify_cond, &tcb->notify_mutex);
+		}
+		else if (pthread_cond_timedwait(&tcb->notify_cond, &tcb->notify_mutex, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+	uint32_t count = tcb->notify_count;
+	if (count) {
+		tcb->notify_count = clear_on_exit ? 0 : count - 1;
+	}
+	pthread_mutex_unlock(&tcb->notify_mutex);
+	return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	pthread_mutex_lock(&task->notify_mutex);
+	task->notify_count++;
+	pthread_cond_signal(&task->notify_cond);
+	pthread_mutex_unlock(&task->notify_mutex);
+	return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+	if (higher_priority_task_woken) *higher_priority_task_woken = pdFALSE;
+	xTaskNotifyGive(task);
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+	while (__atomic_test_and_set(&mux->lock, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+	__atomic_clear(&mux->lock, __ATOMIC_RELEASE);
+}
+
+QueueHandle_t xQueueGenericCreate(UBaseType_t length, UBaseType_t item_size, uint32_t initial_count)
+{
+	if (!length) return NULL;
+	QueueHandle_t queue = (QueueHandle_t)calloc(1, sizeof(struct QueueDefinition));
+	if (!queue) return NULL;
+	if (item_size) {
+		queue->storage = (uint8_t *)malloc((size_t)length * item_size);
+		if (!queue->storage) {
+			free(queue);
+			return NULL;
+		}
+	}
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+	queue->length = length;
+	queue->item_size = item_size;
+	queue->count = initial_count > length ? length : initial_count;
+	return queue;
+}
+
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait, BaseType_t position)
+{
+	struct timespec deadline;
+	queue_deadline(ticks_to_wait, &deadline);
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->count == queue->length) {
+		if (!queue_wait(queue, &queue->not_full, ticks_to_wait, &deadline)) {
+			pthread_mutex_unlock(&queue->mutex);
+			return pdFAIL;
+		}
+	}
+	if (queue->item_size) {
+		uint32_t idx;
+		if (position == queueSEND_TO_FRONT) {
+			queue->head = (queue->head + queue->length - 1) % queue->length;
+			idx = queue->head;
+		}
+		else {
+			idx = (queue->head + queue->count) % queue->length;
+		}
+		memcpy(queue->storage + (size_t)idx * queue->item_size, item, queue->item_size);
+	}
+	queue->count++;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdPASS;
+}
+
+BaseType_t xQueueGenericSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait, BaseType_t position)
+{
+	return queue_send(queue, item, ticks_to_wait, position);
+}
+
+BaseType_t xQueueGenericSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *higher_priority_task_woken, BaseType_t position)
+{
+	if (higher_priority_task_woken) *higher_priority_task_woken = pdFALSE;
+	return queue_send(queue, item, 0, position);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+	struct timespec deadline;
+	queue_deadline(ticks_to_wait, &deadline);
+	pthread_mutex_lock(&queue->mutex);
+	while (!queue->count) {
+		if (!queue_wait(queue, &queue->not_empty, ticks_to_wait, &deadline)) {
+			pthread_mutex_unlock(&queue->mutex);
+			return pdFAIL;
+		}
+	}
+	if (queue->item_size) {
+		memcpy(buffer, queue->storage + (size_t)queue->head * queue->item_size, queue->item_size);
+		queue->head = (queue->head + 1) % queue->length;
+	}
+	queue->count--;
+	pthread_cond_signal(&queue->not_full);
+	pthread_mutex_unlock(&queue->mutex);
+	return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	UBaseType_t count = queue->count;
+	pthread_mutex_unlock(&queue->mutex);
+	return count;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+	if (!queue) return;
+	pthread_mutex_destroy(&queue->mutex);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_cond_destroy(&queue->not_full);
+	free(queue->storage);
+	free(queue);
+}
@@ -0,0 +1,150 @@
+/*
+ *  Хост-сборка (Linux): распределитель памяти heap_caps
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *  Внутренняя память (SOC_DRAM_LOW - SOC_DRAM_HIGH) раздается простым распределителем
+ *  "первый подходящий" со слиянием соседних свободных блоков. Запросы с MALLOC_CAP_SPIRAM
+ *  обслуживает malloc библиотеки C.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "soc/soc.h"
+#include "esp_heap_caps.h"
+
+#define HEAP_ALIGN		16
+
+typedef struct {
+	uint32_t size;		//размер блока вместе с заголовком, кратен HEAP_ALIGN
+	uint32_t used;
+	uint32_t reserved[2];
+} heap_block_t;
+
+static pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int heap_ready = 0;
+
+#define HEAP_START	((uint8_t *)SOC_DRAM_LOW)
+#define HEAP_END	((uint8_t *)SOC_DRAM_HIGH)
+
+static void heap_init(void)
+{
+	heap_block_t *blk = (heap_block_t *)HEAP_START;
+	blk->size = SOC_DRAM_HIGH - SOC_DRAM_LOW;
+	blk->used = 0;
+	heap_ready = 1;
+}
+
+static int heap_is_internal(const void *ptr)
+{
+	return (const uint8_t *)ptr >= HEAP_START && (const uint8_t *)ptr < HEAP_END;
+}
+
+//слияние свободного блока со следующими за ним свободными блоками
+static void heap_merge(heap_block_t *blk)
+{
+	while (1) {
+		heap_block_t *next = (heap_block_t *)((uint8_t *)blk + blk->size);
+		if ((uint8_t *)next >= HEAP_END || next->used) break;
+		blk->size += next->size;
+	}
+}
+
+static void *heap_internal_alloc(size_t size)
+{
+	if (size > SOC_DRAM_HIGH - SOC_DRAM_LOW) return NULL;
+	uint32_t need = (uint32_t)((size + sizeof(heap_block_t) + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1));
+	void *res = NULL;
+	pthread_mutex_lock(&heap_mutex);
+	if (!heap_ready) heap_init();
+	heap_block_t *blk = (heap_block_t *)HEAP_START;
+	while ((uint8_t *)blk < HEAP_END) {
+		if (!blk->used) {
+			heap_merge(blk);
+			if (blk->size >= need) {
+				if (blk->size - need >= 2 * sizeof(heap_block_t)) {
+					heap_block_t *rest = (heap_block_t *)((uint8_t *)blk + need);
+					rest->size = blk->size - need;
+					rest->used = 0;
+					blk->size = need;
+				}
+				blk->used = 1;
+				res = (void *)(blk + 1);
+				break;
+			}
+		}
+		blk = (heap_block_t *)((uint8_t *)blk + blk->size);
+	}
+	pthread_mutex_unlock(&heap_mutex);
+	return res;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+	if (caps & MALLOC_CAP_SPIRAM) return malloc(size);
+	return heap_internal_alloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+	if (size && n > (size_t)-1 / size) return NULL;
+	void *ptr = heap_caps_malloc(n * size, caps);
+	if (ptr) memset(ptr, 0, n * size);
+	return ptr;
+}
+
+void heap_caps_free(void *ptr)
+{
+	if (!ptr) return;
+	if (!heap_is_internal(ptr)) {
+		free(ptr);
+		return;
+	}
+	pthread_mutex_lock(&heap_mutex);
+	((heap_block_t *)ptr - 1)->used = 0;
+	pthread_mutex_unlock(&heap_mutex);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
+{
+	if (!ptr) return heap_caps_malloc(size, caps);
+	if (!heap_is_internal(ptr)) return realloc(ptr, size);
+	void *res = heap_caps_malloc(size, caps);
+	if (!res) return NULL;
+	size_t old = ((heap_block_t *)ptr - 1)->size - sizeof(heap_block_t);
+	memcpy(res, ptr, old < size ? old : size);
+	heap_caps_free(ptr);
+	return res;
+}
+
+static size_t heap_scan(int largest)
+{
+	size_t total = 0, max_blk = 0;
+	pthread_mutex_lock(&heap_mutex);
+	if (!heap_ready) heap_init();
+	heap_block_t *blk = (heap_block_t *)HEAP_START;
+	while ((uint8_t *)blk < HEAP_END) {
+		if (!blk->used) {
+			heap_merge(blk);
+			size_t free_size = blk->size - sizeof(heap_block_t);
+			total += free_size;
+			if (free_size > max_blk) max_blk = free_size;
+		}
+		blk = (heap_block_t *)((uint8_t *)blk + blk->size);
+	}
+	pthread_mutex_unlock(&heap_mutex);
+	return largest ? max_blk : total;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+	if (caps & MALLOC_CAP_SPIRAM) return 0;
+	return heap_scan(0);
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+	if (caps & MALLOC_CAP_SPIRAM) return 0;
+	return heap_scan(1);
+}
@@ -0,0 +1,19 @@
+/*
+ *  Хост-сборка (Linux): внутренний интерфейс симулятора
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#ifndef HOST_SIM_INTERNAL_H_
+#define HOST_SIM_INTERNAL_H_
+
+#include <stdint.h>
+
+//обслуживает записанные регистры шин SPI (запуск DMA и транзакций), возвращает 1, если что-то было сделано
+int sim_spi_service(void);
+//вызывает обработчики прерываний завершенных транзакций, возвращает 1, если был вызван хотя бы один
+int sim_spi_dispatch_isr(void);
+//уровень на выходе gpio
+uint32_t sim_gpio_level(int pin_num);
+
+#endif /* HOST_SIM_INTERNAL_H_ */
@@ -0,0 +1,157 @@
+/*
+ *  Хост-сборка (Linux): карта памяти ESP32 и перехват записи в регистры периферии
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ *
+ *  При загрузке программы по адресам ESP32 отображается 1 Мб: 0x3FF00000 - 0x3FF7FFFF -
+ *  регистры периферии, 0x3FF80000 - 0x3FFFFFFF - внутренняя память (куча heap_caps).
+ *  Страницы периферии доступны только для чтения. Запись в них вызывает SIGSEGV, обработчик
+ *  временно открывает страницы на запись и взводит флаг трассировки (TF), процессор выполняет
+ *  одну команду записи и генерирует SIGTRAP. В обработчике SIGTRAP симулятор обслуживает
+ *  записанные регистры (GPIO w1ts/w1tc, запуск DMA, запуск транзакции SPI) и снова закрывает
+ *  страницы. Таким образом драйвер работает с "железом" без каких-либо изменений,
+ *  а каждая транзакция выполняется синхронно, до следующей команды процессора.
+ *  Обработчики прерываний SPI вызываются после того, как страницы снова закрыты, поэтому
+ *  их запись в регистры (запуск следующей транзакции, ожидание DMA) тоже перехватывается.
+ *  Вложенные прерывания не вызываются: их обслуживает внешний цикл того же потока.
+ *
+ *  Под отладчиком: handle SIGSEGV nostop noprint pass / handle SIGTRAP nostop noprint pass
+ */
+
+#if !defined(__linux__) || !defined(__x86_64__)
+#error "Host simulator requires Linux on x86-64"
+#endif
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "freertos/FreeRTOS.h"
+#include "soc/soc.h"
+#include "soc/gpio_struct.h"
+#include "sim_internal.h"
+
+#define SIM_EFLAGS_TF		0x100UL		//флаг пошаговой трассировки
+#define SIM_PERIPH_SIZE		(SOC_DRAM_LOW - DR_REG_PERIPH_BASE)
+#define SIM_MAP_SIZE		(SOC_DRAM_HIGH - DR_REG_PERIPH_BASE)
+
+static volatile int sim_lock_flag = 0;		//одновременно обслуживается только одна запись
+static __thread int sim_stepping = 0;		//поток выполняет перехваченную команду записи
+static __thread int sim_in_isr = 0;			//поток выполняет обработчик прерывания
+
+BaseType_t xPortInIsrContext(void)
+{
+	return sim_in_isr;
+}
+
+static void sim_lock(void)
+{
+	while (__atomic_test_and_set(&sim_lock_flag, __ATOMIC_ACQUIRE)) {
+		sched_yield();
+	}
+}
+
+static void sim_unlock(void)
+{
+	__atomic_clear(&sim_lock_flag, __ATOMIC_RELEASE);
+}
+
+static void sim_periph_protect(int write_enable)
+{
+	mprotect((void *)DR_REG_PERIPH_BASE, SIM_PERIPH_SIZE, PROT_READ | (write_enable ? PROT_WRITE : 0));
+}
+
+uint32_t sim_gpio_level(int pin_num)
+{
+	if (pin_num < 0) return 0;
+	if (pin_num < 32) return (GPIO.out >> pin_num) & 1;
+	return (GPIO.out1.data >> (pin_num - 32)) & 1;
+}
+
+//регистры w1ts/w1tc читаются как 0: запись переносится в out и регистр очищается
+static int sim_gpio_service(void)
+{
+	int event = 0;
+	uint32_t val;
+	if ((val = GPIO.out_w1ts))		{ GPIO.out |= val;  GPIO.out_w1ts = 0; event = 1; }
+	if ((val = GPIO.out_w1tc))		{ GPIO.out &= ~val; GPIO.out_w1tc = 0; event = 1; }
+	if ((val = GPIO.out1_w1ts.val))	{ GPIO.out1.val |= val;  GPIO.out1_w1ts.val = 0; event = 1; }
+	if ((val = GPIO.out1_w1tc.val))	{ GPIO.out1.val &= ~val; GPIO.out1_w1tc.val = 0; event = 1; }
+	if ((val = GPIO.enable_w1ts))	{ GPIO.enable |= val;  GPIO.enable_w1ts = 0; event = 1; }
+	if ((val = GPIO.enable_w1tc))	{ GPIO.enable &= ~val; GPIO.enable_w1tc = 0; event = 1; }
+	return event;
+}
+
+//обработчик прерывания, вызванный по завершении транзакции, может снова писать в регистры,
+//поэтому обслуживание повторяется, пока есть изменения
+static void sim_service(void)
+{
+	int event;
+	do {
+		event = sim_gpio_service();
+		event |= sim_spi_service();
+	} while (event);
+}
+
+static void sim_fatal(int sig)
+{
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+static void sim_segv_handler(int sig, siginfo_t *info, void *context)
+{
+	uintptr_t addr = (uintptr_t)info->si_addr;
+	if (addr < DR_REG_PERIPH_BASE || addr >= SOC_DRAM_LOW || sim_stepping) {
+		sim_fatal(sig);
+		return;
+	}
+	ucontext_t *uc = (ucontext_t *)context;
+	sim_lock();
+	sim_stepping = 1;
+	sim_periph_protect(1);
+	uc->uc_mcontext.gregs[REG_EFL] |= SIM_EFLAGS_TF;
+}
+
+static void sim_trap_handler(int sig, siginfo_t *info, void *context)
+{
+	(void)info;
+	if (!sim_stepping) {
+		sim_fatal(sig);
+		return;
+	}
+	ucontext_t *uc = (ucontext_t *)context;
+	uc->uc_mcontext.gregs[REG_EFL] &= ~SIM_EFLAGS_TF;
+	sim_service();
+	sim_periph_protect(0);
+	sim_stepping = 0;
+	sim_unlock();
+	if (sim_in_isr) return;
+	sim_in_isr = 1;
+	while (sim_spi_dispatch_isr()) ;
+	sim_in_isr = 0;
+}
+
+__attribute__((constructor(101))) static void sim_soc_init(void)
+{
+	void *map = mmap((void *)DR_REG_PERIPH_BASE, SIM_MAP_SIZE, PROT_READ | PROT_WRITE,
+					 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+	if (map != (void *)DR_REG_PERIPH_BASE) {
+		fprintf(stderr, "sim: unable to map ESP32 address space at 0x%08X\n", DR_REG_PERIPH_BASE);
+		exit(EXIT_FAILURE);
+	}
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags = SA_SIGINFO;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_sigaction = sim_segv_handler;
+	sigaction(SIGSEGV, &sa, NULL);
+	sa.sa_sigaction = sim_trap_handler;
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;	//обработчик прерывания сам пишет в регистры
+	sigaction(SIGTRAP, &sa, NULL);
+	sim_periph_protect(0);
+}
@@ -0,0 +1,280 @@
+/*
+ *  Хост-сборка (Linux): модель SPI с DMA и контроллера дисплея
+ *  Author: VadRov
+ *  Copyright (C) 2024, VadRov, all right reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "soc/soc.h"
+#include "soc/spi_struct.h"
+#include "esp_intr_alloc.h"
+#include "host_sim.h"
+#include "sim_internal.h"
+
+#define SIM_APB_CLK_FREQ	80000000ULL	//частота шины APB, Гц
+#define SIM_MAX_PANELS		4			//максимальное количество дисплеев на одной шине
+
+//команды контроллера (общие для ST7789 и ILI9341)
+#define SIM_CMD_CASET		0x2A
+#define SIM_CMD_RASET		0x2B
+#define SIM_CMD_RAMWR		0x2C
+#define SIM_CMD_MADCTL		0x36
+
+//дескриптор DMA в том же формате, что и LCD_DMA_descriptor_link
+typedef struct {
+	volatile uint32_t size:     12,
+					  lenght:   12,
+					  reserved:  6,
+					  eof:       1,
+					  owner:     1;
+	volatile const uint8_t *buf;
+	void *next_link;
+} sim_lldesc_t;
+
+struct SIM_Panel {
+	int cs_pin, dc_pin;
+	uint16_t side;				//GRAM квадратная: max(ширина, высота) контроллера
+	uint16_t *gram;				//память дисплея, R5G6B5
+	uint8_t cmd;				//текущая команда
+	uint8_t par[4];				//параметры CASET/RASET
+	uint8_t par_cnt;
+	uint8_t pix_hi, pix_phase;	//старший байт точки и номер принимаемого байта
+	uint8_t madctl;
+	uint16_t xs, xe, ys, ye;	//окно вывода
+	uint16_t x, y;				//текущая позиция записи в окне
+};
+
+typedef struct {
+	spi_dev_t *spi;
+	intr_handler_t isr;
+	void *isr_arg;
+	volatile uint8_t isr_pending;	//транзакция завершена, обработчик прерывания еще не вызван
+	uint8_t dma_armed;			//выходной канал DMA запущен (dma_out_link.start)
+	uint32_t dma_addr;			//младшие 20 бит адреса первого дескриптора
+	SIM_Panel *panels[SIM_MAX_PANELS];
+	int panels_num;
+	SIM_SpiStats stats;
+} sim_spi_host_t;
+
+static sim_spi_host_t sim_hosts[2] = { { .spi = &SPI2 }, { .spi = &SPI3 } };
+
+static sim_spi_host_t* sim_host(spi_dev_t *spi)
+{
+	for (int i = 0; i < 2; i++) {
+		if (sim_hosts[i].spi == spi) return &sim_hosts[i];
+	}
+	return NULL;
+}
+
+esp_err_t esp_intr_alloc(int source, int flags, intr_handler_t handler, void *arg, intr_handle_t *ret_handle)
+{
+	(void)flags;
+	sim_spi_host_t *host;
+	if (source == ETS_SPI2_INTR_SOURCE) host = &sim_hosts[0];
+	else if (source == ETS_SPI3_INTR_SOURCE) host = &sim_hosts[1];
+	else return ESP_ERR_INVALID_ARG;
+	host->isr = handler;
+	host->isr_arg = arg;
+	if (ret_handle) *ret_handle = NULL;
+	return ESP_OK;
+}
+
+SIM_Panel* SIM_PanelAttach(spi_dev_t *spi, int cs_pin, int dc_pin, uint16_t width_controller, uint16_t height_controller)
+{
+	sim_spi_host_t *host = sim_host(spi);
+	if (!host || host->panels_num == SIM_MAX_PANELS) return NULL;
+	SIM_Panel *panel = (SIM_Panel *)calloc(1, sizeof(SIM_Panel));
+	if (!panel) return NULL;
+	panel->side = width_controller > height_controller ? width_controller : height_controller;
+	panel->gram = (uint16_t *)calloc((size_t)panel->side * panel->side, sizeof(uint16_t));
+	if (!panel->gram) {
+		free(panel);
+		return NULL;
+	}
+	panel->cs_pin = cs_pin;
+	panel->dc_pin = dc_pin;
+	panel->xe = panel->ye = panel->side - 1;
+	host->panels[host->panels_num++] = panel;
+	return panel;
+}
+
+uint16_t SIM_PanelGetPixel(SIM_Panel *panel, uint16_t x, uint16_t y)
+{
+	if (x >= panel->side || y >= panel->side) return 0;
+	return panel->gram[y * panel->side + x];
+}
+
+int SIM_PanelSavePPM(SIM_Panel *panel, uint16_t x, uint16_t y, uint16_t w, uint16_t h, const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) return -1;
+	fprintf(f, "P6\n%u %u\n255\n", w, h);
+	for (uint16_t j = 0; j < h; j++) {
+		for (uint16_t i = 0; i < w; i++) {
+			uint16_t c = SIM_PanelGetPixel(panel, x + i, y + j);
+			uint8_t r = (c >> 11) & 0x1F, g = (c >> 5) & 0x3F, b = c & 0x1F;
+			uint8_t rgb[3] = { (uint8_t)((r << 3) | (r >> 2)), (uint8_t)((g << 2) | (g >> 4)), (uint8_t)((b << 3) | (b >> 2)) };
+			fwrite(rgb, 1, 3, f);
+		}
+	}
+	return fclose(f) ? -1 : 0;
+}
+
+void SIM_SpiGetStats(spi_dev_t *spi, SIM_SpiStats *stats)
+{
+	sim_spi_host_t *host = sim_host(spi);
+	if (host) *stats = host->stats;
+	else memset(stats, 0, sizeof(SIM_SpiStats));
+}
+
+void SIM_SpiResetStats(spi_dev_t *spi)
+{
+	sim_spi_host_t *host = sim_host(spi);
+	if (host) memset(&host->stats, 0, sizeof(SIM_SpiStats));
+}
+
+static void sim_panel_command(sim_spi_host_t *host, SIM_Panel *panel, uint8_t cmd)
+{
+	panel->cmd = cmd;
+	panel->par_cnt = 0;
+	panel->pix_phase = 0;
+	if (cmd == SIM_CMD_CASET) {
+		host->stats.windows++;
+	}
+	else if (cmd == SIM_CMD_RAMWR) {
+		panel->x = panel->xs;
+		panel->y = panel->ys;
+	}
+}
+
+static void sim_panel_data(sim_spi_host_t *host, SIM_Panel *panel, const uint8_t *data, uint32_t len)
+{
+	while (len--) {
+		uint8_t b = *data++;
+		switch (panel->cmd) {
+			case SIM_CMD_CASET:
+			case SIM_CMD_RASET:
+				if (panel->par_cnt < 4) panel->par[panel->par_cnt++] = b;
+				if (panel->par_cnt == 4) {
+					uint16_t s = (panel->par[0] << 8) | panel->par[1];
+					uint16_t e = (panel->par[2] << 8) | panel->par[3];
+					if (panel->cmd == SIM_CMD_CASET) { panel->xs = s; panel->xe = e; }
+					else { panel->ys = s; panel->ye = e; }
+					panel->par_cnt = 5;
+				}
+				break;
+			case SIM_CMD_RAMWR:
+				if (!panel->pix_phase) {
+					panel->pix_hi = b;
+					panel->pix_phase = 1;
+					break;
+				}
+				panel->pix_phase = 0;
+				if (panel->x < panel->side && panel->y < panel->side) {
+					panel->gram[panel->y * panel->side + panel->x] = (panel->pix_hi << 8) | b;
+				}
+				host->stats.pixels++;
+				if (++panel->x > panel->xe) {
+					panel->x = panel->xs;
+					if (++panel->y > panel->ye) panel->y = panel->ys;
+				}
+				break;
+			case SIM_CMD_MADCTL:
+				panel->madctl = b;
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+//выдача блока байт на шину: байты получают все выбранные (CS = 0) дисплеи
+static void sim_bus_out(sim_spi_host_t *host, const uint8_t *data, uint32_t len)
+{
+	int dc = -1;
+	for (int i = 0; i < host->panels_num; i++) {
+		SIM_Panel *panel = host->panels[i];
+		if (panel->cs_pin >= 0 && sim_gpio_level(panel->cs_pin)) continue;
+		dc = sim_gpio_level(panel->dc_pin);
+		if (dc) {
+			sim_panel_data(host, panel, data, len);
+		}
+		else {
+			for (uint32_t j = 0; j < len; j++) sim_panel_command(host, panel, data[j]);
+		}
+	}
+	if (dc == 0) host->stats.cmd_bytes += len;
+	else host->stats.data_bytes += len;
+}
+
+static void sim_spi_transfer(sim_spi_host_t *host)
+{
+	spi_dev_t *spi = host->spi;
+	uint32_t bits = spi->mosi_dlen.usr_mosi_dbitlen + 1;
+	uint32_t len = (bits + 7) / 8;
+	host->stats.transactions++;
+	if (host->dma_armed) {
+		host->dma_armed = 0;
+		host->stats.dma_transactions++;
+		sim_lldesc_t *desc = (sim_lldesc_t *)(uintptr_t)(DR_REG_PERIPH_BASE | host->dma_addr);
+		uint32_t left = len;
+		while (left && desc) {
+			uint32_t n = desc->lenght < left ? desc->lenght : left;
+			sim_bus_out(host, (const uint8_t *)desc->buf, n);
+			left -= n;
+			if (desc->eof) break;
+			desc = (sim_lldesc_t *)desc->next_link;
+		}
+	}
+	else {
+		uint32_t offset = spi->user.usr_mosi_highpart ? 32 : 0;
+		if (len > 64 - offset) len = 64 - offset;
+		sim_bus_out(host, (const uint8_t *)spi->data_buf + offset, len);
+	}
+	uint64_t freq = spi->clock.clk_equ_sysclk ? SIM_APB_CLK_FREQ :
+					SIM_APB_CLK_FREQ / ((spi->clock.clkcnt_n + 1ULL) * (spi->clock.clkdiv_pre + 1ULL));
+	host->stats.bus_time_ns += (bits * 1000000000ULL) / freq;
+}
+
+int sim_spi_service(void)
+{
+	int event = 0;
+	for (int i = 0; i < 2; i++) {
+		sim_spi_host_t *host = &sim_hosts[i];
+		spi_dev_t *spi = host->spi;
+		if (spi->dma_out_link.start) {
+			host->dma_addr = spi->dma_out_link.addr;
+			host->dma_armed = 1;
+			spi->dma_out_link.start = 0;
+			spi->dma_rx_status |= 1UL << 30;	//FIFO DMA заполнен
+			event = 1;
+		}
+		if (spi->cmd.usr) {
+			sim_spi_transfer(host);
+			spi->dma_rx_status &= ~(1UL << 30);
+			spi->cmd.usr = 0;
+			event = 1;
+			if (spi->slave.trans_inten) {
+				spi->slave.trans_done = 1;
+				host->stats.interrupts++;
+				if (host->isr) host->isr_pending = 1;
+			}
+		}
+	}
+	return event;
+}
+
+int sim_spi_dispatch_isr(void)
+{
+	int event = 0;
+	for (int i = 0; i < 2; i++) {
+		sim_spi_host_t *host = &sim_hosts[i];
+		if (__atomic_exchange_n(&host->isr_pending, 0, __ATOMIC_ACQ_REL)) {
+			host->isr(host->isr_arg);
+			event = 1;
+		}
+	}
+	return event;
+}
@@ -80,88 +80,70 @@ extern const uint8_t image1_jpg_end[] asm("_binary_image1_jpg_end");
 static uint16_t *render_buf1, *render_buf2; //render buffers
 
 #ifdef RENDER_USE_TWO_CORES
-typedef struct {
-	MGL_OBJ *obj;
-	int x0, y0, x1, y1;
-	uint16_t *data;
-} render_parameters;
-
-render_parameters render1_par, render2_par;
-SemaphoreHandle_t renderSemaphore;
-
-static void Render_task(void *param)
-{
-	render_parameters *par = (render_parameters*)param;
-	MGL_RenderObjects(par->obj, par->x0, par->y0, par->x1, par->y1, par->data);
-	xSemaphoreGive(renderSemaphore);
-	vTaskDelete(NULL);
-}
+static MGL_RENDER_SCHEDULER *render_sched; //render workers pinned to cores 0 and 1
+#else
+#define render_sched	NULL
 #endif
+static MGL_RENDER_TABLE *render_table; //objects of the frame bucketed by their top line
 
 static void Render2D (LCD_Handler *lcd, MGL_OBJ *obj, uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1, int x_c, int y_c)
 {
 	int lines = y1 - y0 + 1;
 	uint32_t w = x1 - x0 + 1;
 	uint16_t *render_ptr = render_buf1;
-	uint8_t use_dma = (lcd->spi_data.dma_channel) ? 1 : 0;
-	LCD_SetActiveWindow(lcd, x0, y0, x1, y1);
-	lcd->cs_control = lcd->dc_control = 1;
-	LCD_ResCS(lcd);
-	LCD_SetDC(lcd);
+	int buffers = render_buf2 ? 2 : 1;
+	int queued = 0; //bands queued for output and not yet sent
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	//a buffer holds RENDER_BUFFER_LINES full lines: narrow windows are sent in taller bands
+	uint32_t band_lines = (RENDER_BUFFER_LINES * lcd->Width) / w;
+	//each band walks only the objects that cross its lines
+	uint8_t use_table = !MGL_RenderTablePrepare(render_table, obj, y_c, y_c + lines - 1);
+	//the window and the bands are sent from the SPI interrupt while the next band is being rendered
+	LCD_QueueSetActiveWindow(lcd, x0, y0, x1, y1);
 	uint32_t r_lines;
 	while (lines) {
-		r_lines = lines < RENDER_BUFFER_LINES ? lines : RENDER_BUFFER_LINES;
-#ifndef RENDER_USE_TWO_CORES
-		MGL_RenderObjects(obj, x_c, y_c, x_c + w - 1, y_c + r_lines - 1, render_ptr);
-#else
-		if (r_lines == 1) {
-			MGL_RenderObjects(obj, x_c, y_c, x_c + w - 1, y_c, render_ptr);
+		r_lines = lines < band_lines ? lines : band_lines;
+		if (queued == buffers) { //wait until the oldest band is sent and its buffer is free
+			ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+			queued--;
+		}
+		if (use_table) {
+			MGL_RenderSchedulerRenderTable(render_sched, render_table, x_c, y_c, x_c + w - 1, y_c + r_lines - 1, render_ptr);
 		}
 		else {
-			uint32_t r_lines_c1, r_lines_c0;
-			r_lines_c0 = r_lines / 2;
-			r_lines_c1 = r_lines - r_lines_c0;
-			render1_par.obj = obj;
-			render1_par.data = render_ptr;
-			render1_par.x0 = x_c;
-			render1_par.y0 = y_c;
-			render1_par.x1 = x_c + w - 1;
-			render1_par.y1 = y_c + r_lines_c1 - 1;
-			render2_par.obj = obj;
-			render2_par.data = render_ptr + r_lines_c1 * w;
-			render2_par.x0 = x_c;
-			render2_par.y0 = y_c + r_lines_c1;
-			render2_par.x1 = x_c + w - 1;
-			render2_par.y1 = y_c + r_lines - 1;
-			xTaskCreatePinnedToCore(Render_task, "render_core0", 2000, (void*)&render1_par, 4, NULL, 0);
-		    xTaskCreatePinnedToCore(Render_task, "render_core1", 2000, (void*)&render2_par, 4, NULL, 1);
-		    xSemaphoreTake(renderSemaphore, portMAX_DELAY);
-		    xSemaphoreTake(renderSemaphore, portMAX_DELAY);
+			MGL_RenderSchedulerRender(render_sched, obj, x_c, y_c, x_c + w - 1, y_c + r_lines - 1, render_ptr);
 		}
-#endif
-		if (use_dma) {
-			LCD_WriteDataDMA(lcd, render_ptr, r_lines * w);
+		LCD_QueueWriteData(lcd, render_ptr, r_lines * w, LCD_QueueNotifyCallback, (void*)task);
+		queued++;
+		if (buffers == 2) {
 			render_ptr = (render_ptr == render_buf1) ? render_buf2 : render_buf1;
 		}
-		else {
-			LCD_WriteData(lcd, render_ptr, r_lines * w);
-		}
 		lines -= r_lines;
 		y_c += r_lines;
 	}
-	lcd->cs_control = lcd->dc_control = 0;
-	if (use_dma) {
-		return;
+	for (; queued; queued--) {
+		ulTaskNotifyTake(pdFALSE, portMAX_DELAY);
+	}
+}
+
+/* renders and sends only the areas of the screen changed since the previous call */
+static void Render2D_Dirty (LCD_Handler *lcd, MGL_OBJ *obj, MGL_DIRTY *dirty)
+{
+	MGL_DirtyCollect(dirty, obj);
+	for (int i = 0; i < dirty->rects_num; i++) {
+		MGL_RECT *r = &dirty->rects[i];
+		Render2D(lcd, obj, r->x1, r->y1, r->x2, r->y2, r->x1, r->y1);
 	}
-	LCD_SetCS(lcd);
+	MGL_DirtyReset(dirty);
 }
 
 void demo(void *par)
 {
 	LCD_Handler *lcd = (LCD_Handler*)par;
 #ifdef RENDER_USE_TWO_CORES
-	renderSemaphore = xSemaphoreCreateCounting(2, 0);
+	render_sched = MGL_RenderSchedulerCreate(2, 2048, 4);
 #endif
+	render_table = MGL_RenderTableCreate(2);
 	//gradients
 	MGL_GRADIENT *grad1 = MGL_GradientCreate(MGL_GRADIENT_LINEAR);
 	MGL_GradientAddColor(grad1, 0,   COLOR_WHITE,    1);
@@ -277,8 +259,10 @@ void demo(void *par)
 	uint32_t frame = 0, counter = 0;
 	int ticks_in_sec = esp_clk_cpu_freq(); //частота cpu, Гц (соответствует количеству тактов за секунду)
 	uint32_t tick = esp_cpu_get_cycle_count();
+	MGL_DIRTY dirty;
+	MGL_DirtyInit(&dirty, 0, 0, lcd->Width - 1, lcd->Height - 1);
 	while (1)  {
-		Render2D(lcd, rect, 0, 0, lcd->Width - 1, lcd->Height - 1, 0, 0);
+		Render2D_Dirty(lcd, rect, &dirty);
 		MGL_ObjectListMove(obj1, z, z1);
 		MGL_ObjectListMove(slider, -z, -z1);
 
@@ -293,6 +277,8 @@ void demo(void *par)
 		if (((MGL_OBJ_TEXT*)text1->object)->y < -30) {
 			((MGL_OBJ_TEXT*)text->object)->y = lcd->Height + 30;
 			((MGL_OBJ_TEXT*)text1->object)->y = lcd->Height + 50;
+			MGL_ObjectInvalidate(text);
+			MGL_ObjectInvalidate(text1);
 		}
 
 		((MGL_OBJ_CIRCLE*)img_obj->object)->r += z2;
@@ -302,16 +288,19 @@ void demo(void *par)
 
 		img_obj->texture->alpha += 10;
 		if (img_obj->texture->alpha > 360) img_obj->texture->alpha %= 360;
+		MGL_ObjectInvalidate(img_obj);
 
 		((MGL_OBJ_SLIDER*)slider->object)->value += z3;
 		if (((MGL_OBJ_SLIDER*)slider->object)->value <= 0 ||
 			((MGL_OBJ_SLIDER*)slider->object)->value >= 100)
 			z3 = -z3;
+		MGL_ObjectInvalidate(slider);
 
 		((MGL_OBJ_SLIDER*)slider1->object)->value += z4;
 		if (((MGL_OBJ_SLIDER*)slider1->object)->value <= 0 ||
 			((MGL_OBJ_SLIDER*)slider1->object)->value >= 100)
 			z4 = -z4;
+		MGL_ObjectInvalidate(slider1);
 
 		loshad_tex.alpha += z5;
 		if (!(counter % 5))  {
@@ -319,6 +308,7 @@ void demo(void *par)
 		}
 		if (loshad_tex.alpha == 20 ||
 			loshad_tex.alpha == -20) z5 = -z5;
+		MGL_ObjectInvalidate(loshad);
 
 		MGL_ObjectMove(melnica, zz1, zz2);
 		if (((MGL_OBJ_RECTANGLE*)melnica->object)->x1 < 0 ||
@@ -337,6 +327,7 @@ void demo(void *par)
 		frame++;
 		if (esp_cpu_get_cycle_count() - tick >= ticks_in_sec) {
 			utoa(frame, &fps_s[6], 10);
+			MGL_ObjectInvalidate(fps);
 			frame = 0;
 			tick = esp_cpu_get_cycle_count();
 		}
@@ -353,11 +344,13 @@ void demo(void *par)
 			}
 			points_list = (MGL_GRADIENT_POINT*)points_list->next;
 		}
+		MGL_GradientInvalidate(grad_fon);
 		step_z6++;
 		if (step_z6 > 20) {
 			step_z6 = 0;
 			z6 = -z6;
 		}
+		MGL_ObjectInvalidate(rect); //the background gradient changes every frame
 	}
 }
 